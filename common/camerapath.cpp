@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "camerapath.hpp"
+
+bool loadCameraPath(const char * path, std::vector<CameraKeyframe> & keyframes){
+	printf("Loading camera path %s...\n", path);
+
+	FILE * file = fopen(path, "r");
+	if( file == NULL ){
+		printf("Impossible to open the file ! Are you in the right path ?\n");
+		return false;
+	}
+
+	keyframes.clear();
+	char line[256];
+	int lineNumber = 0;
+	while( fgets(line, sizeof(line), file) ){
+		lineNumber++;
+		char * p = line;
+		while (*p == ' ' || *p == '\t') p++;
+		if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') continue;
+
+		CameraKeyframe k;
+		if (sscanf(p, "%f %f %f %f %f %f", &k.time, &k.position.x, &k.position.y, &k.position.z, &k.horizontalAngle, &k.verticalAngle) != 6
+		    || (!keyframes.empty() && k.time <= keyframes.back().time)){
+			printf("Camera path %s : bad keyframe on line %d\n", path, lineNumber);
+			fclose(file);
+			return false;
+		}
+		keyframes.push_back(k);
+	}
+	fclose(file);
+
+	if (keyframes.empty()){
+		printf("Camera path %s has no keyframes\n", path);
+		return false;
+	}
+	return true;
+}
+
+bool saveCameraPath(const char * path, const std::vector<CameraKeyframe> & keyframes){
+	FILE * file = fopen(path, "w");
+	if( file == NULL ){
+		printf("Impossible to write camera path %s\n", path);
+		return false;
+	}
+	fprintf(file, "# time x y z horizontalAngle verticalAngle\n");
+	for (size_t i = 0; i < keyframes.size(); i++){
+		const CameraKeyframe & k = keyframes[i];
+		fprintf(file, "%.3f %.4f %.4f %.4f %.5f %.5f\n", k.time, k.position.x, k.position.y, k.position.z, k.horizontalAngle, k.verticalAngle);
+	}
+	fclose(file);
+	return true;
+}
+
+// Uniform Catmull-Rom between p1 and p2
+static float catmullRom(float p0, float p1, float p2, float p3, float t){
+	float t2 = t * t, t3 = t2 * t;
+	return 0.5f * (2.0f * p1 + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+}
+
+CameraKeyframe sampleCameraPath(const std::vector<CameraKeyframe> & keyframes, float time){
+	int count = (int)keyframes.size();
+	float duration = keyframes.back().time - keyframes.front().time;
+	if (count == 1 || duration <= 0.0f) return keyframes.front();
+
+	float t = keyframes.front().time + fmodf(time, duration);
+	int segment = 0;
+	while (segment < count - 2 && t >= keyframes[segment + 1].time) segment++;
+
+	// End tangents reuse the end keyframes
+	const CameraKeyframe & k0 = keyframes[segment > 0 ? segment - 1 : 0];
+	const CameraKeyframe & k1 = keyframes[segment];
+	const CameraKeyframe & k2 = keyframes[segment + 1];
+	const CameraKeyframe & k3 = keyframes[segment + 2 < count ? segment + 2 : count - 1];
+	float u = (t - k1.time) / (k2.time - k1.time);
+
+	CameraKeyframe result;
+	result.time = time;
+	for (int i = 0; i < 3; i++) result.position[i] = catmullRom(k0.position[i], k1.position[i], k2.position[i], k3.position[i], u);
+	result.horizontalAngle = catmullRom(k0.horizontalAngle, k1.horizontalAngle, k2.horizontalAngle, k3.horizontalAngle, u);
+	result.verticalAngle = catmullRom(k0.verticalAngle, k1.verticalAngle, k2.verticalAngle, k3.verticalAngle, u);
+	return result;
+}
@@ -0,0 +1,20 @@
+#ifndef CAMERAPATH_HPP
+#define CAMERAPATH_HPP
+
+// One pose on a scripted camera path, in the same terms as controls.cpp
+struct CameraKeyframe {
+	float time;             // Seconds from the start of the path
+	glm::vec3 position;
+	float horizontalAngle;
+	float verticalAngle;
+};
+
+// Text format : one "time x y z horizontalAngle verticalAngle" keyframe per line, in time order.
+// '#' starts a comment.
+bool loadCameraPath(const char * path, std::vector<CameraKeyframe> & keyframes);
+bool saveCameraPath(const char * path, const std::vector<CameraKeyframe> & keyframes);
+
+// Catmull-Rom spline through the keyframes. Time wraps around, so the path loops.
+CameraKeyframe sampleCameraPath(const std::vector<CameraKeyframe> & keyframes, float time);
+
+#endif
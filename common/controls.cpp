@@ -49,6 +49,43 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 
 
 
+// Camera axes for the current angles
+static void computeCameraAxes(glm::vec3 & direction, glm::vec3 & right, glm::vec3 & up){
+	// Direction : Spherical coordinates to Cartesian coordinates conversion
+	direction = glm::vec3(
+		cos(verticalAngle) * sin(horizontalAngle), 
+		sin(verticalAngle),
+		cos(verticalAngle) * cos(horizontalAngle)
+	);
+	
+	// Right vector
+	right = glm::vec3(
+		sin(horizontalAngle - 3.14f/2.0f), 
+		0,
+		cos(horizontalAngle - 3.14f/2.0f)
+	);
+	
+	// Up vector
+	up = glm::cross( right, direction );
+}
+
+void setCameraPose(glm::vec3 cameraPosition, float cameraHorizontalAngle, float cameraVerticalAngle, float aspectRatio){
+	position = cameraPosition;
+	horizontalAngle = cameraHorizontalAngle;
+	verticalAngle = cameraVerticalAngle;
+
+	glm::vec3 direction, right, up;
+	computeCameraAxes(direction, right, up);
+	ProjectionMatrix = glm::perspective(glm::radians(initialFoV), aspectRatio, 0.1f, 200.0f);
+	ViewMatrix       = glm::lookAt(position, position + direction, up);
+}
+
+void getCameraPose(glm::vec3 & cameraPosition, float & cameraHorizontalAngle, float & cameraVerticalAngle){
+	cameraPosition = position;
+	cameraHorizontalAngle = horizontalAngle;
+	cameraVerticalAngle = verticalAngle;
+}
+
 void computeMatricesFromInputs(){
 
 	
@@ -69,22 +106,8 @@ void computeMatricesFromInputs(){
 	horizontalAngle += mouseSpeed * float(1024/2 - xpos );
 	verticalAngle   += mouseSpeed * float( 768/2 - ypos );
 
-	// Direction : Spherical coordinates to Cartesian coordinates conversion
-	glm::vec3 direction(
-		cos(verticalAngle) * sin(horizontalAngle), 
-		sin(verticalAngle),
-		cos(verticalAngle) * cos(horizontalAngle)
-	);
-	
-	// Right vector
-	glm::vec3 right = glm::vec3(
-		sin(horizontalAngle - 3.14f/2.0f), 
-		0,
-		cos(horizontalAngle - 3.14f/2.0f)
-	);
-	
-	// Up vector
-	glm::vec3 up = glm::cross( right, direction );
+	glm::vec3 direction, right, up;
+	computeCameraAxes(direction, right, up);
 
 	
 	float currentSpeed = speed; 
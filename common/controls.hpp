@@ -2,6 +2,9 @@
 #define CONTROLS_HPP
 
 void computeMatricesFromInputs();
+// Places the camera directly instead of reading the mouse and keyboard (scripted camera paths)
+void setCameraPose(glm::vec3 cameraPosition, float cameraHorizontalAngle, float cameraVerticalAngle, float aspectRatio);
+void getCameraPose(glm::vec3 & cameraPosition, float & cameraHorizontalAngle, float & cameraVerticalAngle);
 glm::mat4 getViewMatrix();
 glm::mat4 getProjectionMatrix();
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <GL/glew.h>
+
+#include "framecapture.hpp"
+
+bool FrameCapture::init(const char * outputPath){
+	path = outputPath;
+	perFrameFiles = strchr(outputPath, '%') != NULL;
+	if (!perFrameFiles){
+		stream = fopen(outputPath, "wb");
+		if (!stream){
+			printf("Impossible to open %s for the capture\n", outputPath);
+			return false;
+		}
+	}
+	streamWidth = streamHeight = 0;
+	mapFailed = sizeChanged = false;
+	stopping = false;
+	writer = std::thread(&FrameCapture::writerLoop, this);
+	return true;
+}
+
+void FrameCapture::cleanup(){
+	if (active()) finish();
+	stopWriter();
+	for (int i = 0; i < FRAME_CAPTURE_RING; i++){
+		if (ring[i].fence) glDeleteSync(ring[i].fence);
+		if (ring[i].buffer) glDeleteBuffers(1, &ring[i].buffer);
+		ring[i] = Readback();
+	}
+	next = pending = 0;
+	spare.clear();
+}
+
+void FrameCapture::capture(GLuint framebuffer, int width, int height){
+	// A stream keeps the size of its first frame
+	if (!perFrameFiles){
+		if (streamWidth == 0){
+			streamWidth = width;
+			streamHeight = height;
+		}else if (width != streamWidth || height != streamHeight){
+			if (!sizeChanged) printf("Capture %s is %d x %d : frames of another size are left out\n", path.c_str(), streamWidth, streamHeight);
+			sizeChanged = true;
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+			return;
+		}
+	}
+
+	// Every slot still in flight : the GPU is a whole ring behind, so this one wait is unavoidable
+	if (pending == FRAME_CAPTURE_RING){
+		readbackWaits++;
+		retire(true);
+	}
+
+	Readback & readback = ring[next];
+	size_t size = (size_t)width * height * 4;
+	if (!readback.buffer) glGenBuffers(1, &readback.buffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+	if (readback.capacity < size){
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		readback.capacity = size;
+	}
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glReadBuffer(framebuffer ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL); // Into the buffer : returns at once
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	readback.width = width;
+	readback.height = height;
+	next = (next + 1) % FRAME_CAPTURE_RING;
+	pending++;
+}
+
+void FrameCapture::update(){
+	while (pending > 0 && retire(false)) {}
+}
+
+void FrameCapture::finish(){
+	while (pending > 0) retire(true);
+	std::unique_lock<std::mutex> lock(mutex);
+	frameWritten.wait(lock, [this]{ return queue.empty() && writing == 0; });
+	if (stream) fflush(stream);
+}
+
+// Copies the oldest readback out and queues it for the writer. Without wait, returns false if the GPU
+// hasn't finished it yet.
+bool FrameCapture::retire(bool wait){
+	Readback & readback = ring[(next + FRAME_CAPTURE_RING - pending) % FRAME_CAPTURE_RING];
+	GLenum status;
+	do status = glClientWaitSync(readback.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000ull : 0);
+	while (wait && status == GL_TIMEOUT_EXPIRED);
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return false;
+	glDeleteSync(readback.fence);
+	readback.fence = 0;
+	pending--;
+
+	// A frame to copy into, once the writer has room for it
+	Frame frame;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (queue.size() + writing >= FRAME_CAPTURE_QUEUE){
+			writerWaits++;
+			frameWritten.wait(lock, [this]{ return queue.size() + writing < FRAME_CAPTURE_QUEUE; });
+		}
+		if (!spare.empty()){
+			frame = std::move(spare.back());
+			spare.pop_back();
+		}
+	}
+	size_t size = (size_t)readback.width * readback.height * 4;
+	frame.pixels.resize(size);
+	frame.width = readback.width;
+	frame.height = readback.height;
+	frame.index = framesCaptured++;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+	const void * pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	if (pixels) memcpy(frame.pixels.data(), pixels, size);
+	else{
+		// Keep the frame count (and so the video's timing) right with a black frame
+		if (!mapFailed) printf("Impossible to map capture frame %u, writing it black\n", frame.index);
+		mapFailed = true;
+		memset(frame.pixels.data(), 0, size);
+	}
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(std::move(frame));
+	}
+	frameQueued.notify_one();
+	return true;
+}
+
+// Writer thread only : one binary PPM, top row first
+void FrameCapture::writeFrame(const Frame & frame, std::vector<unsigned char> & row){
+	FILE * out = stream;
+	if (perFrameFiles){
+		char fileName[1024];
+		snprintf(fileName, sizeof(fileName), path.c_str(), frame.index);
+		out = fopen(fileName, "wb");
+		if (!out){
+			if (!writeFailed) printf("Impossible to write capture frame %s\n", fileName);
+			writeFailed = true;
+			return;
+		}
+	}
+
+	fprintf(out, "P6\n%d %d\n255\n", frame.width, frame.height);
+	row.resize((size_t)frame.width * 3);
+	for (int y = frame.height - 1; y >= 0; y--){
+		const unsigned char * src = &frame.pixels[(size_t)y * frame.width * 4];
+		for (int x = 0; x < frame.width; x++){
+			row[x*3    ] = src[x*4    ];
+			row[x*3 + 1] = src[x*4 + 1];
+			row[x*3 + 2] = src[x*4 + 2];
+		}
+		fwrite(row.data(), 1, row.size(), out);
+	}
+	if (ferror(out) && !writeFailed){
+		printf("Impossible to write capture frame %u to %s\n", frame.index, path.c_str());
+		writeFailed = true;
+	}
+	if (perFrameFiles) fclose(out);
+}
+
+void FrameCapture::writerLoop(){
+	std::vector<unsigned char> row;
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;){
+		frameQueued.wait(lock, [this]{ return stopping || !queue.empty(); });
+		if (queue.empty()) return; // Stopping, and everything is written
+		Frame frame = std::move(queue.front());
+		queue.pop_front();
+		writing++;
+		lock.unlock();
+
+		writeFrame(frame, row);
+
+		lock.lock();
+		writing--;
+		spare.push_back(std::move(frame));
+		frameWritten.notify_all();
+	}
+}
+
+void FrameCapture::stopWriter(){
+	if (writer.joinable()){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		frameQueued.notify_one();
+		writer.join();
+	}
+	if (stream) fclose(stream);
+	stream = NULL;
+}
@@ -0,0 +1,81 @@
+#ifndef FRAMECAPTURE_HPP
+#define FRAMECAPTURE_HPP
+
+// Asynchronous framebuffer readback.
+// capture() issues glReadPixels into one of FRAME_CAPTURE_RING pixel pack buffers and fences it : the
+// call returns at once and the copy runs on the GPU after the frame. update() maps the buffers whose
+// fence has signaled (it never waits on the GPU), copies the pixels out and hands them to a writer
+// thread, which flips them upright, drops alpha and writes them out. A frame thus reaches the writer
+// one or two frames after it was rendered.
+//
+// Output : a path containing a printf integer conversion (frames/%05d.ppm) gets one binary PPM per
+// frame ; any other path gets every frame appended to it as PPM, a stream that ffmpeg encodes with
+//   ffmpeg -f image2pipe -c:v ppm -framerate 60 -i capture.ppm capture.mp4
+// The encoder takes the size of the first frame for the whole stream, so frames of another size (a
+// resized window) are left out of it.
+
+#define FRAME_CAPTURE_RING  3  // Readbacks in flight ; capture() waits on the oldest when all are
+#define FRAME_CAPTURE_QUEUE 8  // Frames waiting for the writer ; update() waits on it when all are
+
+struct FrameCapture {
+	~FrameCapture() { stopWriter(); }
+
+	// Starts the writer. Returns false if outputPath can't be written.
+	bool init(const char * outputPath);
+	// Waits for everything captured, then releases the buffers
+	void cleanup();
+	bool active() const { return writer.joinable(); }
+
+	// Reads width x height pixels of framebuffer's first colour attachment (the back buffer for 0).
+	// Leaves framebuffer bound to GL_READ_FRAMEBUFFER.
+	void capture(GLuint framebuffer, int width, int height);
+	// Hands the readbacks that have completed to the writer. Call once per frame.
+	void update();
+	// Waits for every readback and every write
+	void finish();
+
+	// Statistics : frames handed to the writer, and how often the GPU or the writer had to be waited for
+	unsigned int framesCaptured = 0;
+	unsigned int readbackWaits = 0;
+	unsigned int writerWaits = 0;
+
+private:
+	struct Readback {
+		GLuint buffer;
+		size_t capacity;            // Bytes allocated for buffer
+		GLsync fence;               // 0 when the slot is free
+		int width, height;
+	};
+	struct Frame {
+		std::vector<unsigned char> pixels;  // RGBA, bottom row first
+		int width, height;
+		unsigned int index;
+	};
+
+	bool retire(bool wait);
+	void writeFrame(const Frame & frame, std::vector<unsigned char> & row);
+	void writerLoop();
+	void stopWriter();
+
+	Readback ring[FRAME_CAPTURE_RING] = {};
+	unsigned int next = 0;          // Slot the next capture() uses
+	unsigned int pending = 0;       // Slots with a fence ; the oldest is pending slots before next
+
+	std::string path;
+	bool perFrameFiles = false;
+	FILE * stream = NULL;           // Appended to when !perFrameFiles
+	int streamWidth = 0, streamHeight = 0;  // Size of the stream's first frame
+	std::thread writer;
+	std::deque<Frame> queue;        // Waiting for the writer
+	std::vector<Frame> spare;       // Written ; their pixel storage is reused
+	std::mutex mutex;
+	std::condition_variable frameQueued;
+	std::condition_variable frameWritten;
+	unsigned int writing = 0;       // Frames taken by the writer and not written yet
+	bool stopping = false;
+	bool writeFailed = false;
+	bool mapFailed = false;
+	bool sizeChanged = false;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "jobsystem.hpp"
+
+void JobSystem::start(unsigned int threadCount){
+	if (threadCount == 0){
+		unsigned int cores = std::thread::hardware_concurrency();
+		threadCount = cores > 1 ? cores - 1 : 1;
+	}
+	stopping = false;
+	for (unsigned int i = 0; i < threadCount; i++)
+		workers.push_back(std::thread(&JobSystem::workerLoop, this));
+}
+
+void JobSystem::stop(){
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	jobAvailable.notify_all();
+	for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+	workers.clear();
+}
+
+void JobSystem::submit(std::function<void()> job){
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(std::move(job));
+		jobsInFlight++;
+	}
+	jobAvailable.notify_one();
+}
+
+void JobSystem::postToMainThread(std::function<void()> task){
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		mainThreadTasks.push_back(std::move(task));
+	}
+	mainThreadWake.notify_one();
+}
+
+void JobSystem::workerLoop(){
+	for (;;){
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobAvailable.wait(lock, [this]{ return stopping || !jobs.empty(); });
+			if (jobs.empty()) return; // Stopping, and nothing left to do
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+
+		job();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobsInFlight--;
+		}
+		mainThreadWake.notify_one();
+	}
+}
+
+void JobSystem::waitAndRunMainThreadTasks(){
+	for (;;){
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			mainThreadWake.wait(lock, [this]{ return !mainThreadTasks.empty() || jobsInFlight == 0; });
+			if (mainThreadTasks.empty()) return; // Every job finished and everything they posted has run
+			task = std::move(mainThreadTasks.front());
+			mainThreadTasks.pop_front();
+		}
+		task(); // Outside the lock : it may submit more jobs
+	}
+}
@@ -0,0 +1,39 @@
+#ifndef JOBSYSTEM_HPP
+#define JOBSYSTEM_HPP
+
+// Worker thread pool for CPU-only work (file I/O, parsing, decoding), plus a queue through which
+// workers hand results back to the thread that owns the GL context :
+//
+//	jobs.submit([&]{ /* no GL calls here */ jobs.postToMainThread([&]{ /* GL calls here */ }); });
+//	jobs.waitAndRunMainThreadTasks();
+
+struct JobSystem {
+	~JobSystem() { stop(); }
+
+	// threadCount 0 : one worker per core, leaving one core for the main thread
+	void start(unsigned int threadCount = 0);
+	// Waits for the queued jobs, then joins the workers
+	void stop();
+	unsigned int threadCount() const { return (unsigned int)workers.size(); }
+
+	void submit(std::function<void()> job);
+	void postToMainThread(std::function<void()> task);
+
+	// Main thread only : runs posted tasks as they arrive, until every submitted job
+	// (and every task those jobs posted) is done
+	void waitAndRunMainThreadTasks();
+
+private:
+	void workerLoop();
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::deque<std::function<void()>> mainThreadTasks;
+	std::mutex mutex;
+	std::condition_variable jobAvailable;
+	std::condition_variable mainThreadWake;
+	unsigned int jobsInFlight = 0;  // Submitted and not finished yet
+	bool stopping = false;
+};
+
+#endif
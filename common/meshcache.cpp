@@ -0,0 +1,416 @@
+#include <vector>
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <cstring>
+#include <sys/stat.h>
+
+#include <glm/glm.hpp>
+
+#include "meshcache.hpp"
+#include "objloader.hpp"
+#include "vboindexer.hpp"
+#include "tangentspace.hpp"
+#include "meshsimplify.hpp"
+#include "meshoptimize.hpp"
+
+// Level of detail chain (MESH_CACHE_BUILD_LODS) : targets as fractions of the full index count,
+// and the largest error allowed as a fraction of the bounding radius
+static const float LOD_TARGETS[] = { 0.5f, 0.25f, 0.125f };
+static const float LOD_MAX_ERROR = 0.02f;
+static const float LOD_DEPTH_TARGET = 0.0625f;     // Depth-only level, seams welded
+static const float LOD_DEPTH_MAX_ERROR = 0.04f;
+static const float LOD_MIN_REDUCTION = 0.85f;      // A level is kept only below this fraction of the previous one
+
+static const float OVERDRAW_THRESHOLD = 1.05f;     // ACMR given up for smaller overdraw clusters (see optimizeOverdraw)
+
+// 32 bit FNV-1a. Cheap, and good enough to catch truncated or partially written files.
+static unsigned int fnv1a(const unsigned char * data, size_t size){
+	unsigned int hash = 2166136261u;
+	for (size_t i=0; i<size; i++){
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// float to IEEE half, rounded to nearest ; small values flush to zero, large ones clamp to the largest half
+static unsigned short floatToHalf(float value){
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+	unsigned int sign = (bits >> 16) & 0x8000;
+	int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+	unsigned int mantissa = bits & 0x7FFFFF;
+	if (exponent >= 31)
+		return (unsigned short)(sign | 0x7BFF);
+	if (exponent <= 0){
+		// Subnormal half
+		if (exponent < -10) return (unsigned short)sign;
+		mantissa |= 0x800000;
+		unsigned int shift = (unsigned int)(14 - exponent);
+		unsigned int half = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1) half++;
+		return (unsigned short)(sign | half);
+	}
+	unsigned int half = sign | ((unsigned int)exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000) half++; // A carry into the exponent is still the right value
+	return (unsigned short)half;
+}
+
+// Unit vector to octahedral coordinates in [-1, 1]^2 (decoded in ShadowMapping.vertexshader)
+static glm::vec2 octahedralEncode(glm::vec3 n){
+	float sum = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (sum <= 0.0f) return glm::vec2(0.0f);
+	n /= sum;
+	if (n.z >= 0.0f) return glm::vec2(n.x, n.y);
+	return glm::vec2((1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+	                 (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+}
+
+// Signed normalized GL_INT_2_10_10_10_REV : x, y in 10 bits each, z = 0, w = +1 or -1.
+// -1 is stored as -2, which reads back as -1 under both the GL 3.3 and the GL 4.2 conversion rules.
+static unsigned int packOctahedral(const glm::vec3 & v, float w){
+	glm::vec2 e = octahedralEncode(v);
+	unsigned int x = (unsigned int)(int)floorf(glm::clamp(e.x, -1.0f, 1.0f) * 511.0f + 0.5f) & 0x3FF;
+	unsigned int y = (unsigned int)(int)floorf(glm::clamp(e.y, -1.0f, 1.0f) * 511.0f + 0.5f) & 0x3FF;
+	unsigned int sign = w < 0.0f ? 0x2 : 0x1;
+	return x | (y << 10) | (sign << 30);
+}
+
+static void quantizeVertex(const MeshVertex & in, const glm::vec3 & offset, float invScale, MeshVertexPacked & out){
+	for (int k=0; k<3; k++)
+		out.position[k] = (unsigned short)floorf(glm::clamp((in.position[k] - offset[k]) * invScale, 0.0f, 1.0f) * 65535.0f + 0.5f);
+	out.position[3] = 0;
+	out.uv[0] = floatToHalf(in.uv.x);
+	out.uv[1] = floatToHalf(in.uv.y);
+	out.normal = packOctahedral(in.normal, 1.0f);
+}
+
+static void quantizeVertex(const MeshVertexTBN & in, const glm::vec3 & offset, float invScale, MeshVertexPackedTBN & out){
+	MeshVertex plain = { in.position, in.uv, in.normal };
+	MeshVertexPacked packed;
+	quantizeVertex(plain, offset, invScale, packed);
+	memcpy(&out, &packed, sizeof(packed));
+	float handedness = glm::dot(glm::cross(in.normal, in.tangent), in.bitangent) < 0.0f ? -1.0f : 1.0f;
+	out.tangent = packOctahedral(in.tangent, handedness);
+}
+
+// The compact counterpart of each vertex format
+template <typename Vertex> struct PackedVertexOf;
+template <> struct PackedVertexOf<MeshVertex> { typedef MeshVertexPacked type; };
+template <> struct PackedVertexOf<MeshVertexTBN> { typedef MeshVertexPackedTBN type; };
+
+// Converts vertices to the compact format, recording the dequantization in header
+template <typename Vertex, typename Packed>
+static void quantizeVertices(const std::vector<Vertex> & vertices, MeshCacheHeader & header, std::vector<Packed> & out){
+	glm::vec3 offset(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+	glm::vec3 extent = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]) - offset;
+	float scale = glm::max(extent.x, glm::max(extent.y, extent.z));
+	if (scale <= 0.0f) scale = 1.0f;
+	for (int k=0; k<3; k++) header.quantizeOffset[k] = offset[k];
+	header.quantizeScale = scale;
+
+	out.resize(vertices.size());
+	for (size_t i=0; i<vertices.size(); i++)
+		quantizeVertex(vertices[i], offset, 1.0f / scale, out[i]);
+}
+
+// Returns the modification time of a file, or 0 if it doesn't exist
+static long long fileTime(const char * path){
+	struct stat info;
+	if (stat(path, &info) != 0)
+		return 0;
+	return (long long)info.st_mtime;
+}
+
+bool loadMeshCache(
+	const char * cachePath,
+	const char * sourcePath,
+	unsigned int flags,
+	MeshData & out
+){
+	long long cacheTime = fileTime(cachePath);
+	if (cacheTime == 0)
+		return false;
+	if (sourcePath != NULL && fileTime(sourcePath) > cacheTime)
+		return false; // The OBJ was edited after the cache was written
+
+	FILE * file = fopen(cachePath, "rb");
+	if (file == NULL)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (size < (long)sizeof(MeshCacheHeader)){
+		fclose(file);
+		return false;
+	}
+
+	// One read for the whole mesh
+	out.blob.resize(size);
+	size_t read = fread(out.blob.data(), 1, size, file);
+	fclose(file);
+	if (read != (size_t)size)
+		return false;
+
+	const MeshCacheHeader & header = out.header();
+	size_t payload = (size_t)header.lodCount * sizeof(MeshLod) + (size_t)header.rangeCount * sizeof(MeshDrawRange) +
+	                 (size_t)header.vertexCount * header.vertexStride + (size_t)header.indexCount * header.indexSize;
+	bool valid = header.magic == MESH_CACHE_MAGIC && header.version == MESH_CACHE_VERSION && header.flags == flags &&
+		header.lodCount > 0 && payload == size - sizeof(MeshCacheHeader) &&
+		header.checksum == fnv1a(out.blob.data() + sizeof(MeshCacheHeader), payload);
+	for (unsigned int i=0; valid && i<header.lodCount; i++)
+		valid = (unsigned long long)out.lods()[i].firstRange + out.lods()[i].rangeCount <= header.rangeCount;
+	if (!valid){
+		printf("Mesh cache %s is outdated or corrupt, rebuilding\n", cachePath);
+		out.blob.clear();
+		return false;
+	}
+	return true;
+}
+
+bool saveMeshCache(
+	const char * cachePath,
+	const MeshData & data
+){
+	FILE * file = fopen(cachePath, "wb");
+	if (file == NULL){
+		printf("Could not write mesh cache %s\n", cachePath);
+		return false;
+	}
+	size_t written = fwrite(data.blob.data(), 1, data.blob.size(), file);
+	fclose(file);
+	if (written != data.blob.size()){
+		remove(cachePath); // Never leave a truncated cache behind
+		return false;
+	}
+	return true;
+}
+
+// Appends the simplified levels after the full mesh (ranges and lods[0]) : every range is simplified
+// on its own, so a level keeps the chunks and base vertices of the full mesh.
+// indices are relative to each range's baseVertex.
+template <typename Vertex>
+static void buildMeshLods(
+	const std::vector<Vertex> & vertices,
+	float boundsRadius,
+	std::vector<unsigned int> & indices,
+	std::vector<MeshDrawRange> & ranges,
+	std::vector<MeshLod> & lods
+){
+	std::vector<glm::vec3> positions(vertices.size());
+	for (size_t i=0; i<vertices.size(); i++) positions[i] = vertices[i].position;
+
+	// levels[l][r] : level l of range r, then the depth-only level last
+	size_t levelCount = sizeof(LOD_TARGETS) / sizeof(LOD_TARGETS[0]);
+	std::vector<MeshDrawRange> fullRanges(ranges);
+	std::vector<std::vector<std::vector<unsigned int> > > levels(levelCount + 1, std::vector<std::vector<unsigned int> >(fullRanges.size()));
+	std::vector<float> levelErrors(levelCount + 1, 0.0f);
+	for (size_t r=0; r<fullRanges.size(); r++){
+		const MeshDrawRange & range = fullRanges[r];
+		std::vector<unsigned int> rangeIndices(indices.begin() + range.firstIndex, indices.begin() + range.firstIndex + range.indexCount);
+		for (unsigned int & i : rangeIndices) i += range.baseVertex;
+
+		std::vector<size_t> targets;
+		for (size_t l=0; l<levelCount; l++) targets.push_back((size_t)(range.indexCount * LOD_TARGETS[l]) / 3 * 3);
+		std::vector<std::vector<unsigned int> > simplified;
+		std::vector<float> errors;
+		simplifyIndexedMesh(positions, rangeIndices, targets, LOD_MAX_ERROR * boundsRadius, false, simplified, errors);
+		for (size_t l=0; l<levelCount; l++){
+			optimizeVertexCache(simplified[l], positions.size(), VERTEX_CACHE_SIZE);
+			levels[l][r].swap(simplified[l]);
+			levelErrors[l] = glm::max(levelErrors[l], errors[l]);
+		}
+
+		targets.assign(1, (size_t)(range.indexCount * LOD_DEPTH_TARGET) / 3 * 3);
+		simplifyIndexedMesh(positions, rangeIndices, targets, LOD_DEPTH_MAX_ERROR * boundsRadius, true, simplified, errors);
+		optimizeVertexCache(simplified[0], positions.size(), VERTEX_CACHE_SIZE);
+		levels[levelCount][r].swap(simplified[0]);
+		levelErrors[levelCount] = glm::max(levelErrors[levelCount], errors[0]);
+	}
+
+	// Keep the levels that are worth a switch ; the depth-only one is compared with the last level kept
+	size_t previousCount = indices.size();
+	printf("LOD chain : %d", (int)(previousCount / 3));
+	for (size_t l=0; l<=levelCount; l++){
+		size_t count = 0;
+		for (const std::vector<unsigned int> & level : levels[l]) count += level.size();
+		if (count == 0 || count > previousCount * LOD_MIN_REDUCTION) continue;
+		previousCount = count;
+
+		MeshLod lod = { (unsigned int)ranges.size(), (unsigned int)fullRanges.size(), levelErrors[l], l == levelCount ? (unsigned int)MESH_LOD_DEPTH_ONLY : 0u };
+		for (size_t r=0; r<fullRanges.size(); r++){
+			ranges.push_back({ (unsigned int)indices.size(), (unsigned int)levels[l][r].size(), fullRanges[r].baseVertex });
+			for (unsigned int i : levels[l][r]) indices.push_back(i - fullRanges[r].baseVertex);
+		}
+		lods.push_back(lod);
+		printf(l == levelCount ? " (depth %d)" : " -> %d", (int)(count / 3));
+	}
+	printf(" triangles\n");
+}
+
+// Reorders freshly indexed triangles for the vertex cache (and overdraw with MESH_CACHE_OPTIMIZE_OVERDRAW),
+// then the vertices in order of first use. Prints the ACMR and ATVR before and after.
+template <typename Vertex>
+static void optimizeMeshData(
+	std::vector<unsigned int> & indices,
+	std::vector<Vertex> & vertices,
+	unsigned int flags
+){
+	if (indices.empty()) return;
+	float acmrBefore = computeACMR(indices, vertices.size(), VERTEX_CACHE_SIZE);
+
+	optimizeVertexCache(indices, vertices.size(), VERTEX_CACHE_SIZE);
+	if (flags & MESH_CACHE_OPTIMIZE_OVERDRAW){
+		std::vector<glm::vec3> positions(vertices.size());
+		for (size_t i=0; i<vertices.size(); i++) positions[i] = vertices[i].position;
+		optimizeOverdraw(indices, positions, VERTEX_CACHE_SIZE, OVERDRAW_THRESHOLD);
+	}
+
+	std::vector<unsigned int> remap;
+	optimizeVertexFetch(indices, vertices.size(), remap);
+	std::vector<Vertex> ordered(remap.size());
+	for (size_t i=0; i<remap.size(); i++)
+		ordered[i] = vertices[remap[i]];
+	vertices.swap(ordered);
+
+	float acmrAfter = computeACMR(indices, vertices.size(), VERTEX_CACHE_SIZE);
+	float trianglesPerVertex = (float)(indices.size() / 3) / (float)vertices.size();
+	printf("Vertex cache (%d entries) : ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", VERTEX_CACHE_SIZE,
+		acmrBefore, acmrAfter, acmrBefore * trianglesPerVertex, acmrAfter * trianglesPerVertex);
+}
+
+// Interleaves indexed attributes into the cache layout, computing bounds, levels of detail and checksum.
+// Picks 16 bit indices whenever they fit, otherwise 32 bit, or 16 bit chunks with MESH_CACHE_SPLIT_16BIT.
+template <typename Vertex>
+static void packMeshData(
+	std::vector<unsigned int> & indices,
+	std::vector<Vertex> & vertices,
+	unsigned int flags,
+	MeshData & out
+){
+	std::vector<MeshDrawRange> ranges;
+	bool useShort = true;
+
+	if (vertices.size() <= MESH_CACHE_MAX_16BIT_VERTICES){
+		ranges.push_back({ 0, (unsigned int)indices.size(), 0 });
+	}else if (flags & MESH_CACHE_SPLIT_16BIT){
+		std::vector<unsigned int> remap;
+		std::vector<unsigned short> chunkIndices;
+		std::vector<IndexedChunk> chunks;
+		splitIndexedMesh(indices, vertices.size(), MESH_CACHE_MAX_16BIT_VERTICES, remap, chunkIndices, chunks);
+
+		std::vector<Vertex> chunkVertices(remap.size());
+		for (size_t i=0; i<remap.size(); i++)
+			chunkVertices[i] = vertices[remap[i]];
+		vertices.swap(chunkVertices);
+		indices.assign(chunkIndices.begin(), chunkIndices.end());
+		for (const IndexedChunk & c : chunks)
+			ranges.push_back({ c.firstIndex, c.indexCount, c.baseVertex });
+		printf("Split into %d chunks of 16 bit indices\n", (int)chunks.size());
+	}else{
+		useShort = false;
+		ranges.push_back({ 0, (unsigned int)indices.size(), 0 });
+	}
+
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MESH_CACHE_MAGIC;
+	header.version = MESH_CACHE_VERSION;
+	header.flags = flags;
+	header.vertexCount = vertices.size();
+
+	if (!vertices.empty()){
+		glm::vec3 minP = vertices[0].position, maxP = vertices[0].position;
+		for (const Vertex & v : vertices){ minP = glm::min(minP, v.position); maxP = glm::max(maxP, v.position); }
+		glm::vec3 center = (minP + maxP) * 0.5f;
+		float radius = 0.0f;
+		for (const Vertex & v : vertices) radius = glm::max(radius, glm::length(v.position - center));
+		header.boundsCenter[0] = center.x; header.boundsCenter[1] = center.y; header.boundsCenter[2] = center.z;
+		header.boundsRadius = radius;
+		header.boundsMin[0] = minP.x; header.boundsMin[1] = minP.y; header.boundsMin[2] = minP.z;
+		header.boundsMax[0] = maxP.x; header.boundsMax[1] = maxP.y; header.boundsMax[2] = maxP.z;
+	}
+
+	std::vector<MeshLod> lods(1, MeshLod{ 0, (unsigned int)ranges.size(), 0.0f, 0 });
+	if ((flags & MESH_CACHE_BUILD_LODS) && !indices.empty())
+		buildMeshLods(vertices, header.boundsRadius, indices, ranges, lods);
+
+	std::vector<unsigned short> shortIndices;
+	if (useShort) shortIndices.assign(indices.begin(), indices.end());
+	header.indexCount = indices.size();
+	header.indexSize = useShort ? sizeof(unsigned short) : sizeof(unsigned int);
+	header.rangeCount = ranges.size();
+	header.lodCount = lods.size();
+
+	// Vertices are packed last : the level of detail chain needs the float positions
+	std::vector<typename PackedVertexOf<Vertex>::type> packedVertices;
+	const void * vertexData = vertices.data();
+	header.vertexStride = sizeof(Vertex);
+	if (flags & MESH_CACHE_QUANTIZED){
+		quantizeVertices(vertices, header, packedVertices);
+		vertexData = packedVertices.data();
+		header.vertexStride = sizeof(packedVertices[0]);
+	}
+
+	size_t lodBytes = lods.size() * sizeof(MeshLod);
+	size_t rangeBytes = ranges.size() * sizeof(MeshDrawRange);
+	size_t vertexBytes = vertices.size() * header.vertexStride;
+	size_t indexBytes = indices.size() * header.indexSize;
+	out.blob.resize(sizeof(MeshCacheHeader) + lodBytes + rangeBytes + vertexBytes + indexBytes);
+	unsigned char * payload = out.blob.data() + sizeof(MeshCacheHeader);
+	memcpy(payload, lods.data(), lodBytes);
+	memcpy(payload + lodBytes, ranges.data(), rangeBytes);
+	if (vertexBytes) memcpy(payload + lodBytes + rangeBytes, vertexData, vertexBytes);
+	if (indexBytes) memcpy(payload + lodBytes + rangeBytes + vertexBytes, useShort ? (const void*)shortIndices.data() : (const void*)indices.data(), indexBytes);
+
+	header.checksum = fnv1a(payload, lodBytes + rangeBytes + vertexBytes + indexBytes);
+	memcpy(out.blob.data(), &header, sizeof(header));
+}
+
+bool loadMeshCached(
+	const char * objPath,
+	unsigned int flags,
+	MeshData & out
+){
+	std::string cachePath = std::string(objPath) + ".meshcache";
+	if (loadMeshCache(cachePath.c_str(), objPath, flags, out))
+		return true;
+
+	// Slow path : parse and index the OBJ, then write the cache for next time
+	std::vector<glm::vec3> vertices, normals;
+	std::vector<glm::vec2> uvs;
+	if (!loadOBJ(objPath, vertices, uvs, normals))
+		return false;
+
+	std::vector<unsigned int> indices;
+	std::vector<glm::vec3> i_vertices, i_normals;
+	std::vector<glm::vec2> i_uvs;
+
+	if (flags & MESH_CACHE_HAS_TANGENTS){
+		std::vector<glm::vec3> tangents, bitangents;
+		computeTangentBasis(vertices, uvs, normals, tangents, bitangents);
+
+		std::vector<glm::vec3> i_tangents, i_bitangents;
+		indexVBO_TBN(vertices, uvs, normals, tangents, bitangents, indices,
+		             i_vertices, i_uvs, i_normals, i_tangents, i_bitangents);
+
+		std::vector<MeshVertexTBN> packed(i_vertices.size());
+		for (size_t i=0; i<packed.size(); i++)
+			packed[i] = { i_vertices[i], i_uvs[i], i_normals[i], i_tangents[i], i_bitangents[i] };
+		optimizeMeshData(indices, packed, flags);
+		packMeshData(indices, packed, flags, out);
+	}else{
+		indexVBO(vertices, uvs, normals, indices, i_vertices, i_uvs, i_normals);
+
+		std::vector<MeshVertex> packed(i_vertices.size());
+		for (size_t i=0; i<packed.size(); i++)
+			packed[i] = { i_vertices[i], i_uvs[i], i_normals[i] };
+		optimizeMeshData(indices, packed, flags);
+		packMeshData(indices, packed, flags, out);
+	}
+
+	saveMeshCache(cachePath.c_str(), out);
+	return true;
+}
@@ -0,0 +1,128 @@
+#ifndef MESHCACHE_HPP
+#define MESHCACHE_HPP
+
+// Binary mesh cache.
+// A .meshcache file is the already-indexed, interleaved result of loadOBJ + indexVBO(_TBN),
+// so loading a model is a single read followed by glBufferData, instead of parsing the OBJ.
+// Triangles and vertices are stored in vertex cache order (see meshoptimize.hpp).
+//
+// Layout : [MeshCacheHeader][lodCount * MeshLod][rangeCount * MeshDrawRange][vertexCount * vertexStride bytes][indexCount * indexSize bytes]
+
+#define MESH_CACHE_MAGIC   0x434D4C43 // "CLMC" in ASCII
+#define MESH_CACHE_VERSION 7
+
+#define MESH_CACHE_HAS_TANGENTS 0x1  // Vertices are MeshVertexTBN instead of MeshVertex
+#define MESH_CACHE_SPLIT_16BIT  0x2  // Split meshes over 65536 vertices into 16 bit chunks instead of using 32 bit indices
+#define MESH_CACHE_BUILD_LODS   0x4  // Append simplified index lists (see MeshLod) after the full mesh
+#define MESH_CACHE_OPTIMIZE_OVERDRAW 0x8  // Also order triangle clusters outside-in, at a small vertex cache cost
+#define MESH_CACHE_QUANTIZED    0x10 // Vertices are MeshVertexPacked(TBN) instead of MeshVertex(TBN)
+
+#define MESH_CACHE_MAX_16BIT_VERTICES 65536
+
+// Interleaved vertex, as stored in the cache and in the VBO
+struct MeshVertex {
+	glm::vec3 position; // Layout 0
+	glm::vec2 uv;       // Layout 1
+	glm::vec3 normal;   // Layout 2
+};
+
+// Interleaved vertex for normal-mapped meshes
+struct MeshVertexTBN {
+	glm::vec3 position;  // Layout 0
+	glm::vec2 uv;        // Layout 1
+	glm::vec3 normal;    // Layout 2
+	glm::vec3 tangent;   // Layout 3
+	glm::vec3 bitangent; // Layout 4
+};
+
+// Compact vertex (MESH_CACHE_QUANTIZED), 16 bytes instead of 32.
+// position is 16 bit unsigned normalized : model position = quantizeOffset + position * quantizeScale,
+// a cube around the bounding box (the same scale on every axis keeps normals undistorted).
+// uv is two half floats, normal a GL_INT_2_10_10_10_REV holding the octahedral encoding in x and y.
+struct MeshVertexPacked {
+	unsigned short position[4]; // Layout 0 (w unused)
+	unsigned short uv[2];       // Layout 1
+	unsigned int normal;        // Layout 2
+};
+
+// Compact normal-mapped vertex, 20 bytes instead of 56. The bitangent is not stored :
+// the shader rebuilds it as cross(normal, tangent) * w.
+struct MeshVertexPackedTBN {
+	unsigned short position[4]; // Layout 0
+	unsigned short uv[2];       // Layout 1
+	unsigned int normal;        // Layout 2
+	unsigned int tangent;       // Layout 3 : octahedral tangent in x and y, handedness (+1 or -1) in w
+};
+
+struct MeshCacheHeader {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int flags;
+	unsigned int vertexCount;
+	unsigned int vertexStride;  // Bytes per vertex
+	unsigned int indexCount;
+	unsigned int indexSize;     // 2 (GL_UNSIGNED_SHORT) or 4 (GL_UNSIGNED_INT)
+	unsigned int rangeCount;    // Number of MeshDrawRange records, every level's
+	unsigned int lodCount;      // Number of MeshLod records, at least 1 (the full mesh)
+	unsigned int checksum;      // FNV-1a of everything after the header
+	float boundsCenter[3];      // Model space bounding sphere
+	float boundsRadius;
+	float boundsMin[3];         // Model space axis-aligned box
+	float boundsMax[3];
+	float quantizeOffset[3];    // MESH_CACHE_QUANTIZED : maps the packed positions back to model space
+	float quantizeScale;
+};
+
+// One draw call's worth of a mesh : indices [firstIndex, firstIndex + indexCount), offset by baseVertex.
+// Small meshes have a single range ; split meshes have one per 16 bit chunk.
+struct MeshDrawRange {
+	unsigned int firstIndex;
+	unsigned int indexCount;
+	unsigned int baseVertex;
+};
+
+#define MESH_LOD_DEPTH_ONLY 0x1  // Simplified across the attribute seams : positions only, for depth and shadow passes
+
+// One level of detail : ranges [firstRange, firstRange + rangeCount), drawn with the same vertices.
+// Level 0 is the full mesh ; each following level has fewer indices. The depth-only level, if any, is last.
+struct MeshLod {
+	unsigned int firstRange;
+	unsigned int rangeCount;
+	float error;                // Largest distance (model units) the surface moved from the full mesh
+	unsigned int flags;         // MESH_LOD_XXX
+};
+
+// A loaded (or freshly built) mesh. The whole file lives in one buffer;
+// lods(), ranges(), vertices() and indices() point straight into it.
+struct MeshData {
+	std::vector<unsigned char> blob;
+
+	const MeshCacheHeader & header() const { return *(const MeshCacheHeader*)blob.data(); }
+	const MeshLod * lods() const { return (const MeshLod*)(blob.data() + sizeof(MeshCacheHeader)); }
+	const MeshDrawRange * ranges() const { return (const MeshDrawRange*)(lods() + header().lodCount); }
+	const void * vertices() const { return ranges() + header().rangeCount; }
+	const void * indices() const { return (const unsigned char*)vertices() + (size_t)header().vertexCount * header().vertexStride; }
+};
+
+// Loads objPath through its cache (objPath + ".meshcache"), flags being MESH_CACHE_XXX.
+// The cache is (re)built from the OBJ when missing, stale, corrupt, of another version or made with other flags.
+bool loadMeshCached(
+	const char * objPath,
+	unsigned int flags,
+	MeshData & out
+);
+
+// Reads a cache file. Fails if it is older than sourcePath (when given), or does not validate.
+bool loadMeshCache(
+	const char * cachePath,
+	const char * sourcePath,
+	unsigned int flags,
+	MeshData & out
+);
+
+bool saveMeshCache(
+	const char * cachePath,
+	const MeshData & data
+);
+
+#endif
@@ -0,0 +1,212 @@
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "meshoptimize.hpp"
+
+// FIFO cache simulated with timestamps : v is cached while time - cacheTime[v] < cacheSize.
+// time advances on every miss, so the oldest entry is the one that falls out.
+struct VertexCacheSim {
+	std::vector<unsigned int> cacheTime;
+	unsigned int time;
+	unsigned int cacheSize;
+
+	VertexCacheSim(size_t vertexCount, unsigned int size) : cacheTime(vertexCount, 0), time(size + 1), cacheSize(size) {}
+
+	// Returns 1 on a miss
+	unsigned int access(unsigned int v){
+		if (time - cacheTime[v] < cacheSize) return 0;
+		cacheTime[v] = time++;
+		return 1;
+	}
+	void flush(){ time += cacheSize + 1; }
+};
+
+float computeACMR(
+	const std::vector<unsigned int> & indices,
+	size_t vertexCount,
+	unsigned int cacheSize
+){
+	if (indices.size() < 3) return 0.0f;
+	VertexCacheSim cache(vertexCount, cacheSize);
+	size_t misses = 0;
+	for (unsigned int i : indices) misses += cache.access(i);
+	return (float)misses / (float)(indices.size() / 3);
+}
+
+void optimizeVertexCache(
+	std::vector<unsigned int> & indices,
+	size_t vertexCount,
+	unsigned int cacheSize
+){
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0 || vertexCount == 0) return;
+
+	// Triangles around each vertex (compressed rows), and how many are not emitted yet
+	std::vector<unsigned int> liveTriangles(vertexCount, 0), offsets(vertexCount + 1, 0), adjacency(triangleCount * 3);
+	for (size_t i=0; i<triangleCount*3; i++) liveTriangles[indices[i]]++;
+	for (size_t v=0; v<vertexCount; v++) offsets[v+1] = offsets[v] + liveTriangles[v];
+	{
+		std::vector<unsigned int> cursor(offsets.begin(), offsets.end() - 1);
+		for (size_t i=0; i<triangleCount*3; i++) adjacency[cursor[indices[i]]++] = (unsigned int)(i / 3);
+	}
+
+	std::vector<unsigned int> cacheTime(vertexCount, 0);
+	unsigned int time = cacheSize + 1;
+	std::vector<unsigned char> emitted(triangleCount, 0);
+	std::vector<unsigned int> deadEnd, candidates, out;
+	deadEnd.reserve(triangleCount * 3);
+	out.reserve(triangleCount * 3);
+	size_t scan = 0;
+
+	// Fan out every live triangle around one vertex, then move on to a neighbour that will still be cached
+	long long fanning = indices[0];
+	while (fanning >= 0){
+		unsigned int f = (unsigned int)fanning;
+		candidates.clear();
+		for (unsigned int k=offsets[f]; k<offsets[f+1]; k++){
+			unsigned int t = adjacency[k];
+			if (emitted[t]) continue;
+			emitted[t] = 1;
+			for (int j=0; j<3; j++){
+				unsigned int v = indices[t*3 + j];
+				out.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+				if (time - cacheTime[v] > cacheSize) cacheTime[v] = time++;
+			}
+		}
+
+		// Prefer the oldest candidate that stays cached while its own fan is emitted
+		fanning = -1;
+		int bestPriority = -1;
+		for (unsigned int v : candidates){
+			if (liveTriangles[v] == 0) continue;
+			int priority = 0;
+			if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) priority = (int)(time - cacheTime[v]);
+			if (priority > bestPriority){ bestPriority = priority; fanning = v; }
+		}
+		// Dead end : back to recently used vertices, then to the first one left in the mesh
+		while (fanning < 0 && !deadEnd.empty()){
+			unsigned int v = deadEnd.back();
+			deadEnd.pop_back();
+			if (liveTriangles[v] > 0) fanning = v;
+		}
+		while (fanning < 0 && scan < vertexCount){
+			if (liveTriangles[scan] > 0) fanning = (long long)scan;
+			else scan++;
+		}
+	}
+	indices.swap(out);
+}
+
+void optimizeOverdraw(
+	std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & positions,
+	unsigned int cacheSize,
+	float threshold
+){
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount < 2) return;
+
+	// Hard boundaries : triangles that miss on all three vertices, where the order restarted anyway
+	std::vector<size_t> hard;
+	{
+		VertexCacheSim cache(positions.size(), cacheSize);
+		for (size_t t=0; t<triangleCount; t++){
+			unsigned int misses = 0;
+			for (int k=0; k<3; k++) misses += cache.access(indices[t*3 + k]);
+			if (t == 0 || misses == 3) hard.push_back(t);
+		}
+		hard.push_back(triangleCount);
+	}
+
+	// Soft boundaries : cut a hard cluster once its running ACMR is back to threshold times its own
+	std::vector<size_t> clusters;
+	VertexCacheSim cache(positions.size(), cacheSize);
+	for (size_t h=0; h+1<hard.size(); h++){
+		size_t first = hard[h], last = hard[h+1];
+		cache.flush();
+		size_t clusterMisses = 0;
+		for (size_t i=first*3; i<last*3; i++) clusterMisses += cache.access(indices[i]);
+		float clusterACMR = (float)clusterMisses / (float)(last - first);
+
+		cache.flush();
+		clusters.push_back(first);
+		size_t misses = 0, start = first;
+		for (size_t t=first; t<last; t++){
+			for (int k=0; k<3; k++) misses += cache.access(indices[t*3 + k]);
+			if (t + 1 < last && (float)misses / (float)(t + 1 - start) <= clusterACMR * threshold){
+				clusters.push_back(t + 1);
+				cache.flush();
+				misses = 0;
+				start = t + 1;
+			}
+		}
+	}
+	clusters.push_back(triangleCount);
+
+	// Area-weighted centroid and normal of each cluster and of the whole mesh
+	size_t clusterCount = clusters.size() - 1;
+	std::vector<glm::vec3> centroids(clusterCount, glm::vec3(0.0f)), normals(clusterCount, glm::vec3(0.0f));
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (size_t c=0; c<clusterCount; c++){
+		float area = 0.0f;
+		for (size_t t=clusters[c]; t<clusters[c+1]; t++){
+			const glm::vec3 & p0 = positions[indices[t*3]];
+			const glm::vec3 & p1 = positions[indices[t*3 + 1]];
+			const glm::vec3 & p2 = positions[indices[t*3 + 2]];
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float a = glm::length(n);
+			centroids[c] += (p0 + p1 + p2) * (a / 3.0f);
+			normals[c] += n;
+			area += a;
+		}
+		meshCentroid += centroids[c];
+		meshArea += area;
+		if (area > 0.0f) centroids[c] /= area;
+	}
+	if (meshArea > 0.0f) meshCentroid /= meshArea;
+
+	// Outward-facing clusters far from the centre first
+	std::vector<float> keys(clusterCount, 0.0f);
+	std::vector<unsigned int> order(clusterCount);
+	for (size_t c=0; c<clusterCount; c++){
+		float length = glm::length(normals[c]);
+		if (length > 0.0f) keys[c] = glm::dot(centroids[c] - meshCentroid, normals[c] / length);
+		order[c] = (unsigned int)c;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b){ return keys[a] > keys[b]; });
+
+	std::vector<unsigned int> out;
+	out.reserve(indices.size());
+	for (unsigned int c : order)
+		out.insert(out.end(), indices.begin() + clusters[c]*3, indices.begin() + clusters[c+1]*3);
+	indices.swap(out);
+}
+
+void optimizeVertexFetch(
+	std::vector<unsigned int> & indices,
+	size_t vertexCount,
+	std::vector<unsigned int> & out_remap
+){
+	std::vector<unsigned int> newIndex(vertexCount, 0xFFFFFFFF);
+	out_remap.clear();
+	out_remap.reserve(vertexCount);
+	for (unsigned int & i : indices){
+		if (newIndex[i] == 0xFFFFFFFF){
+			newIndex[i] = (unsigned int)out_remap.size();
+			out_remap.push_back(i);
+		}
+		i = newIndex[i];
+	}
+	for (size_t v=0; v<vertexCount; v++){
+		if (newIndex[v] == 0xFFFFFFFF){
+			newIndex[v] = (unsigned int)out_remap.size();
+			out_remap.push_back((unsigned int)v);
+		}
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef MESHOPTIMIZE_HPP
+#define MESHOPTIMIZE_HPP
+
+// Index and vertex order optimizations, run once on indexed meshes before they are cached.
+// Triangles are reordered for the post-transform vertex cache (Tipsify, Sander, Nehab & Barczak 2007),
+// optionally grouped into clusters drawn outside-in to cut overdraw, then vertices are renumbered
+// in order of first use so fetches walk the vertex buffer forwards.
+
+#define VERTEX_CACHE_SIZE 16 // FIFO entries assumed by the optimizer and the statistics
+
+// Average cache miss ratio : vertices transformed per triangle through a FIFO cache of cacheSize
+// entries. 3 is the worst, 0.5 the limit for large regular grids. The average transform to vertex
+// ratio (ATVR, 1 is the best possible) is ACMR * triangles / vertices.
+float computeACMR(
+	const std::vector<unsigned int> & indices,
+	size_t vertexCount,
+	unsigned int cacheSize
+);
+
+// Reorders the triangles of indices for a cache of cacheSize entries
+void optimizeVertexCache(
+	std::vector<unsigned int> & indices,
+	size_t vertexCount,
+	unsigned int cacheSize
+);
+
+// Splits cache-optimized triangles into clusters where the cache restarts (or where the ACMR
+// since the cluster start has dropped to threshold times the whole cluster's), then sorts the
+// clusters so those facing away from the mesh centre come first : they tend to hide the inner ones.
+// threshold (e.g. 1.05) bounds the ACMR given up for smaller clusters.
+void optimizeOverdraw(
+	std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & positions,
+	unsigned int cacheSize,
+	float threshold
+);
+
+// Renumbers vertices in order of first use (unused ones go last).
+// out_remap[i] is the old index of new vertex i ; the caller reorders its vertex arrays with it.
+void optimizeVertexFetch(
+	std::vector<unsigned int> & indices,
+	size_t vertexCount,
+	std::vector<unsigned int> & out_remap
+);
+
+#endif
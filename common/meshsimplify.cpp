@@ -0,0 +1,247 @@
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+#include "meshsimplify.hpp"
+
+// Symmetric 4x4 error quadric (Garland & Heckbert), upper triangle :
+// aa ab ac ad bb bc bd cc cd dd for the plane ax + by + cz + d = 0
+struct Quadric {
+	double m[10];
+};
+
+static void addPlane(Quadric & q, double a, double b, double c, double d){
+	q.m[0] += a*a; q.m[1] += a*b; q.m[2] += a*c; q.m[3] += a*d;
+	q.m[4] += b*b; q.m[5] += b*c; q.m[6] += b*d;
+	q.m[7] += c*c; q.m[8] += c*d;
+	q.m[9] += d*d;
+}
+
+// Sum of squared distances from p to every plane in q
+static double evaluate(const Quadric & q, const glm::vec3 & p){
+	double x = p.x, y = p.y, z = p.z;
+	double e = q.m[0]*x*x + 2*q.m[1]*x*y + 2*q.m[2]*x*z + 2*q.m[3]*x
+	         + q.m[4]*y*y + 2*q.m[5]*y*z + 2*q.m[6]*y
+	         + q.m[7]*z*z + 2*q.m[8]*z
+	         + q.m[9];
+	return e > 0.0 ? e : 0.0;
+}
+
+// Collapsing u onto v, as popped from the queue. Stale once either vertex has changed since.
+struct Collapse {
+	double cost;
+	unsigned int u, v;
+	unsigned int stampU, stampV;
+	bool operator>(const Collapse & other) const { return cost > other.cost; }
+};
+
+static glm::vec3 triangleNormal(const glm::vec3 & a, const glm::vec3 & b, const glm::vec3 & c){
+	return glm::cross(b - a, c - a);
+}
+
+void simplifyIndexedMesh(
+	const std::vector<glm::vec3> & positions,
+	const std::vector<unsigned int> & indices,
+	const std::vector<size_t> & targetIndexCounts,
+	float maxError,
+	bool weldSeams,
+
+	std::vector<std::vector<unsigned int> > & out_lods,
+	std::vector<float> & out_errors
+){
+	size_t vertexCount = positions.size();
+	size_t triangleCount = indices.size() / 3;
+	out_lods.clear();
+	out_errors.clear();
+
+	std::vector<unsigned int> triangles(indices);
+	std::vector<unsigned char> locked(vertexCount, 0);
+	{
+		// Vertices sharing a position : welded onto the first one, or locked so the seam stays closed
+		std::vector<unsigned char> used(vertexCount, 0);
+		for (unsigned int i : indices) used[i] = 1;
+		std::vector<unsigned int> order;
+		for (size_t i=0; i<vertexCount; i++) if (used[i]) order.push_back((unsigned int)i);
+		auto less = [&](unsigned int a, unsigned int b){
+			const glm::vec3 & pa = positions[a];
+			const glm::vec3 & pb = positions[b];
+			if (pa.x != pb.x) return pa.x < pb.x;
+			if (pa.y != pb.y) return pa.y < pb.y;
+			return pa.z < pb.z;
+		};
+		std::stable_sort(order.begin(), order.end(), less);
+		std::vector<unsigned int> weld(vertexCount);
+		for (size_t i=0; i<vertexCount; i++) weld[i] = (unsigned int)i;
+		for (size_t i=1; i<order.size(); i++){
+			if (less(order[i-1], order[i])) continue;
+			if (weldSeams) weld[order[i]] = weld[order[i-1]];
+			else locked[order[i-1]] = locked[order[i]] = 1;
+		}
+		if (weldSeams){
+			for (unsigned int & i : triangles) i = weld[i];
+		}
+
+		// Open and non-manifold edges are locked too, so outlines don't shrink
+		std::vector<unsigned long long> edges;
+		edges.reserve(triangles.size());
+		for (size_t t=0; t<triangleCount; t++){
+			for (int e=0; e<3; e++){
+				unsigned long long a = triangles[t*3 + e], b = triangles[t*3 + (e+1)%3];
+				edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i=0; i<edges.size(); ){
+			size_t j = i;
+			while (j < edges.size() && edges[j] == edges[i]) j++;
+			if (j - i != 2){
+				locked[edges[i] >> 32] = 1;
+				locked[edges[i] & 0xFFFFFFFFull] = 1;
+			}
+			i = j;
+		}
+	}
+
+	// The triangles around each vertex (dead ones are skipped, and pruned after each collapse)
+	std::vector<unsigned char> alive(triangleCount, 1);
+	std::vector<std::vector<unsigned int> > vertexTriangles(vertexCount);
+	for (size_t t=0; t<triangleCount; t++)
+		for (int k=0; k<3; k++) vertexTriangles[triangles[t*3 + k]].push_back((unsigned int)t);
+	size_t aliveTriangles = triangleCount;
+
+	// Each vertex starts with the planes of the triangles around it
+	std::vector<Quadric> quadrics(vertexCount);
+	memset(quadrics.data(), 0, quadrics.size() * sizeof(Quadric));
+	for (size_t t=0; t<triangleCount; t++){
+		if (triangles[t*3] == triangles[t*3+1] || triangles[t*3+1] == triangles[t*3+2] || triangles[t*3] == triangles[t*3+2]){
+			alive[t] = 0; // Degenerate once welded
+			aliveTriangles--;
+			continue;
+		}
+		const glm::vec3 & p0 = positions[triangles[t*3]];
+		glm::vec3 n = triangleNormal(p0, positions[triangles[t*3+1]], positions[triangles[t*3+2]]);
+		float length = glm::length(n);
+		if (length <= 0.0f) continue;
+		n /= length;
+		double d = -(double)glm::dot(n, p0);
+		for (int k=0; k<3; k++) addPlane(quadrics[triangles[t*3 + k]], n.x, n.y, n.z, d);
+	}
+
+	std::vector<unsigned int> stamps(vertexCount, 0);
+	std::vector<unsigned char> removed(vertexCount, 0);
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse> > queue;
+
+	auto push = [&](unsigned int u, unsigned int v){
+		if (locked[u] || u == v) return;
+		Quadric q;
+		for (int i=0; i<10; i++) q.m[i] = quadrics[u].m[i] + quadrics[v].m[i];
+		queue.push({ evaluate(q, positions[v]), u, v, stamps[u], stamps[v] });
+	};
+	// Both directions of every edge around vertex a
+	auto pushAround = [&](unsigned int a){
+		for (unsigned int t : vertexTriangles[a]){
+			if (!alive[t]) continue;
+			for (int k=0; k<3; k++){
+				unsigned int b = triangles[t*3 + k];
+				if (b == a) continue;
+				push(a, b);
+				push(b, a);
+			}
+		}
+	};
+	for (size_t t=0; t<triangleCount; t++){
+		if (!alive[t]) continue;
+		for (int k=0; k<3; k++) push(triangles[t*3 + k], triangles[t*3 + (k+1)%3]);
+		for (int k=0; k<3; k++) push(triangles[t*3 + (k+1)%3], triangles[t*3 + k]);
+	}
+
+	std::vector<unsigned int> neighboursU, neighboursV;
+	auto gatherNeighbours = [&](unsigned int a, std::vector<unsigned int> & out){
+		out.clear();
+		for (unsigned int t : vertexTriangles[a]){
+			if (!alive[t]) continue;
+			for (int k=0; k<3; k++) if (triangles[t*3 + k] != a) out.push_back(triangles[t*3 + k]);
+		}
+		std::sort(out.begin(), out.end());
+		out.erase(std::unique(out.begin(), out.end()), out.end());
+	};
+
+	// u -> v keeps the surface manifold (their shared neighbours are exactly the far corners of
+	// the triangles on the edge) and flips or folds none of u's other triangles
+	auto isValid = [&](unsigned int u, unsigned int v){
+		int sharedTriangles = 0;
+		for (unsigned int t : vertexTriangles[u]){
+			if (!alive[t]) continue;
+			unsigned int * tri = &triangles[t*3];
+			if (tri[0] == v || tri[1] == v || tri[2] == v){ sharedTriangles++; continue; }
+
+			glm::vec3 p[3], q[3];
+			for (int k=0; k<3; k++){
+				p[k] = positions[tri[k]];
+				q[k] = tri[k] == u ? positions[v] : p[k];
+			}
+			glm::vec3 before = triangleNormal(p[0], p[1], p[2]);
+			glm::vec3 after = triangleNormal(q[0], q[1], q[2]);
+			float lengths = glm::length(before) * glm::length(after);
+			if (lengths <= 0.0f || glm::dot(before, after) < 0.2f * lengths) return false;
+		}
+		if (sharedTriangles == 0) return false; // No longer an edge
+
+		gatherNeighbours(u, neighboursU);
+		gatherNeighbours(v, neighboursV);
+		int common = 0;
+		for (size_t i=0, j=0; i<neighboursU.size() && j<neighboursV.size(); ){
+			if (neighboursU[i] < neighboursV[j]) i++;
+			else if (neighboursV[j] < neighboursU[i]) j++;
+			else { common++; i++; j++; }
+		}
+		return common == sharedTriangles;
+	};
+
+	double error = 0.0;
+	for (size_t target : targetIndexCounts){
+		while (aliveTriangles * 3 > target && !queue.empty() && std::sqrt(queue.top().cost) <= maxError){
+			Collapse c = queue.top();
+			queue.pop();
+			if (removed[c.u] || removed[c.v] || stamps[c.u] != c.stampU || stamps[c.v] != c.stampV)
+				continue;
+			if (!isValid(c.u, c.v))
+				continue;
+
+			// Move u onto v : triangles on the edge disappear, the others now use v
+			for (unsigned int t : vertexTriangles[c.u]){
+				if (!alive[t]) continue;
+				unsigned int * tri = &triangles[t*3];
+				if (tri[0] == c.v || tri[1] == c.v || tri[2] == c.v){
+					alive[t] = 0;
+					aliveTriangles--;
+					continue;
+				}
+				for (int k=0; k<3; k++) if (tri[k] == c.u) tri[k] = c.v;
+				vertexTriangles[c.v].push_back(t);
+			}
+			std::vector<unsigned int>().swap(vertexTriangles[c.u]);
+			std::vector<unsigned int> & around = vertexTriangles[c.v];
+			around.erase(std::remove_if(around.begin(), around.end(), [&](unsigned int t){ return !alive[t]; }), around.end());
+
+			for (int i=0; i<10; i++) quadrics[c.v].m[i] += quadrics[c.u].m[i];
+			removed[c.u] = 1;
+			stamps[c.u]++;
+			stamps[c.v]++;
+			error = std::max(error, std::sqrt(c.cost));
+			pushAround(c.v);
+		}
+
+		std::vector<unsigned int> lod;
+		lod.reserve(aliveTriangles * 3);
+		for (size_t t=0; t<triangleCount; t++)
+			if (alive[t]) lod.insert(lod.end(), &triangles[t*3], &triangles[t*3] + 3);
+		out_lods.push_back(lod);
+		out_errors.push_back((float)error);
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef MESHSIMPLIFY_HPP
+#define MESHSIMPLIFY_HPP
+
+// Quadric edge-collapse simplification (Garland & Heckbert) for level-of-detail chains.
+// Vertices are collapsed onto a neighbour, never moved, so every level indexes the input vertex
+// array unchanged. Attribute seams (positions shared by several vertices) and open borders are kept.
+//
+// targetIndexCounts is decreasing ; out_lods receives one index list per entry, out_errors the
+// largest distance (in model units) the surface may have moved at that level. No collapse costs more
+// than maxError, so a level keeps more indices than its target once the cheap collapses run out.
+// weldSeams ignores the seams (vertices sharing a position become one) : for depth-only passes,
+// where the other attributes don't matter and much coarser levels are possible.
+void simplifyIndexedMesh(
+	const std::vector<glm::vec3> & positions,
+	const std::vector<unsigned int> & indices,
+	const std::vector<size_t> & targetIndexCounts,
+	float maxError,
+	bool weldSeams,
+
+	std::vector<std::vector<unsigned int> > & out_lods,
+	std::vector<float> & out_errors
+);
+
+#endif
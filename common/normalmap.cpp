@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include <GL/glew.h>
+
+#include "texture.hpp"
+#include "normalmap.hpp"
+
+#define DXGI_FORMAT_BC5_UNORM 83
+
+// Returns the modification time of a file, or 0 if it doesn't exist
+static long long fileTime(const char * path){
+	struct stat info;
+	if (stat(path, &info) != 0)
+		return 0;
+	return (long long)info.st_mtime;
+}
+
+// One mipmap level of unit normals, 3 floats per texel
+struct NormalLevel {
+	unsigned int width, height;
+	std::vector<float> texels;
+};
+
+// 2x2 box filter of the level above, renormalized. Odd sizes repeat the last row / column.
+static NormalLevel downsample(const NormalLevel & src){
+	NormalLevel dst;
+	dst.width  = src.width  > 1 ? src.width  / 2 : 1;
+	dst.height = src.height > 1 ? src.height / 2 : 1;
+	dst.texels.resize((size_t)dst.width * dst.height * 3);
+	for (unsigned int y = 0; y < dst.height; y++){
+		for (unsigned int x = 0; x < dst.width; x++){
+			float n[3] = { 0.0f, 0.0f, 0.0f };
+			for (unsigned int dy = 0; dy < 2; dy++){
+				for (unsigned int dx = 0; dx < 2; dx++){
+					unsigned int sx = x * 2 + dx < src.width  ? x * 2 + dx : src.width  - 1;
+					unsigned int sy = y * 2 + dy < src.height ? y * 2 + dy : src.height - 1;
+					const float * t = &src.texels[((size_t)sy * src.width + sx) * 3];
+					n[0] += t[0]; n[1] += t[1]; n[2] += t[2];
+				}
+			}
+			float length = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+			float * out = &dst.texels[((size_t)y * dst.width + x) * 3];
+			if (length > 0.0f){
+				out[0] = n[0] / length; out[1] = n[1] / length; out[2] = n[2] / length;
+			} else {
+				out[0] = 0.0f; out[1] = 0.0f; out[2] = 1.0f; // Opposing normals cancelled out : flat
+			}
+		}
+	}
+	return dst;
+}
+
+// One BC4 block (8 bytes) for 16 unsigned values : the two endpoints, then 3 bit palette indices.
+// With endpoint0 > endpoint1 the palette is 8 values, evenly spaced between them.
+static void encodeBC4(const unsigned char values[16], unsigned char * block){
+	unsigned char lo = 255, hi = 0;
+	for (int i = 0; i < 16; i++){
+		if (values[i] < lo) lo = values[i];
+		if (values[i] > hi) hi = values[i];
+	}
+	block[0] = hi;
+	block[1] = lo;
+	memset(block + 2, 0, 6);
+	if (hi == lo)
+		return; // Every index 0 : the block is endpoint0
+
+	int palette[8];
+	palette[0] = hi;
+	palette[1] = lo;
+	for (int i = 1; i < 7; i++)
+		palette[i + 1] = ((7 - i) * hi + i * lo) / 7;
+
+	unsigned long long indices = 0;
+	for (int i = 0; i < 16; i++){
+		int best = 0, bestError = 256;
+		for (int p = 0; p < 8; p++){
+			int error = abs(palette[p] - (int)values[i]);
+			if (error < bestError){ bestError = error; best = p; }
+		}
+		indices |= (unsigned long long)best << (3 * i);
+	}
+	for (int i = 0; i < 6; i++)
+		block[2 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+// [-1, 1] to the byte the shader's * 2.0 - 1.0 turns back into it
+static unsigned char toUnorm8(float v){
+	float scaled = v * 127.5f + 127.5f + 0.5f;
+	return (unsigned char)(scaled < 0.0f ? 0.0f : scaled > 255.0f ? 255.0f : scaled);
+}
+
+// Appends a level as BC5 : a BC4 block of X, then one of Y, per 4x4 texels
+static void encodeBC5(const NormalLevel & level, std::vector<unsigned char> & out){
+	for (unsigned int by = 0; by < level.height; by += 4){
+		for (unsigned int bx = 0; bx < level.width; bx += 4){
+			unsigned char xs[16], ys[16];
+			for (int i = 0; i < 16; i++){
+				unsigned int x = bx + (i & 3) < level.width  ? bx + (i & 3) : level.width  - 1;
+				unsigned int y = by + (i >> 2) < level.height ? by + (i >> 2) : level.height - 1;
+				const float * t = &level.texels[((size_t)y * level.width + x) * 3];
+				xs[i] = toUnorm8(t[0]);
+				ys[i] = toUnorm8(t[1]);
+			}
+			unsigned char block[16];
+			encodeBC4(xs, block);
+			encodeBC4(ys, block + 8);
+			out.insert(out.end(), block, block + 16);
+		}
+	}
+}
+
+// Writes a DX10 DDS holding data (mipMapCount BC5 levels)
+static bool writeBC5DDS(const char * path, unsigned int width, unsigned int height, unsigned int mipMapCount,
+	const std::vector<unsigned char> & data){
+
+	unsigned int header[31];
+	memset(header, 0, sizeof(header));
+	header[0] = 124;                                  // dwSize
+	header[1] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000;   // CAPS | HEIGHT | WIDTH | PIXELFORMAT | MIPMAPCOUNT
+	header[2] = height;
+	header[3] = width;
+	header[6] = mipMapCount;
+	header[18] = 32;                                  // ddspf.dwSize
+	header[19] = 0x4;                                 // DDPF_FOURCC
+	memcpy(&header[20], "DX10", 4);
+	header[26] = 0x1000 | 0x400000 | 0x8;             // TEXTURE | MIPMAP | COMPLEX
+	unsigned int dx10[5] = { DXGI_FORMAT_BC5_UNORM, 3 /* TEXTURE2D */, 0, 1, 0 };
+
+	FILE * file = fopen(path, "wb");
+	if (file == NULL){
+		printf("Could not write normal map cache %s\n", path);
+		return false;
+	}
+	bool ok = fwrite("DDS ", 1, 4, file) == 4 &&
+		fwrite(header, sizeof(header), 1, file) == 1 &&
+		fwrite(dx10, sizeof(dx10), 1, file) == 1 &&
+		fwrite(data.data(), 1, data.size(), file) == data.size();
+	fclose(file);
+	if (!ok)
+		remove(path); // Never leave a truncated cache behind
+	return ok;
+}
+
+static bool buildNormalMapCache(const char * imagepath, const char * cachePath){
+	unsigned int width, height;
+	unsigned char * bgr = readBMPImage(imagepath, width, height);
+	if (bgr == NULL)
+		return false;
+	printf("Compressing %s to BC5\n", imagepath);
+
+	// Unpack to unit vectors ; the BMP stores B, G, R = Z, Y, X
+	NormalLevel level;
+	level.width = width;
+	level.height = height;
+	level.texels.resize((size_t)width * height * 3);
+	for (size_t i = 0; i < (size_t)width * height; i++){
+		float n[3] = { bgr[i*3+2] / 127.5f - 1.0f, bgr[i*3+1] / 127.5f - 1.0f, bgr[i*3+0] / 127.5f - 1.0f };
+		float length = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+		if (length == 0.0f){ n[2] = 1.0f; length = 1.0f; }
+		for (int c = 0; c < 3; c++) level.texels[i*3+c] = n[c] / length;
+	}
+	delete [] bgr;
+
+	std::vector<unsigned char> data;
+	unsigned int mipMapCount = 0;
+	while (true){
+		encodeBC5(level, data);
+		mipMapCount++;
+		if (level.width == 1 && level.height == 1)
+			break;
+		level = downsample(level);
+	}
+	return writeBC5DDS(cachePath, width, height, mipMapCount, data);
+}
+
+bool readNormalMapCached(const char * imagepath, DDSImage & image){
+	std::string cachePath = std::string(imagepath) + ".bc5.dds";
+
+	long long cacheTime = fileTime(cachePath.c_str());
+	if (cacheTime != 0 && cacheTime >= fileTime(imagepath)){
+		if (readDDSImage(cachePath.c_str(), image)){
+			if (image.format == GL_COMPRESSED_RG_RGTC2)
+				return true;
+			freeDDSImage(image);
+		}
+		printf("Normal map cache %s is outdated or corrupt, rebuilding\n", cachePath.c_str());
+	}
+
+	if (!buildNormalMapCache(imagepath, cachePath.c_str()))
+		return false;
+	return readDDSImage(cachePath.c_str(), image);
+}
@@ -0,0 +1,15 @@
+#ifndef NORMALMAP_HPP
+#define NORMALMAP_HPP
+
+// Compressed normal maps.
+// A tangent-space normal map is stored as two-channel BC5 (RGTC2) with a precomputed mipmap chain :
+// X in red, Y in green, Z rebuilt in the shader as sqrt(1 - x*x - y*y).
+// That is 1 byte per texel instead of 3, and the mipmaps are averaged and renormalized as normals
+// rather than as colours by glGenerateMipmap.
+
+// Loads imagepath (a 24 bpp .BMP) through its cache (imagepath + ".bc5.dds"), a DX10 DDS.
+// The cache is (re)built from the BMP when missing, older than it, or unreadable.
+// image is a memory-mapped DDSImage ; freeDDSImage() it when done. No GL calls.
+bool readNormalMapCached(const char * imagepath, DDSImage & image);
+
+#endif
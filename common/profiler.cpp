@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "shader.hpp"
+#include "profiler.hpp"
+
+// Overlay scale : 16.6 ms (60 Hz) is this many pixels
+static const float OVERLAY_BUDGET_MS = 1000.0f / 60.0f;
+static const float OVERLAY_BAR_WIDTH = 400.0f;
+static const float OVERLAY_GRAPH_HEIGHT = 100.0f;
+
+// Scope colours, cycled in scope order (the same order printSummary() lists them in)
+static const float SCOPE_COLORS[8][3] = {
+	{ 0.90f, 0.30f, 0.25f }, { 0.95f, 0.65f, 0.20f }, { 0.95f, 0.90f, 0.30f }, { 0.45f, 0.85f, 0.35f },
+	{ 0.30f, 0.75f, 0.85f }, { 0.35f, 0.45f, 0.95f }, { 0.70f, 0.40f, 0.90f }, { 0.90f, 0.45f, 0.70f },
+};
+
+double FrameProfiler::now() const {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool FrameProfiler::init(){
+	overlayProgram = LoadShaders("shaders/ProfilerOverlay.vertexshader", "shaders/ProfilerOverlay.fragmentshader");
+	if (overlayProgram == 0) return false;
+	overlayScreenSizeID = glGetUniformLocation(overlayProgram, "ScreenSize");
+
+	glGenVertexArrays(1, &overlayVao);
+	glBindVertexArray(overlayVao);
+	glGenBuffers(1, &overlayBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, overlayBuffer);
+	glEnableVertexAttribArray(0); glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+	glEnableVertexAttribArray(1); glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(2 * sizeof(float)));
+	glBindVertexArray(0);
+
+	for (int i = 0; i < PROFILER_FRAME_LATENCY; i++) ring[i].pending = false;
+	return true;
+}
+
+bool FrameProfiler::openDump(const char * path){
+	dumpFile = fopen(path, "w");
+	if (!dumpFile){
+		printf("Impossible to open profile dump %s\n", path);
+		return false;
+	}
+	size_t length = strlen(path);
+	dumpJson = length >= 5 && strcmp(path + length - 5, ".json") == 0;
+	dumpFirst = true;
+	if (dumpJson) fprintf(dumpFile, "[\n");
+	else          fprintf(dumpFile, "frame,source,name,value\n");
+	return true;
+}
+
+void FrameProfiler::cleanup(){
+	if (dumpFile){
+		if (active) flush(); // The last frames in flight still belong in the dump
+		if (dumpJson) fprintf(dumpFile, "\n]\n");
+		fclose(dumpFile);
+		dumpFile = NULL;
+	}
+	for (int i = 0; i < PROFILER_FRAME_LATENCY; i++){
+		if (!ring[i].queries.empty()) glDeleteQueries((GLsizei)ring[i].queries.size(), ring[i].queries.data());
+		ring[i].queries.clear();
+	}
+	if (overlayBuffer) glDeleteBuffers(1, &overlayBuffer);
+	if (overlayVao) glDeleteVertexArrays(1, &overlayVao);
+	if (overlayProgram) glDeleteProgram(overlayProgram);
+	overlayBuffer = overlayVao = overlayProgram = 0;
+}
+
+void FrameProfiler::beginFrame(){
+	// Turning the profiler (back) on starts from a clean ring
+	if (enabled && !active){
+		for (int i = 0; i < PROFILER_FRAME_LATENCY; i++) ring[i].pending = false;
+	}
+	active = enabled;
+	frameIndex++;
+	if (!active) return;
+
+	// This slot was last used PROFILER_FRAME_LATENCY frames ago ; its queries should be done by now
+	current = &ring[frameIndex % PROFILER_FRAME_LATENCY];
+	if (current->pending) collect(*current);
+
+	ProfileFrame & frame = current->frame;
+	frame.frame = frameIndex;
+	frame.cpu.clear();
+	frame.gpu.clear();
+	memset(&frame.counters, 0, sizeof(frame.counters));
+	current->pending = true;
+	cpuStack.clear();
+	cpuStarts.clear();
+	gpuScopeOpen = false;
+	frameStart = now();
+}
+
+void FrameProfiler::endFrame(){
+	if (!active) return;
+	if (gpuScopeOpen) endGpuScope();
+	while (!cpuStack.empty()) endCpuScope();
+	current->frame.cpuMs = now() - frameStart;
+}
+
+void FrameProfiler::flush(){
+	glFinish();
+	for (unsigned long long frame = frameIndex + 1; frame <= frameIndex + PROFILER_FRAME_LATENCY; frame++){
+		PendingFrame & slot = ring[frame % PROFILER_FRAME_LATENCY];
+		if (slot.pending) collect(slot);
+	}
+}
+
+void FrameProfiler::collect(PendingFrame & slot){
+	ProfileFrame & frame = slot.frame;
+	slot.pending = false;
+
+	// Queries finish in order, so the last one being ready means they all are
+	frame.gpuMs = 0.0;
+	GLuint available = GL_TRUE;
+	if (!frame.gpu.empty()) glGetQueryObjectuiv(slot.queries[frame.gpu.size() - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (available){
+		for (size_t i = 0; i < frame.gpu.size(); i++){
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(slot.queries[i], GL_QUERY_RESULT, &elapsed);
+			frame.gpu[i].ms = elapsed / 1.0e6;
+			frame.gpuMs += frame.gpu[i].ms;
+		}
+	} else {
+		frame.gpu.clear();
+		frame.gpuMs = -1.0;
+	}
+
+	latestFrame = frame;
+	latestValid = true;
+	historyGpu[historyNext] = (float)std::max(frame.gpuMs, 0.0);
+	historyCpu[historyNext] = (float)frame.cpuMs;
+	historyNext = (historyNext + 1) % PROFILER_HISTORY;
+	writeDump(frame);
+	if (recordTo) recordTo->push_back(frame);
+}
+
+void FrameProfiler::beginGpuScope(const char * name){
+	if (!active) return;
+	if (gpuScopeOpen) endGpuScope();
+
+	std::vector<GLuint> & queries = current->queries;
+	size_t index = current->frame.gpu.size();
+	if (index == queries.size()){
+		GLuint query;
+		glGenQueries(1, &query);
+		queries.push_back(query);
+	}
+	ProfileScope scope = { name, 0, 0.0 };
+	current->frame.gpu.push_back(scope);
+	glBeginQuery(GL_TIME_ELAPSED, queries[index]);
+	gpuScopeOpen = true;
+}
+
+void FrameProfiler::endGpuScope(){
+	if (!active || !gpuScopeOpen) return;
+	glEndQuery(GL_TIME_ELAPSED);
+	gpuScopeOpen = false;
+}
+
+void FrameProfiler::beginCpuScope(const char * name){
+	if (!active) return;
+	ProfileScope scope = { name, (int)cpuStack.size(), 0.0 };
+	cpuStack.push_back(current->frame.cpu.size());
+	current->frame.cpu.push_back(scope);
+	cpuStarts.push_back(now());
+}
+
+void FrameProfiler::endCpuScope(){
+	if (!active || cpuStack.empty()) return;
+	current->frame.cpu[cpuStack.back()].ms = now() - cpuStarts.back();
+	cpuStack.pop_back();
+	cpuStarts.pop_back();
+}
+
+void FrameProfiler::countDraw(unsigned int calls, unsigned int commands, unsigned long long triangles){
+	if (!active) return;
+	current->frame.counters.drawCalls += calls;
+	current->frame.counters.drawCommands += commands;
+	current->frame.counters.triangles += triangles;
+}
+
+void FrameProfiler::countStateChange(unsigned int count){
+	if (!active) return;
+	current->frame.counters.stateChanges += count;
+}
+
+void FrameProfiler::writeDump(const ProfileFrame & frame){
+	if (!dumpFile) return;
+	const ProfileCounters & c = frame.counters;
+
+	if (!dumpJson){
+		// Long format : one row per value, so frames with different scopes share the same columns
+		fprintf(dumpFile, "%llu,frame,cpu_ms,%.4f\n%llu,frame,gpu_ms,%.4f\n", frame.frame, frame.cpuMs, frame.frame, frame.gpuMs);
+		for (size_t i = 0; i < frame.cpu.size(); i++) fprintf(dumpFile, "%llu,cpu,%s,%.4f\n", frame.frame, frame.cpu[i].name.c_str(), frame.cpu[i].ms);
+		for (size_t i = 0; i < frame.gpu.size(); i++) fprintf(dumpFile, "%llu,gpu,%s,%.4f\n", frame.frame, frame.gpu[i].name.c_str(), frame.gpu[i].ms);
+		fprintf(dumpFile, "%llu,counter,draw_calls,%u\n%llu,counter,draw_commands,%u\n%llu,counter,triangles,%llu\n%llu,counter,state_changes,%u\n",
+			frame.frame, c.drawCalls, frame.frame, c.drawCommands, frame.frame, c.triangles, frame.frame, c.stateChanges);
+		return;
+	}
+
+	fprintf(dumpFile, "%s  {\"frame\": %llu, \"cpuMs\": %.4f, \"gpuMs\": %.4f,\n", dumpFirst ? "" : ",\n", frame.frame, frame.cpuMs, frame.gpuMs);
+	dumpFirst = false;
+	const std::vector<ProfileScope> * lists[2] = { &frame.cpu, &frame.gpu };
+	const char * keys[2] = { "cpu", "gpu" };
+	for (int l = 0; l < 2; l++){
+		fprintf(dumpFile, "   \"%s\": [", keys[l]);
+		for (size_t i = 0; i < lists[l]->size(); i++){
+			const ProfileScope & scope = (*lists[l])[i];
+			fprintf(dumpFile, "%s{\"name\": \"%s\", \"depth\": %d, \"ms\": %.4f}", i ? ", " : "", scope.name.c_str(), scope.depth, scope.ms);
+		}
+		fprintf(dumpFile, "],\n");
+	}
+	fprintf(dumpFile, "   \"counters\": {\"drawCalls\": %u, \"drawCommands\": %u, \"triangles\": %llu, \"stateChanges\": %u}}",
+		c.drawCalls, c.drawCommands, c.triangles, c.stateChanges);
+}
+
+void FrameProfiler::printSummary() const {
+	if (!latestValid) return;
+	const ProfileFrame & f = latestFrame;
+	printf("Frame %llu : CPU %.2f ms, GPU %.2f ms, %u draw calls (%u draws), %llu triangles, %u state changes\n",
+		f.frame, f.cpuMs, f.gpuMs, f.counters.drawCalls, f.counters.drawCommands, f.counters.triangles, f.counters.stateChanges);
+	printf("  GPU :");
+	for (size_t i = 0; i < f.gpu.size(); i++) printf(" [%d] %s %.3f", (int)(i % 8), f.gpu[i].name.c_str(), f.gpu[i].ms);
+	printf("\n  CPU :");
+	int colour = 0;
+	for (size_t i = 0; i < f.cpu.size(); i++){
+		if (f.cpu[i].depth == 0) printf(" [%d] %s %.3f", colour++ % 8, f.cpu[i].name.c_str(), f.cpu[i].ms);
+	}
+	printf("\n");
+}
+
+// Appends a coloured rectangle (two triangles) in pixels
+static void pushRect(std::vector<float> & v, float x0, float y0, float x1, float y1, const float rgb[3], float alpha){
+	const float corners[6][2] = { {x0,y0}, {x1,y0}, {x1,y1}, {x0,y0}, {x1,y1}, {x0,y1} };
+	for (int i = 0; i < 6; i++){
+		v.push_back(corners[i][0]); v.push_back(corners[i][1]);
+		v.push_back(rgb[0]); v.push_back(rgb[1]); v.push_back(rgb[2]); v.push_back(alpha);
+	}
+}
+
+void FrameProfiler::drawOverlay(int width, int height){
+	if (!latestValid || !overlayProgram) return;
+	const ProfileFrame & f = latestFrame;
+	const float pxPerMs = OVERLAY_BAR_WIDTH / OVERLAY_BUDGET_MS;
+	const float black[3] = { 0.0f, 0.0f, 0.0f };
+	const float white[3] = { 1.0f, 1.0f, 1.0f };
+	const float gpuColor[3] = { 0.95f, 0.65f, 0.20f };
+	const float cpuColor[3] = { 0.30f, 0.75f, 0.85f };
+
+	std::vector<float> & v = overlayVertices;
+	v.clear();
+	float x = 10.0f, y = 10.0f;
+	float panelRight = x + OVERLAY_BAR_WIDTH * 1.25f;
+	pushRect(v, x - 5, y - 5, panelRight + 5, y + OVERLAY_GRAPH_HEIGHT + 50, black, 0.6f);
+
+	// Frame time graph : GPU columns, CPU as a marker at its height
+	float column = (panelRight - x) / PROFILER_HISTORY;
+	float graphScale = OVERLAY_GRAPH_HEIGHT / (2.0f * OVERLAY_BUDGET_MS);
+	for (int i = 0; i < PROFILER_HISTORY; i++){
+		int h = (historyNext + i) % PROFILER_HISTORY;
+		float cx = x + i * column;
+		pushRect(v, cx, y, cx + column - 1, y + std::min(historyGpu[h] * graphScale, OVERLAY_GRAPH_HEIGHT), gpuColor, 0.9f);
+		float cy = y + std::min(historyCpu[h] * graphScale, OVERLAY_GRAPH_HEIGHT);
+		pushRect(v, cx, cy - 1, cx + column - 1, cy + 1, cpuColor, 1.0f);
+	}
+	pushRect(v, x, y + OVERLAY_BUDGET_MS * graphScale, x + PROFILER_HISTORY * column, y + OVERLAY_BUDGET_MS * graphScale + 1, white, 0.5f);
+
+	// Per-scope bars : GPU below, top-level CPU scopes above
+	float barY[2] = { y + OVERLAY_GRAPH_HEIGHT + 8, y + OVERLAY_GRAPH_HEIGHT + 26 };
+	const std::vector<ProfileScope> * lists[2] = { &f.gpu, &f.cpu };
+	for (int l = 0; l < 2; l++){
+		float bx = x;
+		int colour = 0;
+		for (size_t i = 0; i < lists[l]->size(); i++){
+			const ProfileScope & scope = (*lists[l])[i];
+			if (scope.depth != 0) continue;
+			float w = std::min((float)scope.ms * pxPerMs, std::max(panelRight - bx, 0.0f)); // Clipped to the panel
+			pushRect(v, bx, barY[l], bx + w, barY[l] + 12, SCOPE_COLORS[colour++ % 8], 1.0f);
+			bx += w;
+		}
+	}
+	pushRect(v, x + OVERLAY_BAR_WIDTH, barY[0] - 2, x + OVERLAY_BAR_WIDTH + 1, barY[1] + 14, white, 0.8f);
+
+	// Draw on top of everything
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glUseProgram(overlayProgram);
+	glUniform2f(overlayScreenSizeID, (float)width, (float)height);
+	glBindVertexArray(overlayVao);
+	glBindBuffer(GL_ARRAY_BUFFER, overlayBuffer);
+	glBufferData(GL_ARRAY_BUFFER, v.size() * sizeof(float), v.data(), GL_STREAM_DRAW);
+	glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(v.size() / 6));
+	glBindVertexArray(0);
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+}
@@ -0,0 +1,109 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+// Frame profiler : GPU pass timings, CPU scope timings and draw counters, with an on-screen
+// overlay and an optional per-frame CSV / JSON dump.
+//
+// GPU scopes are GL_TIME_ELAPSED queries kept in a ring of PROFILER_FRAME_LATENCY frames, so a frame's
+// results are only read back PROFILER_FRAME_LATENCY frames later, when the GPU is long done with them.
+// A result that still isn't ready is dropped rather than waited for, so profiling never stalls.
+// Only one GPU scope can be open at a time (GL_TIME_ELAPSED queries can't nest) ; CPU scopes can nest.
+
+#define PROFILER_FRAME_LATENCY 3
+#define PROFILER_HISTORY       120  // Frames kept for the overlay's graph
+
+struct ProfileScope {
+	std::string name;
+	int depth;       // Nesting level (CPU scopes only)
+	double ms;
+};
+
+struct ProfileCounters {
+	unsigned int drawCalls;       // API calls ; one glMultiDrawElementsIndirect counts once
+	unsigned int drawCommands;    // Individual draws, including each command of an indirect call
+	unsigned long long triangles;
+	unsigned int stateChanges;    // Program, vertex array, texture and framebuffer binds
+};
+
+// One frame's results
+struct ProfileFrame {
+	unsigned long long frame;
+	double cpuMs;                 // beginFrame to endFrame
+	double gpuMs;                 // Sum of the GPU scopes ; negative if they were dropped
+	std::vector<ProfileScope> cpu;
+	std::vector<ProfileScope> gpu;
+	ProfileCounters counters;
+};
+
+struct FrameProfiler {
+	bool enabled = false;         // Changes take effect at the next beginFrame
+	std::vector<ProfileFrame> * recordTo = NULL; // If set, every completed frame is also appended here
+
+	// Loads the overlay shaders. Call once a GL context exists.
+	bool init();
+	// Starts writing every completed frame to path : JSON array if it ends in ".json", CSV otherwise.
+	bool openDump(const char * path);
+	void cleanup();
+
+	void beginFrame();
+	void endFrame();
+	// Waits for and collects every frame still in flight (end of a run ; this one does stall)
+	void flush();
+
+	void beginGpuScope(const char * name);
+	void endGpuScope();
+	void beginCpuScope(const char * name);
+	void endCpuScope();
+
+	void countDraw(unsigned int calls, unsigned int commands, unsigned long long triangles);
+	void countStateChange(unsigned int count = 1);
+
+	// Latest frame whose GPU results came back (hasResults() is false until the first one)
+	bool hasResults() const { return latestValid; }
+	const ProfileFrame & latest() const { return latestFrame; }
+	bool isDumping() const { return dumpFile != NULL; }
+	// Number of the frame in progress (its ProfileFrame::frame), 0 before the first beginFrame
+	unsigned long long frameNumber() const { return frameIndex; }
+
+	// Bottom-left overlay : GPU and CPU scope bars plus a frame time graph, legend via printSummary()
+	void drawOverlay(int width, int height);
+	void printSummary() const;
+
+private:
+	struct PendingFrame {
+		ProfileFrame frame;
+		std::vector<GLuint> queries;  // One per GPU scope, reused frame after frame
+		bool pending;
+	};
+
+	void collect(PendingFrame & slot);
+	void writeDump(const ProfileFrame & frame);
+	double now() const;
+
+	PendingFrame ring[PROFILER_FRAME_LATENCY];
+	PendingFrame * current = NULL;
+	bool active = false;          // enabled, latched for the frame in progress
+	unsigned long long frameIndex = 0;
+	double frameStart = 0.0;
+	bool gpuScopeOpen = false;
+	std::vector<size_t> cpuStack; // Open CPU scopes (index into current->frame.cpu)
+	std::vector<double> cpuStarts;
+
+	ProfileFrame latestFrame;
+	bool latestValid = false;
+	float historyGpu[PROFILER_HISTORY] = {};
+	float historyCpu[PROFILER_HISTORY] = {};
+	int historyNext = 0;
+
+	FILE * dumpFile = NULL;
+	bool dumpJson = false;
+	bool dumpFirst = true;
+
+	GLuint overlayProgram = 0;
+	GLuint overlayScreenSizeID = 0;
+	GLuint overlayVao = 0;
+	GLuint overlayBuffer = 0;
+	std::vector<float> overlayVertices; // x, y, r, g, b, a per vertex
+};
+
+#endif
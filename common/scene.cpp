@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cfloat>
+#include <sys/stat.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "scene.hpp"
+
+// Layout : [SceneCacheHeader][meshes][rooms][portals][instances][lights]
+// Strings are a 32 bit length followed by their bytes ; the other records are stored as they are in memory.
+struct SceneCacheHeader {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int meshCount;
+	unsigned int roomCount;
+	unsigned int portalCount;
+	unsigned int instanceCount;
+	unsigned int lightCount;
+	unsigned int checksum;      // FNV-1a of everything after the header
+};
+
+// 32 bit FNV-1a, as for the mesh cache
+static unsigned int fnv1a(const unsigned char * data, size_t size){
+	unsigned int hash = 2166136261u;
+	for (size_t i=0; i<size; i++){
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Returns the modification time of a file, or 0 if it doesn't exist
+static long long fileTime(const char * path){
+	struct stat info;
+	if (stat(path, &info) != 0)
+		return 0;
+	return (long long)info.st_mtime;
+}
+
+// -- Text form --
+
+static bool readFloat(const std::vector<std::string> & tokens, size_t & i, float & out){
+	if (i >= tokens.size()) return false;
+	char * end;
+	out = strtof(tokens[i].c_str(), &end);
+	if (*end != '\0') return false;
+	i++;
+	return true;
+}
+
+static bool readVec3(const std::vector<std::string> & tokens, size_t & i, glm::vec3 & out){
+	return readFloat(tokens, i, out.x) && readFloat(tokens, i, out.y) && readFloat(tokens, i, out.z);
+}
+
+template <typename Named>
+static int findByName(const std::vector<Named> & items, const std::string & name){
+	for (size_t i=0; i<items.size(); i++)
+		if (items[i].name == name) return (int)i;
+	return -1;
+}
+
+bool loadSceneText(const char * scenePath, SceneData & out){
+	printf("Loading scene %s...\n", scenePath);
+
+	FILE * file = fopen(scenePath, "r");
+	if( file == NULL ){
+		printf("Impossible to open the file ! Are you in the right path ?\n");
+		return false;
+	}
+
+	out = SceneData();
+	// Room 0 holds what comes before the first room, and is replaced by it when that is nothing
+	SceneRoom everything = { "", glm::vec3(-FLT_MAX), glm::vec3(FLT_MAX) };
+	out.rooms.push_back(everything);
+	bool firstRoomUsed = false;
+	unsigned int room = 0;
+
+	const char * bucketNames[] = { "standard", "normalmapped", "transparent", "unlit" };
+	char line[1024];
+	int lineNumber = 0;
+	bool valid = true;
+	while( valid && fgets(line, sizeof(line), file) ){
+		lineNumber++;
+		std::vector<std::string> tokens;
+		for (char * token = strtok(line, " \t\r\n"); token != NULL && token[0] != '#'; token = strtok(NULL, " \t\r\n"))
+			tokens.push_back(token);
+		if (tokens.empty()) continue;
+
+		const std::string & record = tokens[0];
+		size_t i = 1;
+		if (record == "mesh" && tokens.size() >= 5){
+			SceneMesh mesh;
+			mesh.name = tokens[1];
+			mesh.bucket = 4;
+			for (unsigned int b=0; b<4; b++) if (tokens[2] == bucketNames[b]) mesh.bucket = b;
+			mesh.objPath = tokens[3];
+			mesh.diffusePath = tokens[4];
+			mesh.flags = 0;
+			valid = mesh.bucket < 4 && findByName(out.meshes, mesh.name) < 0;
+			for (i=5; valid && i<tokens.size(); i++){
+				if (tokens[i] == "normal" && i + 1 < tokens.size()) mesh.normalPath = tokens[++i];
+				else if (tokens[i] == "specular" && i + 1 < tokens.size()) mesh.specularPath = tokens[++i];
+				else if (tokens[i] == "lods") mesh.flags |= SCENE_MESH_BUILD_LODS;
+				else valid = false;
+			}
+			out.meshes.push_back(mesh);
+		}else if (record == "room" && tokens.size() == 8){
+			SceneRoom r;
+			r.name = tokens[1];
+			i = 2;
+			valid = readVec3(tokens, i, r.boundsMin) && readVec3(tokens, i, r.boundsMax) && findByName(out.rooms, r.name) < 0;
+			if (!firstRoomUsed && out.rooms.size() == 1){
+				out.rooms[0] = r;
+			}else{
+				out.rooms.push_back(r);
+			}
+			firstRoomUsed = true;
+			room = (unsigned int)out.rooms.size() - 1;
+		}else if (record == "portal" && tokens.size() == 9){
+			ScenePortal portal;
+			int a = findByName(out.rooms, tokens[1]), b = findByName(out.rooms, tokens[2]);
+			i = 3;
+			valid = a >= 0 && b >= 0 && a != b && readVec3(tokens, i, portal.boundsMin) && readVec3(tokens, i, portal.boundsMax);
+			portal.rooms[0] = (unsigned int)a;
+			portal.rooms[1] = (unsigned int)b;
+			out.portals.push_back(portal);
+		}else if (record == "instance" && tokens.size() >= 5){
+			SceneInstance instance;
+			int mesh = findByName(out.meshes, tokens[1]);
+			glm::vec3 position, scale(1.0f);
+			i = 2;
+			valid = mesh >= 0 && readVec3(tokens, i, position);
+			instance.mesh = (unsigned int)mesh;
+			instance.room = room;
+			instance.model = glm::translate(glm::mat4(1.0f), position);
+			instance.axis = glm::vec3(0.0f, 1.0f, 0.0f);
+			instance.angularVelocity = 0.0f;
+			instance.pivot = glm::vec3(0.0f);
+			instance.sweep = 0.0f;
+			while (valid && i < tokens.size()){
+				const std::string & option = tokens[i++];
+				float degrees;
+				glm::vec3 axis;
+				if (option == "rotate" && readFloat(tokens, i, degrees) && readVec3(tokens, i, axis) && glm::length(axis) > 0.0f)
+					instance.model = glm::rotate(instance.model, glm::radians(degrees), axis);
+				else if (option == "scale" && readVec3(tokens, i, scale)) {}
+				else if (option == "spin" && readFloat(tokens, i, instance.angularVelocity)) {}
+				else if (option == "sweep" && readFloat(tokens, i, instance.angularVelocity) && readFloat(tokens, i, instance.sweep)) {}
+				else if (option == "axis" && readVec3(tokens, i, axis) && glm::length(axis) > 0.0f) instance.axis = glm::normalize(axis);
+				else if (option == "pivot" && readVec3(tokens, i, instance.pivot)) {}
+				else valid = false;
+			}
+			if (scale != glm::vec3(1.0f)) instance.model = glm::scale(instance.model, scale);
+			out.instances.push_back(instance);
+			firstRoomUsed = true;
+		}else if (record == "light" && tokens.size() == 4){
+			SceneLight light;
+			valid = readVec3(tokens, i, light.position);
+			light.room = room;
+			out.lights.push_back(light);
+			firstRoomUsed = true;
+		}else{
+			valid = false;
+		}
+		if (!valid) printf("Scene %s : bad %s record on line %d\n", scenePath, record.c_str(), lineNumber);
+	}
+	fclose(file);
+	return valid;
+}
+
+// -- Binary form --
+
+template <typename T>
+static void writeRecord(std::vector<unsigned char> & blob, const T & value){
+	const unsigned char * bytes = (const unsigned char *)&value;
+	blob.insert(blob.end(), bytes, bytes + sizeof(T));
+}
+
+static void writeString(std::vector<unsigned char> & blob, const std::string & value){
+	writeRecord(blob, (unsigned int)value.size());
+	blob.insert(blob.end(), value.begin(), value.end());
+}
+
+// Reads records front to back ; every read fails once one has run past the end
+struct SceneCacheReader {
+	const unsigned char * next;
+	const unsigned char * end;
+
+	template <typename T>
+	bool read(T & value){
+		if ((size_t)(end - next) < sizeof(T)) { next = end + 1; return false; }
+		memcpy(&value, next, sizeof(T));
+		next += sizeof(T);
+		return true;
+	}
+	bool readString(std::string & value){
+		unsigned int size;
+		if (!read(size) || (size_t)(end - next) < size) { next = end + 1; return false; }
+		value.assign((const char *)next, size);
+		next += size;
+		return true;
+	}
+};
+
+bool loadSceneCache(const char * cachePath, const char * sourcePath, SceneData & out){
+	long long cacheTime = fileTime(cachePath);
+	if (cacheTime == 0)
+		return false;
+	if (sourcePath != NULL && fileTime(sourcePath) > cacheTime)
+		return false; // The scene was edited after the cache was written
+
+	FILE * file = fopen(cachePath, "rb");
+	if (file == NULL)
+		return false;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (size < (long)sizeof(SceneCacheHeader)){
+		fclose(file);
+		return false;
+	}
+
+	// One read for the whole scene
+	std::vector<unsigned char> blob(size);
+	size_t read = fread(blob.data(), 1, size, file);
+	fclose(file);
+	if (read != (size_t)size)
+		return false;
+
+	SceneCacheHeader header;
+	memcpy(&header, blob.data(), sizeof(header));
+	bool valid = header.magic == SCENE_CACHE_MAGIC && header.version == SCENE_CACHE_VERSION && header.roomCount > 0 &&
+		header.checksum == fnv1a(blob.data() + sizeof(header), blob.size() - sizeof(header));
+
+	out = SceneData();
+	SceneCacheReader reader = { blob.data() + sizeof(header), blob.data() + blob.size() };
+	if (valid){
+		out.meshes.resize(header.meshCount);
+		for (SceneMesh & mesh : out.meshes){
+			reader.read(mesh.bucket);
+			reader.read(mesh.flags);
+			reader.readString(mesh.name);
+			reader.readString(mesh.objPath);
+			reader.readString(mesh.diffusePath);
+			reader.readString(mesh.normalPath);
+			reader.readString(mesh.specularPath);
+		}
+		out.rooms.resize(header.roomCount);
+		for (SceneRoom & room : out.rooms){
+			reader.readString(room.name);
+			reader.read(room.boundsMin);
+			reader.read(room.boundsMax);
+		}
+		out.portals.resize(header.portalCount);
+		for (ScenePortal & portal : out.portals) reader.read(portal);
+		out.instances.resize(header.instanceCount);
+		for (SceneInstance & instance : out.instances) reader.read(instance);
+		out.lights.resize(header.lightCount);
+		for (SceneLight & light : out.lights) reader.read(light);
+		valid = reader.next == reader.end;
+	}
+	for (size_t i=0; valid && i<out.portals.size(); i++)
+		valid = out.portals[i].rooms[0] < header.roomCount && out.portals[i].rooms[1] < header.roomCount;
+	for (size_t i=0; valid && i<out.instances.size(); i++)
+		valid = out.instances[i].mesh < header.meshCount && out.instances[i].room < header.roomCount;
+	for (size_t i=0; valid && i<out.lights.size(); i++)
+		valid = out.lights[i].room < header.roomCount;
+	if (!valid){
+		printf("Scene cache %s is outdated or corrupt, rebuilding\n", cachePath);
+		out = SceneData();
+		return false;
+	}
+	return true;
+}
+
+bool saveSceneCache(const char * cachePath, const SceneData & scene){
+	std::vector<unsigned char> blob(sizeof(SceneCacheHeader));
+	for (const SceneMesh & mesh : scene.meshes){
+		writeRecord(blob, mesh.bucket);
+		writeRecord(blob, mesh.flags);
+		writeString(blob, mesh.name);
+		writeString(blob, mesh.objPath);
+		writeString(blob, mesh.diffusePath);
+		writeString(blob, mesh.normalPath);
+		writeString(blob, mesh.specularPath);
+	}
+	for (const SceneRoom & room : scene.rooms){
+		writeString(blob, room.name);
+		writeRecord(blob, room.boundsMin);
+		writeRecord(blob, room.boundsMax);
+	}
+	for (const ScenePortal & portal : scene.portals) writeRecord(blob, portal);
+	for (const SceneInstance & instance : scene.instances) writeRecord(blob, instance);
+	for (const SceneLight & light : scene.lights) writeRecord(blob, light);
+
+	SceneCacheHeader header;
+	header.magic = SCENE_CACHE_MAGIC;
+	header.version = SCENE_CACHE_VERSION;
+	header.meshCount = (unsigned int)scene.meshes.size();
+	header.roomCount = (unsigned int)scene.rooms.size();
+	header.portalCount = (unsigned int)scene.portals.size();
+	header.instanceCount = (unsigned int)scene.instances.size();
+	header.lightCount = (unsigned int)scene.lights.size();
+	header.checksum = fnv1a(blob.data() + sizeof(header), blob.size() - sizeof(header));
+	memcpy(blob.data(), &header, sizeof(header));
+
+	FILE * file = fopen(cachePath, "wb");
+	if (file == NULL){
+		printf("Could not write scene cache %s\n", cachePath);
+		return false;
+	}
+	size_t written = fwrite(blob.data(), 1, blob.size(), file);
+	fclose(file);
+	if (written != blob.size()){
+		remove(cachePath); // Never leave a truncated cache behind
+		return false;
+	}
+	return true;
+}
+
+bool loadSceneCached(const char * scenePath, SceneData & out){
+	std::string cachePath = std::string(scenePath) + ".scenecache";
+	if (loadSceneCache(cachePath.c_str(), scenePath, out))
+		return true;
+
+	// Slow path : parse the text, then write the cache for next time
+	if (!loadSceneText(scenePath, out))
+		return false;
+	saveSceneCache(cachePath.c_str(), out);
+	return true;
+}
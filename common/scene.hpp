@@ -0,0 +1,84 @@
+#ifndef SCENE_HPP
+#define SCENE_HPP
+
+// Scene description : the meshes, their instances and the lights, grouped into rooms joined by portals.
+// A .scene text file is the editable source ; loadSceneCached() keeps a binary copy next to it
+// (scenePath + ".scenecache") with every transform already composed, so a whole floor loads in one read.
+//
+// Text format, one record per line, '#' starts a comment :
+//   mesh <name> <bucket> <obj> <diffuse> [normal <bmp>] [specular <dds>] [lods]
+//        bucket is standard, normalmapped, transparent or unlit
+//   room <name> <minX> <minY> <minZ> <maxX> <maxY> <maxZ>
+//        the instances and lights that follow belong to this room
+//   portal <room> <room> <minX> <minY> <minZ> <maxX> <maxY> <maxZ>
+//        box around an opening the two rooms see each other through
+//   instance <mesh> <x> <y> <z> [rotate <degrees> <ax> <ay> <az>]... [scale <sx> <sy> <sz>]
+//            [spin <radians/s>] [sweep <radians/s> <radians>] [axis <x> <y> <z>] [pivot <x> <y> <z>]
+//        translate, then every rotate in order, then scale ; spin and sweep turn it on the GPU
+//   light <x> <y> <z>
+// Records before the first room (or all of them, without rooms) go into a room around the whole scene.
+
+#define SCENE_CACHE_MAGIC   0x53434C43 // "CLCS" in ASCII
+#define SCENE_CACHE_VERSION 1
+
+#define SCENE_BUCKET_STANDARD      0
+#define SCENE_BUCKET_NORMAL_MAPPED 1
+#define SCENE_BUCKET_TRANSPARENT   2
+#define SCENE_BUCKET_UNLIT         3
+
+#define SCENE_MESH_BUILD_LODS 0x1  // Simplify it into a level of detail chain (for the heavy props)
+
+struct SceneMesh {
+	std::string name;
+	std::string objPath;
+	std::string diffusePath, normalPath, specularPath; // Empty when unused ; a normal map means tangents
+	unsigned int bucket;                               // SCENE_BUCKET_XXX
+	unsigned int flags;                                // SCENE_MESH_XXX
+};
+
+struct SceneRoom {
+	std::string name;
+	glm::vec3 boundsMin, boundsMax;  // World space ; where the camera has to be to stand in it
+};
+
+struct ScenePortal {
+	unsigned int rooms[2];
+	glm::vec3 boundsMin, boundsMax;
+};
+
+// Rotation applied on the GPU is axis / angularVelocity / pivot / sweep, as in the renderer's
+// InstanceAnimation (angularVelocity 0 for none)
+struct SceneInstance {
+	unsigned int mesh;
+	unsigned int room;
+	glm::mat4 model;
+	glm::vec3 axis;
+	float angularVelocity;
+	glm::vec3 pivot;
+	float sweep;
+};
+
+struct SceneLight {
+	glm::vec3 position;
+	unsigned int room;
+};
+
+struct SceneData {
+	std::vector<SceneMesh> meshes;
+	std::vector<SceneRoom> rooms;      // At least one
+	std::vector<ScenePortal> portals;
+	std::vector<SceneInstance> instances;
+	std::vector<SceneLight> lights;
+};
+
+// Loads scenePath through its cache, rebuilding the cache from the text when missing, stale or corrupt
+bool loadSceneCached(const char * scenePath, SceneData & out);
+
+// Text form only
+bool loadSceneText(const char * scenePath, SceneData & out);
+
+// Binary form. Fails if it is older than sourcePath (when given), or does not validate.
+bool loadSceneCache(const char * cachePath, const char * sourcePath, SceneData & out);
+bool saveSceneCache(const char * cachePath, const SceneData & scene);
+
+#endif
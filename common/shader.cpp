@@ -9,103 +9,329 @@ using namespace std;
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <unistd.h>
+#endif
 
 #include <GL/glew.h>
 
 #include "shader.hpp"
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+#define PROGRAM_CACHE_MAGIC   0x42504C43 // "CLPB" in ASCII
+#define PROGRAM_CACHE_VERSION 1
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+// Layout of a cache entry : [ProgramCacheHeader][size bytes of glGetProgramBinary output]
+struct ProgramCacheHeader {
+	unsigned int magic;
+	unsigned int version;
+	unsigned long long key;   // Same as the file name, to catch renamed or mixed-up files
+	unsigned int format;      // binaryFormat for glProgramBinary
+	unsigned int size;
+};
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << VertexShaderStream.rdbuf();
-		VertexShaderCode = sstr.str();
-		VertexShaderStream.close();
-	}else{
-		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
-		getchar();
-		return 0;
+// Program binary cache, see initShaderCache()
+static bool cacheEnabled = false;
+static std::string cacheDirectory;  // With a trailing separator
+static std::string driverIdentity;  // Vendor, renderer and version strings : a driver update invalidates every entry
+
+// 64 bit FNV-1a, chained through hash
+static unsigned long long fnv1a64(const void * data, size_t size, unsigned long long hash = 14695981039346656037ull){
+	const unsigned char * bytes = (const unsigned char *)data;
+	for (size_t i=0; i<size; i++){
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
 	}
+	return hash;
+}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << FragmentShaderStream.rdbuf();
-		FragmentShaderCode = sstr.str();
-		FragmentShaderStream.close();
+// Directory of the running executable, with a trailing separator ("" if unknown : the working directory)
+static std::string executableDirectory(){
+	char path[4096] = { 0 };
+#ifdef _WIN32
+	DWORD length = GetModuleFileNameA(NULL, path, sizeof(path));
+	if (length == 0 || length >= sizeof(path)) return "";
+#else
+	ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+	if (length <= 0) return "";
+	path[length] = 0;
+#endif
+	std::string directory(path);
+	size_t slash = directory.find_last_of("/\\");
+	return slash == std::string::npos ? "" : directory.substr(0, slash + 1);
+}
+
+static std::string cachePath(unsigned long long key){
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.glbin", key);
+	return cacheDirectory + name;
+}
+
+void initShaderCache(){
+	// Compile and link then return at once, and the driver works on several programs at a time
+	if (GLEW_KHR_parallel_shader_compile){
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		printf("Shader Compile : parallel (KHR_parallel_shader_compile)\n");
+	}else if (GLEW_ARB_parallel_shader_compile){
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+		printf("Shader Compile : parallel (ARB_parallel_shader_compile)\n");
 	}
 
-	GLint Result = GL_FALSE;
-	int InfoLogLength;
+	GLint formatCount = 0;
+	if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+	if (formatCount <= 0){
+		printf("Shader Cache : program binaries are not supported, compiling from source\n");
+		return;
+	}
 
+	const GLenum names[4] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+	driverIdentity.clear();
+	for (int i=0; i<4; i++){
+		const char * value = (const char *)glGetString(names[i]);
+		driverIdentity += value ? value : "";
+		driverIdentity += '\n';
+	}
 
-	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-	glCompileShader(VertexShaderID);
+	cacheDirectory = executableDirectory() + "shadercache/";
+#ifdef _WIN32
+	_mkdir(cacheDirectory.c_str());
+#else
+	mkdir(cacheDirectory.c_str(), 0755);
+#endif
+	cacheEnabled = true;
+	printf("Shader Cache : %s\n", cacheDirectory.c_str());
+}
 
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
-		std::vector<char> VertexShaderErrorMessage(InfoLogLength+1);
-		glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-		printf("%s\n", &VertexShaderErrorMessage[0]);
+// Returns the cached program for key, or 0 when there is none or the driver rejects it
+static GLuint loadProgramBinary(unsigned long long key){
+	FILE * file = fopen(cachePath(key).c_str(), "rb");
+	if (!file)
+		return 0;
+
+	ProgramCacheHeader header;
+	std::vector<char> binary;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+		header.magic == PROGRAM_CACHE_MAGIC && header.version == PROGRAM_CACHE_VERSION &&
+		header.key == key && header.size > 0;
+	if (valid){
+		binary.resize(header.size);
+		valid = fread(binary.data(), 1, binary.size(), file) == binary.size();
+	}
+	fclose(file);
+	if (!valid)
+		return 0;
+
+	GLuint ProgramID = glCreateProgram();
+	glProgramBinary(ProgramID, header.format, binary.data(), (GLsizei)binary.size());
+	GLint Result = GL_FALSE;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	if (Result != GL_TRUE){
+		// Another driver build, or a damaged file : it is rebuilt from source and overwritten
+		glDeleteProgram(ProgramID);
+		return 0;
 	}
+	return ProgramID;
+}
 
+static void saveProgramBinary(GLuint ProgramID, unsigned long long key){
+	GLint length = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
 
+	ProgramCacheHeader header = { PROGRAM_CACHE_MAGIC, PROGRAM_CACHE_VERSION, key, 0, 0 };
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(ProgramID, length, &length, &format, binary.data());
+	header.format = format;
+	header.size = (unsigned int)length;
 
-	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-	glCompileShader(FragmentShaderID);
+	FILE * file = fopen(cachePath(key).c_str(), "wb");
+	if (!file)
+		return; // Read-only install : keep compiling from source
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(binary.data(), 1, header.size, file) == header.size;
+	fclose(file);
+	if (!written)
+		remove(cachePath(key).c_str());
+}
 
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
-		std::vector<char> FragmentShaderErrorMessage(InfoLogLength+1);
-		glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-		printf("%s\n", &FragmentShaderErrorMessage[0]);
+#define SHADER_MAX_INCLUDE_DEPTH 8
+
+// Replaces each '#include "file"' line of code with that file (path relative to the including file's
+// directory), framed by #line directives so compiler messages keep their line numbers.
+// Returns false if an included file can't be opened.
+static bool expandIncludes(const std::string & file_path, std::string & ShaderCode, int depth){
+	size_t slash = file_path.find_last_of("/\\");
+	std::string directory = slash == std::string::npos ? "" : file_path.substr(0, slash + 1);
+	std::string expanded;
+	std::istringstream lines(ShaderCode);
+	std::string line;
+	int lineNumber = 0;
+	while(std::getline(lines, line)){
+		lineNumber++;
+		size_t start = line.find_first_not_of(" \t");
+		size_t open = line.find('"');
+		size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+		if(start == std::string::npos || line.compare(start, 8, "#include") != 0 || close == std::string::npos){
+			expanded += line;
+			expanded += '\n';
+			continue;
+		}
+
+		std::string includePath = directory + line.substr(open + 1, close - open - 1);
+		std::ifstream IncludeStream(includePath.c_str(), std::ios::in);
+		if(!IncludeStream.is_open() || depth >= SHADER_MAX_INCLUDE_DEPTH){
+			printf("Impossible to include %s from %s\n", includePath.c_str(), file_path.c_str());
+			return false;
+		}
+		std::stringstream sstr;
+		sstr << IncludeStream.rdbuf();
+		std::string included = sstr.str();
+		if(!expandIncludes(includePath, included, depth + 1)) return false;
+		expanded += "#line 1\n" + included + "#line " + std::to_string(lineNumber + 1) + "\n";
 	}
+	ShaderCode.swap(expanded);
+	return true;
+}
 
+// Reads one shader stage into code, its #include lines expanded. Returns false if a file can't be opened.
+// defines (e.g. "#define MATERIAL_GLASS\n") go right after the #version line.
+static bool readShaderFile(const char * file_path, const char * defines, std::string & ShaderCode){
 
+	// Read the Shader code from the file
+	std::ifstream ShaderStream(file_path, std::ios::in);
+	if(ShaderStream.is_open()){
+		std::stringstream sstr;
+		sstr << ShaderStream.rdbuf();
+		ShaderCode = sstr.str();
+		ShaderStream.close();
+	}else{
+		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", file_path);
+		return false;
+	}
+	if(!expandIncludes(file_path, ShaderCode, 0)) return false;
 
-	// Link the program
-	printf("Linking program\n");
+	if(defines && defines[0]){
+		size_t version = ShaderCode.find("#version");
+		size_t insertAt = version == std::string::npos ? 0 : ShaderCode.find('\n', version);
+		insertAt = insertAt == std::string::npos ? ShaderCode.size() : insertAt + 1;
+		// #line keeps the compiler's line numbers pointing into the file
+		int line = 1 + (int)std::count(ShaderCode.begin(), ShaderCode.begin() + insertAt, '\n');
+		ShaderCode.insert(insertAt, std::string(defines) + "#line " + std::to_string(line) + "\n");
+	}
+	return true;
+}
+
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+	return LoadShaders(vertex_file_path, NULL, fragment_file_path);
+}
+
+GLuint LoadShaders(const char * vertex_file_path,const char * geometry_file_path,const char * fragment_file_path){
+	return LoadShaders(vertex_file_path, geometry_file_path, fragment_file_path, NULL);
+}
+
+GLuint LoadShaders(const char * vertex_file_path,const char * geometry_file_path,const char * fragment_file_path,const char * defines){
+	PendingProgram pending = beginLoadShaders(vertex_file_path, geometry_file_path, fragment_file_path, defines);
+	return finishLoadShaders(pending);
+}
+
+PendingProgram beginLoadShaders(const char * vertex_file_path,const char * geometry_file_path,const char * fragment_file_path,const char * defines){
+	PendingProgram pending = { 0, { 0, 0, 0 }, false, 0 };
+
+	// Read the stages (the geometry stage is optional), every stage with the same defines
+	const char * paths[3] = { vertex_file_path, geometry_file_path, fragment_file_path };
+	const GLenum types[3] = { GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER };
+	std::string sources[3];
+	// Only a stage without a path is left out : one that was asked for and can't be read fails the program
+	bool present[3] = { false, false, false };
+	for(int i=0; i<3; i++){
+		present[i] = paths[i] != NULL;
+		if(present[i] && !readShaderFile(paths[i], defines, sources[i])){
+			getchar();
+			return pending;
+		}
+	}
+	if(!present[0]){
+		printf("Impossible to load a program without a vertex shader.\n");
+		getchar();
+		return pending;
+	}
+
+	// The key covers the driver and the exact text each stage is compiled from, defines included
+	pending.cacheKey = fnv1a64(driverIdentity.data(), driverIdentity.size());
+	for(int i=0; i<3; i++){
+		if(!present[i]) continue;
+		pending.cacheKey = fnv1a64(&types[i], sizeof(types[i]), pending.cacheKey);
+		pending.cacheKey = fnv1a64(sources[i].data(), sources[i].size(), pending.cacheKey);
+	}
+	if(cacheEnabled){
+		pending.programID = loadProgramBinary(pending.cacheKey);
+		if(pending.programID){
+			printf("Loaded program from cache : %s\n", cachePath(pending.cacheKey).c_str());
+			pending.fromCache = true;
+			return pending;
+		}
+	}
+
+	// Compile and link without asking for the results, so the driver doesn't have to finish yet
 	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
+	for(int i=0; i<3; i++){
+		if(!present[i]) continue;
+		printf("Compiling shader : %s\n", paths[i]);
+		GLuint ShaderID = glCreateShader(types[i]);
+		char const * SourcePointer = sources[i].c_str();
+		glShaderSource(ShaderID, 1, &SourcePointer , NULL);
+		glCompileShader(ShaderID);
+		glAttachShader(ProgramID, ShaderID);
+		pending.shaderIDs[i] = ShaderID;
+	}
+	if(cacheEnabled) glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	printf("Linking program\n");
 	glLinkProgram(ProgramID);
+	pending.programID = ProgramID;
+	return pending;
+}
+
+GLuint finishLoadShaders(PendingProgram & pending){
+	if(pending.programID == 0 || pending.fromCache)
+		return pending.programID;
+
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
+
+	// Check the shaders ; this is where a parallel compile is waited for
+	for(int i=0; i<3; i++){
+		GLuint ShaderID = pending.shaderIDs[i];
+		if(!ShaderID) continue;
+		glGetShaderiv(ShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+		if ( InfoLogLength > 0 ){
+			std::vector<char> ShaderErrorMessage(InfoLogLength+1);
+			glGetShaderInfoLog(ShaderID, InfoLogLength, NULL, &ShaderErrorMessage[0]);
+			printf("%s\n", &ShaderErrorMessage[0]);
+		}
+	}
 
 	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	glGetProgramiv(pending.programID, GL_LINK_STATUS, &Result);
+	glGetProgramiv(pending.programID, GL_INFO_LOG_LENGTH, &InfoLogLength);
 	if ( InfoLogLength > 0 ){
 		std::vector<char> ProgramErrorMessage(InfoLogLength+1);
-		glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+		glGetProgramInfoLog(pending.programID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
 		printf("%s\n", &ProgramErrorMessage[0]);
 	}
 
-	
-	glDetachShader(ProgramID, VertexShaderID);
-	glDetachShader(ProgramID, FragmentShaderID);
-	
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
+	for(int i=0; i<3; i++){
+		if(!pending.shaderIDs[i]) continue;
+		glDetachShader(pending.programID, pending.shaderIDs[i]);
+		glDeleteShader(pending.shaderIDs[i]);
+		pending.shaderIDs[i] = 0;
+	}
 
-	return ProgramID;
+	if(Result == GL_TRUE && cacheEnabled) saveProgramBinary(pending.programID, pending.cacheKey);
+	return pending.programID;
 }
-
-
@@ -1,6 +1,29 @@
 #ifndef SHADER_HPP
 #define SHADER_HPP
 
+// Enables the program binary cache (linked programs saved in a shadercache directory next to the
+// executable, keyed on their sources, defines and the GL driver) and parallel compilation when the
+// driver has them. Call once the context is current ; without it every program is compiled from source.
+void initShaderCache();
+
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path);
+GLuint LoadShaders(const char * vertex_file_path,const char * geometry_file_path,const char * fragment_file_path);
+// One permutation of a shader : defines is a block of "#define NAME [VALUE]" lines
+// inserted into every stage after its #version line. The geometry stage may be NULL.
+GLuint LoadShaders(const char * vertex_file_path,const char * geometry_file_path,const char * fragment_file_path,const char * defines);
+
+// A program started by beginLoadShaders()
+struct PendingProgram {
+	GLuint programID;
+	GLuint shaderIDs[3];         // Vertex, geometry, fragment ; 0 when absent or loaded from the cache
+	bool fromCache;
+	unsigned long long cacheKey;
+};
+
+// LoadShaders() in two halves : begin submits the compile and link (or loads the cached binary)
+// without waiting for the results, so several programs and other CPU work overlap in the driver ;
+// finish waits, prints the logs, saves the binary to the cache and returns the program.
+PendingProgram beginLoadShaders(const char * vertex_file_path,const char * geometry_file_path,const char * fragment_file_path,const char * defines);
+GLuint finishLoadShaders(PendingProgram & pending);
 
 #endif
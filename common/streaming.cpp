@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <functional>
+
+#include <GL/glew.h>
+
+#include "streaming.hpp"
+
+#define STREAMING_ALIGNMENT 16
+
+bool StreamingUploader::init(bool persistent){
+	glGenBuffers(1, &ringBuffer);
+	glBindBuffer(GL_COPY_READ_BUFFER, ringBuffer);
+	if (persistent){
+		// Mapped once for good ; coherent, so writes need no flush before the GPU copies them
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_READ_BUFFER, STREAMING_RING_SIZE, NULL, flags);
+		persistentMapping = (unsigned char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, STREAMING_RING_SIZE, flags);
+	} else {
+		glBufferData(GL_COPY_READ_BUFFER, STREAMING_RING_SIZE, NULL, GL_STREAM_COPY);
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	return !persistent || persistentMapping != NULL;
+}
+
+void StreamingUploader::cleanup(){
+	for (size_t i = 0; i < frames.size(); i++) glDeleteSync(frames[i].fence);
+	frames.clear();
+	queue.clear();
+	queuedBytes = 0;
+	if (ringBuffer){
+		if (persistentMapping){
+			glBindBuffer(GL_COPY_READ_BUFFER, ringBuffer);
+			glUnmapBuffer(GL_COPY_READ_BUFFER);
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &ringBuffer);
+	}
+	ringBuffer = 0;
+	persistentMapping = NULL;
+}
+
+void StreamingUploader::push(const Upload & upload){
+	queue.push_back(upload);
+	queuedBytes += upload.size;
+}
+
+void StreamingUploader::queueBuffer(GLuint buffer, size_t offset, const void * data, size_t size){
+	for (size_t done = 0; done < size; done += STREAMING_BUFFER_CHUNK){
+		Upload upload = {};
+		upload.type = UPLOAD_BUFFER;
+		upload.target = buffer;
+		upload.offset = offset + done;
+		upload.data = (const unsigned char*)data + done;
+		upload.size = size - done < STREAMING_BUFFER_CHUNK ? size - done : STREAMING_BUFFER_CHUNK;
+		push(upload);
+	}
+}
+
+// Splits a layer into full-width bands of whole rows (of 4x4 blocks when compressed), each at most
+// STREAMING_BUFFER_CHUNK bytes unless a single row is larger, so any layer fits through the ring
+void StreamingUploader::queueBands(const Upload & layer, GLsizei rowHeight){
+	GLsizei rows = (layer.height + rowHeight - 1) / rowHeight;
+	size_t rowBytes = layer.size / rows;
+	GLsizei rowsPerBand = rowBytes >= STREAMING_BUFFER_CHUNK ? 1 : (GLsizei)(STREAMING_BUFFER_CHUNK / rowBytes);
+	for (GLsizei row = 0; row < rows; row += rowsPerBand){
+		GLsizei bandRows = rows - row < rowsPerBand ? rows - row : rowsPerBand;
+		Upload band = layer;
+		band.yoffset = row * rowHeight;
+		band.height = (row + bandRows) * rowHeight < layer.height ? bandRows * rowHeight : layer.height - band.yoffset;
+		band.data = (const unsigned char*)layer.data + row * rowBytes;
+		band.size = bandRows * rowBytes;
+		push(band);
+	}
+}
+
+void StreamingUploader::queueCompressedLayer(GLuint textureArray, GLint level, GLint layer, GLsizei width, GLsizei height, GLenum format, const void * data, size_t size){
+	Upload upload = {};
+	upload.type = UPLOAD_COMPRESSED_LAYER;
+	upload.target = textureArray;
+	upload.level = level;
+	upload.layer = layer;
+	upload.width = width;
+	upload.height = height;
+	upload.format = format;
+	upload.data = data;
+	upload.size = size;
+	queueBands(upload, 4);
+}
+
+// Rows are tightly packed (GL_UNPACK_ALIGNMENT 1), size = height rows
+void StreamingUploader::queueLayer(GLuint textureArray, GLint level, GLint layer, GLsizei width, GLsizei height, GLenum format, GLenum type, const void * data, size_t size){
+	Upload upload = {};
+	upload.type = UPLOAD_LAYER;
+	upload.target = textureArray;
+	upload.level = level;
+	upload.layer = layer;
+	upload.width = width;
+	upload.height = height;
+	upload.format = format;
+	upload.dataType = type;
+	upload.data = data;
+	upload.size = size;
+	queueBands(upload, 1);
+}
+
+void StreamingUploader::queueCallback(std::function<void()> callback){
+	Upload upload = {};
+	upload.type = UPLOAD_CALLBACK;
+	upload.callback = callback;
+	push(upload);
+}
+
+// Frees the regions of every frame the GPU has finished with (oldest first)
+void StreamingUploader::retire(bool wait){
+	while (!frames.empty()){
+		GLenum status = glClientWaitSync(frames.front().fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000ull : 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return;
+		glDeleteSync(frames.front().fence);
+		used -= frames.front().bytes;
+		frames.pop_front();
+		if (wait) return; // One region at a time is enough to make progress
+	}
+}
+
+// Contiguous space for size bytes at head, or NULL while the GPU still reads that part of the ring
+unsigned char * StreamingUploader::allocate(size_t size, size_t & offset){
+	size_t aligned = (size + STREAMING_ALIGNMENT - 1) & ~(size_t)(STREAMING_ALIGNMENT - 1);
+	if (used == 0) head = 0;
+	size_t tail = (head + STREAMING_RING_SIZE - used) % STREAMING_RING_SIZE;
+
+	size_t padding = 0;
+	if (used != 0 && tail >= head){
+		if (tail - head < aligned) return NULL; // Free space is [head, tail)
+	} else if (STREAMING_RING_SIZE - head < aligned){
+		// Free space is [head, end) then [0, tail) : skip the end if the upload doesn't fit there
+		if (tail < aligned) return NULL;
+		padding = STREAMING_RING_SIZE - head;
+	}
+
+	if (padding) head = 0;
+	offset = head;
+	head = (head + aligned) % STREAMING_RING_SIZE;
+	used += padding + aligned;
+	frameBytes += padding + aligned;
+
+	if (persistentMapping) return persistentMapping + offset;
+	glBindBuffer(GL_COPY_READ_BUFFER, ringBuffer);
+	return (unsigned char*)glMapBufferRange(GL_COPY_READ_BUFFER, offset, size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT); // The fences already keep this range free
+}
+
+// Issues upload straight from its source memory, for the rare piece that can never fit the ring
+void StreamingUploader::issueDirect(const Upload & upload){
+	printf("Streaming upload of %d bytes does not fit the staging ring, uploading it directly\n", (int)upload.size);
+	if (upload.type == UPLOAD_BUFFER){
+		glBindBuffer(GL_COPY_WRITE_BUFFER, upload.target);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, upload.offset, upload.size, upload.data);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		return;
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, upload.target);
+	if (upload.type == UPLOAD_COMPRESSED_LAYER)
+		glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, upload.level, 0, upload.yoffset, upload.layer, upload.width, upload.height, 1,
+			upload.format, (GLsizei)upload.size, upload.data);
+	else
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, upload.level, 0, upload.yoffset, upload.layer, upload.width, upload.height, 1,
+			upload.format, upload.dataType, upload.data);
+}
+
+// Copies one upload into the ring and issues the GPU copy. Returns false if the ring is full.
+bool StreamingUploader::issue(const Upload & upload, bool wait){
+	if (upload.size > STREAMING_RING_SIZE){
+		issueDirect(upload);
+		return true;
+	}
+	size_t offset;
+	unsigned char * staging = allocate(upload.size, offset);
+	while (!staging && wait){
+		if (frames.empty() && frameBytes){
+			// Everything in use was issued this update : fence it so it can be waited for
+			frames.push_back({ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), frameBytes });
+			frameBytes = 0;
+		}
+		if (frames.empty()) return false; // Larger than the ring
+		retire(true);
+		staging = allocate(upload.size, offset);
+	}
+	if (!staging) return false;
+
+	memcpy(staging, upload.data, upload.size);
+	if (!persistentMapping){
+		glBindBuffer(GL_COPY_READ_BUFFER, ringBuffer);
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+	}
+
+	if (upload.type == UPLOAD_BUFFER){
+		glBindBuffer(GL_COPY_READ_BUFFER, ringBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, upload.target);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, upload.offset, upload.size);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	} else {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ringBuffer);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, upload.target);
+		if (upload.type == UPLOAD_COMPRESSED_LAYER)
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, upload.level, 0, upload.yoffset, upload.layer, upload.width, upload.height, 1,
+				upload.format, (GLsizei)upload.size, (void*)offset);
+		else
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, upload.level, 0, upload.yoffset, upload.layer, upload.width, upload.height, 1,
+				upload.format, upload.dataType, (void*)offset);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	return true;
+}
+
+void StreamingUploader::update(){
+	retire(false);
+
+	size_t issued = 0;
+	while (!queue.empty()){
+		Upload & upload = queue.front();
+		if (upload.type != UPLOAD_CALLBACK){
+			if (issued && issued + upload.size > STREAMING_FRAME_BUDGET) break;
+			if (!issue(upload, false)) break; // Ring full until an older frame's fence signals
+			issued += upload.size;
+		}
+		else {
+			upload.callback();
+		}
+		queuedBytes -= upload.size;
+		queue.pop_front();
+	}
+
+	if (frameBytes){
+		frames.push_back({ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), frameBytes });
+		frameBytes = 0;
+	}
+}
+
+void StreamingUploader::finish(){
+	while (!queue.empty()){
+		Upload & upload = queue.front();
+		if (upload.type != UPLOAD_CALLBACK){
+			if (!issue(upload, true)) issueDirect(upload);
+		}
+		else {
+			upload.callback();
+		}
+		queuedBytes -= upload.size;
+		queue.pop_front();
+	}
+	if (frameBytes){
+		frames.push_back({ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), frameBytes });
+		frameBytes = 0;
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef STREAMING_HPP
+#define STREAMING_HPP
+
+// Streaming uploads through a staging ring.
+// Data is copied into one ring buffer, persistently mapped where ARB_buffer_storage exists and
+// mapped unsynchronized for each write otherwise, then copied by the GPU into its destination :
+// glCopyBufferSubData for buffers, glCompressedTexSubImage3D / glTexSubImage3D from the ring bound
+// as GL_PIXEL_UNPACK_BUFFER for texture layers.
+// Each frame's part of the ring is fenced and only rewritten once that fence has signaled. update()
+// never waits on the GPU : whatever doesn't fit in the ring or the frame budget waits a frame.
+// Buffers are split into chunks and texture layers into row bands, so nothing is larger than the ring
+// in practice ; a piece that still is goes straight from its source memory, with a message.
+
+#define STREAMING_RING_SIZE       (16 * 1024 * 1024)
+#define STREAMING_FRAME_BUDGET    (4 * 1024 * 1024)  // Bytes issued per update() (at least one upload)
+#define STREAMING_BUFFER_CHUNK    (1024 * 1024)      // Buffers and texture layers are split into pieces of about this size
+
+struct StreamingUploader {
+	bool init(bool persistent);
+	void cleanup();
+	bool isPersistent() const { return persistentMapping != NULL; }
+
+	// The source memory must stay valid until a callback queued after the upload has run
+	void queueBuffer(GLuint buffer, size_t offset, const void * data, size_t size);
+	void queueCompressedLayer(GLuint textureArray, GLint level, GLint layer, GLsizei width, GLsizei height, GLenum format, const void * data, size_t size);
+	void queueLayer(GLuint textureArray, GLint level, GLint layer, GLsizei width, GLsizei height, GLenum format, GLenum type, const void * data, size_t size);
+	// Runs on the GL thread once every upload queued before it has been issued
+	void queueCallback(std::function<void()> callback);
+
+	// Issues queued uploads (up to STREAMING_FRAME_BUDGET bytes) and fences them. Call once per frame.
+	void update();
+	// Issues everything left, waiting on the GPU whenever the ring is full
+	void finish();
+
+	bool idle() const { return queue.empty(); }
+	size_t pendingBytes() const { return queuedBytes; }
+
+private:
+	enum UploadType { UPLOAD_BUFFER, UPLOAD_COMPRESSED_LAYER, UPLOAD_LAYER, UPLOAD_CALLBACK };
+	struct Upload {
+		UploadType type;
+		GLuint target;              // Buffer or texture array
+		size_t offset;              // Destination offset (buffers)
+		GLint level, layer;
+		GLint yoffset;              // First row of a layer band
+		GLsizei width, height;
+		GLenum format, dataType;
+		const void * data;
+		size_t size;
+		std::function<void()> callback;
+	};
+	struct FrameRegion {
+		GLsync fence;
+		size_t bytes;               // Ring bytes used, alignment and wrap-around padding included
+	};
+
+	void push(const Upload & upload);
+	void queueBands(const Upload & layer, GLsizei rowHeight);
+	bool issue(const Upload & upload, bool wait);
+	void issueDirect(const Upload & upload);
+	unsigned char * allocate(size_t size, size_t & offset);
+	void retire(bool wait);
+
+	GLuint ringBuffer = 0;
+	unsigned char * persistentMapping = NULL;
+	size_t head = 0;                // Next write offset
+	size_t used = 0;                // Bytes between the oldest unretired region and head
+	size_t frameBytes = 0;          // Used since the last fence
+	std::deque<FrameRegion> frames;
+	std::deque<Upload> queue;
+	size_t queuedBytes = 0;
+};
+
+#endif
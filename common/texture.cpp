@@ -2,12 +2,22 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <GL/glew.h>
 
 #include <GLFW/glfw3.h>
 
+#include "texture.hpp"
 
-GLuint loadBMP_custom(const char * imagepath){
+static unsigned char * readBMP(const char * imagepath, unsigned int & width, unsigned int & height){
 
 	printf("Reading image %s\n", imagepath);
 
@@ -15,7 +25,6 @@ GLuint loadBMP_custom(const char * imagepath){
 	unsigned char header[54];
 	unsigned int dataPos;
 	unsigned int imageSize;
-	unsigned int width, height;
 	// Actual RGB data
 	unsigned char * data;
 
@@ -23,8 +32,7 @@ GLuint loadBMP_custom(const char * imagepath){
 	FILE * file = fopen(imagepath,"rb");
 	if (!file){
 		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
-		getchar();
-		return 0;
+		return NULL;
 	}
 
 	// Read the header, i.e. the 54 first bytes
@@ -33,17 +41,17 @@ GLuint loadBMP_custom(const char * imagepath){
 	if ( fread(header, 1, 54, file)!=54 ){ 
 		printf("Not a correct BMP file\n");
 		fclose(file);
-		return 0;
+		return NULL;
 	}
 	// A BMP files always begins with "BM"
 	if ( header[0]!='B' || header[1]!='M' ){
 		printf("Not a correct BMP file\n");
 		fclose(file);
-		return 0;
+		return NULL;
 	}
 	// Make sure this is a 24bpp file
-	if ( *(int*)&(header[0x1E])!=0  )         {printf("Not a correct BMP file\n");    fclose(file); return 0;}
-	if ( *(int*)&(header[0x1C])!=24 )         {printf("Not a correct BMP file\n");    fclose(file); return 0;}
+	if ( *(int*)&(header[0x1E])!=0  )         {printf("Not a correct BMP file\n");    fclose(file); return NULL;}
+	if ( *(int*)&(header[0x1C])!=24 )         {printf("Not a correct BMP file\n");    fclose(file); return NULL;}
 
 	// Read the information about the image
 	dataPos    = *(int*)&(header[0x0A]);
@@ -64,6 +72,16 @@ GLuint loadBMP_custom(const char * imagepath){
 	// Everything is in memory now, the file can be closed.
 	fclose (file);
 
+	return data;
+}
+
+GLuint loadBMP_custom(const char * imagepath){
+
+	unsigned int width, height;
+	unsigned char * data = readBMP(imagepath, width, height);
+	if (!data)
+		return 0;
+
 	// Create one OpenGL texture
 	GLuint textureID;
 	glGenTextures(1, &textureID);
@@ -93,6 +111,40 @@ GLuint loadBMP_custom(const char * imagepath){
 	return textureID;
 }
 
+GLuint loadBMPArray_custom(const char * imagepath){
+
+	unsigned int width, height;
+	unsigned char * data = readBMP(imagepath, width, height);
+	if (!data)
+		return 0;
+
+	GLuint textureID = uploadBMPArray(data, width, height);
+	delete [] data;
+	return textureID;
+}
+
+unsigned char * readBMPImage(const char * imagepath, unsigned int & width, unsigned int & height){
+	return readBMP(imagepath, width, height);
+}
+
+GLuint uploadBMPArray(const unsigned char * data, unsigned int width, unsigned int height){
+
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+
+	// Same upload and trilinear filtering as loadBMP_custom, as a single layer
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB, width, height, 1, 0, GL_BGR, GL_UNSIGNED_BYTE, data);
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+	return textureID;
+}
+
 // Since GLFW 3, glfwLoadTexture2D() has been removed. You have to use another texture loading library, 
 // or do it yourself (just like loadBMP_custom and loadDDS)
 //GLuint loadTGA_glfw(const char * imagepath){
@@ -123,63 +175,259 @@ GLuint loadBMP_custom(const char * imagepath){
 #define FOURCC_DXT1 0x31545844 // Equivalent to "DXT1" in ASCII
 #define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
 #define FOURCC_DXT5 0x35545844 // Equivalent to "DXT5" in ASCII
+#define FOURCC_ATI1 0x31495441 // BC4, legacy name
+#define FOURCC_BC4U 0x55344342
+#define FOURCC_ATI2 0x32495441 // BC5, legacy name
+#define FOURCC_BC5U 0x55354342
+#define FOURCC_DX10 0x30315844 // A DDS_HEADER_DXT10 follows the header
+
+#define DDS_HEADER_SIZE       (4 + 124)
+#define DDS_HEADER_DXT10_SIZE 20
+
+// DXGI_FORMAT values of the block compressed formats
+#define DXGI_FORMAT_BC1_UNORM       71
+#define DXGI_FORMAT_BC1_UNORM_SRGB  72
+#define DXGI_FORMAT_BC2_UNORM       74
+#define DXGI_FORMAT_BC2_UNORM_SRGB  75
+#define DXGI_FORMAT_BC3_UNORM       77
+#define DXGI_FORMAT_BC3_UNORM_SRGB  78
+#define DXGI_FORMAT_BC4_UNORM       80
+#define DXGI_FORMAT_BC4_SNORM       81
+#define DXGI_FORMAT_BC5_UNORM       83
+#define DXGI_FORMAT_BC5_SNORM       84
+#define DXGI_FORMAT_BC7_UNORM       98
+#define DXGI_FORMAT_BC7_UNORM_SRGB  99
+
+static unsigned int formatFromDXGI(unsigned int dxgiFormat){
+	switch(dxgiFormat)
+	{
+	case DXGI_FORMAT_BC1_UNORM:      return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+	case DXGI_FORMAT_BC1_UNORM_SRGB: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT;
+	case DXGI_FORMAT_BC2_UNORM:      return GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+	case DXGI_FORMAT_BC2_UNORM_SRGB: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT;
+	case DXGI_FORMAT_BC3_UNORM:      return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case DXGI_FORMAT_BC3_UNORM_SRGB: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+	case DXGI_FORMAT_BC4_UNORM:      return GL_COMPRESSED_RED_RGTC1;
+	case DXGI_FORMAT_BC4_SNORM:      return GL_COMPRESSED_SIGNED_RED_RGTC1;
+	case DXGI_FORMAT_BC5_UNORM:      return GL_COMPRESSED_RG_RGTC2;
+	case DXGI_FORMAT_BC5_SNORM:      return GL_COMPRESSED_SIGNED_RG_RGTC2;
+	case DXGI_FORMAT_BC7_UNORM:      return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	case DXGI_FORMAT_BC7_UNORM_SRGB: return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+	default:                         return 0;
+	}
+}
 
-GLuint loadDDS(const char * imagepath){
+// BC1 and BC4 store a 4x4 block in 8 bytes, every other format in 16
+static unsigned int blockSize(unsigned int format){
+	switch(format)
+	{
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RED_RGTC1:
+	case GL_COMPRESSED_SIGNED_RED_RGTC1:
+		return 8;
+	default:
+		return 16;
+	}
+}
 
-	unsigned char header[124];
+static unsigned int compressedSize(unsigned int width, unsigned int height, unsigned int format){
+	return ((width+3)/4)*((height+3)/4)*blockSize(format); 
+}
+
+// Whether the current context can sample format (BC7 needs GL 4.2 or ARB_texture_compression_bptc)
+static bool formatSupported(unsigned int format){
+	if (format == GL_COMPRESSED_RGBA_BPTC_UNORM || format == GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM)
+		return GLEW_ARB_texture_compression_bptc;
+	if (format == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT || format == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT ||
+		format == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT)
+		return GLEW_EXT_texture_sRGB;
+	return true;
+}
+
+// Maps a whole file read-only. The mapping stays valid after the file is closed.
+static unsigned char * mapFile(const char * path, size_t & size){
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+	LARGE_INTEGER fileSize;
+	unsigned char * data = NULL;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0){
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping){
+			data = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+		size = (size_t)fileSize.QuadPart;
+	}
+	CloseHandle(file);
+	return data;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat info;
+	unsigned char * data = NULL;
+	if (fstat(fd, &info) == 0 && info.st_size > 0){
+		void * mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped != MAP_FAILED){
+			data = (unsigned char*)mapped;
+			size = (size_t)info.st_size;
+			// Fault the pages in now, on the loading thread, rather than during the upload
+			madvise(mapped, size, MADV_WILLNEED);
+		}
+	}
+	close(fd);
+	return data;
+#endif
+}
+
+static void unmapFile(unsigned char * data, size_t size){
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap(data, size);
+#endif
+}
+
+static bool readDDS(const char * imagepath, DDSImage & image, bool headerOnly){
+
+	image.buffer = NULL;
+	image.bufsize = 0;
+	image.mapping = NULL;
+	image.mappingSize = 0;
 
-	FILE *fp; 
- 
 	/* try to open the file */ 
-	fp = fopen(imagepath, "rb"); 
-	if (fp == NULL){
-		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); getchar(); 
-		return 0;
+	size_t fileSize = 0;
+	unsigned char * file = mapFile(imagepath, fileSize);
+	if (file == NULL){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
+		return false;
 	}
    
 	/* verify the type of file */ 
-	char filecode[4]; 
-	fread(filecode, 1, 4, fp); 
-	if (strncmp(filecode, "DDS ", 4) != 0) { 
-		fclose(fp); 
-		return 0; 
+	if (fileSize < DDS_HEADER_SIZE || strncmp((const char*)file, "DDS ", 4) != 0) { 
+		printf("%s is not a DDS file\n", imagepath);
+		unmapFile(file, fileSize); 
+		return false; 
 	}
 	
 	/* get the surface desc */ 
-	fread(&header, 124, 1, fp); 
-
-	unsigned int height      = *(unsigned int*)&(header[8 ]);
-	unsigned int width	     = *(unsigned int*)&(header[12]);
-	unsigned int linearSize	 = *(unsigned int*)&(header[16]);
-	unsigned int mipMapCount = *(unsigned int*)&(header[24]);
+	const unsigned char * header = file + 4;
+	image.height      = *(unsigned int*)&(header[8 ]);
+	image.width       = *(unsigned int*)&(header[12]);
+	image.mipMapCount = *(unsigned int*)&(header[24]);
 	unsigned int fourCC      = *(unsigned int*)&(header[80]);
+	size_t dataOffset = DDS_HEADER_SIZE;
 
- 
-	unsigned char * buffer;
-	unsigned int bufsize;
-	/* how big is it going to be including all mipmaps? */ 
-	bufsize = mipMapCount > 1 ? linearSize * 2 : linearSize; 
-	buffer = (unsigned char*)malloc(bufsize * sizeof(unsigned char)); 
-	fread(buffer, 1, bufsize, fp); 
-	/* close the file pointer */ 
-	fclose(fp);
-
-	unsigned int components  = (fourCC == FOURCC_DXT1) ? 3 : 4; 
-	unsigned int format;
 	switch(fourCC) 
 	{ 
 	case FOURCC_DXT1: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; 
+		image.format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; 
 		break; 
 	case FOURCC_DXT3: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; 
+		image.format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; 
 		break; 
 	case FOURCC_DXT5: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; 
+		image.format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; 
+		break; 
+	case FOURCC_ATI1: 
+	case FOURCC_BC4U: 
+		image.format = GL_COMPRESSED_RED_RGTC1; 
+		break; 
+	case FOURCC_ATI2: 
+	case FOURCC_BC5U: 
+		image.format = GL_COMPRESSED_RG_RGTC2; 
+		break; 
+	case FOURCC_DX10: 
+		if (fileSize < DDS_HEADER_SIZE + DDS_HEADER_DXT10_SIZE){
+			image.format = 0;
+			break;
+		}
+		/* DDS_HEADER_DXT10 : dxgiFormat, resourceDimension, miscFlag, arraySize, miscFlags2 */ 
+		image.format = formatFromDXGI(*(unsigned int*)&(file[DDS_HEADER_SIZE]));
+		if (*(unsigned int*)&(file[DDS_HEADER_SIZE + 12]) > 1){
+			printf("%s is a texture array, only single images are supported\n", imagepath);
+			image.format = 0;
+		}
+		dataOffset += DDS_HEADER_DXT10_SIZE;
 		break; 
 	default: 
-		free(buffer); 
-		return 0; 
+		image.format = 0;
+		break; 
+	}
+	if (image.format == 0 || image.width == 0 || image.height == 0){
+		printf("%s : unsupported DDS format\n", imagepath);
+		unmapFile(file, fileSize); 
+		return false; 
+	}
+
+	/* every level down to 1x1 at most ; 0 means the file has no mipmaps */ 
+	unsigned int fullChain = 1;
+	for (unsigned int size = image.width > image.height ? image.width : image.height; size > 1; size /= 2) fullChain++;
+	if (image.mipMapCount == 0) image.mipMapCount = 1;
+	if (image.mipMapCount > fullChain) image.mipMapCount = fullChain;
+
+	/* exact size of all the levels, instead of trusting pitchOrLinearSize */ 
+	size_t dataSize = 0;
+	unsigned int width = image.width, height = image.height;
+	for (unsigned int level = 0; level < image.mipMapCount; level++){
+		dataSize += compressedSize(width, height, image.format);
+		width  = width  > 1 ? width  / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	if (fileSize < dataOffset + dataSize){
+		printf("%s is truncated : %u mipmap levels need %u bytes, the file has %u\n", imagepath,
+			image.mipMapCount, (unsigned int)dataSize, (unsigned int)(fileSize - dataOffset));
+		unmapFile(file, fileSize); 
+		return false; 
+	}
+
+	if (headerOnly){
+		unmapFile(file, fileSize); 
+		return true;
+	}
+
+	/* the levels are used straight from the mapping, no copy */ 
+	image.mapping = file;
+	image.mappingSize = fileSize;
+	image.buffer = file + dataOffset;
+	image.bufsize = (unsigned int)dataSize;
+	return true;
+}
+
+void freeDDSImage(DDSImage & image){
+	if (image.mapping)
+		unmapFile(image.mapping, image.mappingSize);
+	image.mapping = NULL;
+	image.mappingSize = 0;
+	image.buffer = NULL;
+	image.bufsize = 0;
+}
+
+// Sampling state every DDS texture needs : files may stop short of a full mipmap chain, and
+// single channel BC4 (specular, gloss, masks) reads as grey instead of red
+static void setDDSParameters(GLenum target, const DDSImage & image){
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, image.mipMapCount - 1);
+	if (image.format == GL_COMPRESSED_RED_RGTC1 || image.format == GL_COMPRESSED_SIGNED_RED_RGTC1){
+		GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+		glTexParameteriv(target, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+	}
+}
+
+GLuint loadDDS(const char * imagepath){
+
+	DDSImage image;
+	if (!readDDS(imagepath, image, false))
+		return 0;
+
+	unsigned int width = image.width;
+	unsigned int height = image.height;
+	if (!formatSupported(image.format)){
+		printf("%s : compressed format 0x%x is not supported by this OpenGL context\n", imagepath, image.format);
+		freeDDSImage(image);
+		return 0;
 	}
 
 	// Create one OpenGL texture
@@ -190,15 +438,14 @@ GLuint loadDDS(const char * imagepath){
 	glBindTexture(GL_TEXTURE_2D, textureID);
 	glPixelStorei(GL_UNPACK_ALIGNMENT,1);	
 	
-	unsigned int blockSize = (format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16; 
 	unsigned int offset = 0;
 
 	/* load the mipmaps */ 
-	for (unsigned int level = 0; level < mipMapCount && (width || height); ++level) 
+	for (unsigned int level = 0; level < image.mipMapCount && (width || height); ++level) 
 	{ 
-		unsigned int size = ((width+3)/4)*((height+3)/4)*blockSize; 
-		glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height,  
-			0, size, buffer + offset); 
+		unsigned int size = compressedSize(width, height, image.format); 
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, image.format, width, height,  
+			0, size, image.buffer + offset); 
 	 
 		offset += size; 
 		width  /= 2; 
@@ -209,10 +456,134 @@ GLuint loadDDS(const char * imagepath){
 		if(height < 1) height = 1;
 
 	} 
+	setDDSParameters(GL_TEXTURE_2D, image);
 
-	free(buffer); 
+	freeDDSImage(image); 
 
 	return textureID;
 
 
-}
\ No newline at end of file
+}
+
+bool getDDSInfo(const char * imagepath, unsigned int & width, unsigned int & height, unsigned int & mipMapCount, unsigned int & format){
+	DDSImage image;
+	if (!readDDS(imagepath, image, true))
+		return false;
+	width = image.width;
+	height = image.height;
+	mipMapCount = image.mipMapCount;
+	format = image.format;
+	return true;
+}
+
+GLuint loadDDSArray(const char * const * imagepaths, int count){
+
+	if (count < 1)
+		return 0;
+
+	// Every layer has to be in memory first : glCompressedTexImage3D takes a whole mipmap level at once
+	DDSImage * images = new DDSImage[count];
+	int loaded = 0;
+	for (; loaded < count; loaded++){
+		printf("Reading image %s\n", imagepaths[loaded]);
+		if (!readDDS(imagepaths[loaded], images[loaded], false))
+			break;
+		if (images[loaded].width != images[0].width || images[loaded].height != images[0].height ||
+			images[loaded].mipMapCount != images[0].mipMapCount || images[loaded].format != images[0].format){
+			printf("%s does not match the size or format of %s\n", imagepaths[loaded], imagepaths[0]);
+			freeDDSImage(images[loaded]);
+			break;
+		}
+	}
+	if (loaded != count){
+		for (int i = 0; i < loaded; i++) freeDDSImage(images[i]);
+		delete [] images;
+		return 0;
+	}
+
+	GLuint textureID = uploadDDSArray(images, count);
+	for (int i = 0; i < count; i++) freeDDSImage(images[i]);
+	delete [] images;
+	return textureID;
+}
+
+bool readDDSImage(const char * imagepath, DDSImage & image){
+	printf("Reading image %s\n", imagepath);
+	return readDDS(imagepath, image, false);
+}
+
+GLuint uploadDDSArray(const DDSImage * images, int count){
+
+	GLuint textureID = allocateDDSArray(images[0], count);
+	if (!textureID)
+		return 0;
+
+	/* load the mipmaps, one slice per layer, straight from each file mapping */ 
+	for (unsigned int level = 0; level < images[0].mipMapCount; ++level) 
+	{ 
+		unsigned int width, height, offset;
+		unsigned int size = getDDSLevel(images[0], level, width, height, offset);
+		for (int i = 0; i < count; i++)
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, i, width, height, 1,
+				images[0].format, size, images[i].buffer + offset); 
+	} 
+
+	return textureID;
+}
+
+GLuint allocateDDSArray(const DDSImage & image, int count){
+
+	if (count < 1)
+		return 0;
+	if (!formatSupported(image.format)){
+		printf("Compressed format 0x%x is not supported by this OpenGL context\n", image.format);
+		return 0;
+	}
+
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);	
+
+	for (unsigned int level = 0; level < image.mipMapCount; ++level) 
+	{ 
+		unsigned int width, height, offset;
+		unsigned int size = getDDSLevel(image, level, width, height, offset);
+		glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, image.format, width, height, count,
+			0, size * count, NULL); 
+	} 
+	setDDSParameters(GL_TEXTURE_2D_ARRAY, image);
+
+	return textureID;
+}
+
+GLuint allocateBMPArray(unsigned int width, unsigned int height, int count){
+
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);	
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB, width, height, count, 0, GL_BGR, GL_UNSIGNED_BYTE, NULL);
+
+	// Same sampling as uploadBMPArray()
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+	return textureID;
+}
+
+unsigned int getDDSLevel(const DDSImage & image, unsigned int level, unsigned int & width, unsigned int & height, unsigned int & offset){
+	width = image.width;
+	height = image.height;
+	offset = 0;
+	for (unsigned int i = 0; i < level; i++){
+		offset += compressedSize(width, height, image.format);
+		width  /= 2; 
+		height /= 2; 
+		if(width < 1) width = 1;
+		if(height < 1) height = 1;
+	}
+	return compressedSize(width, height, image.format);
+}
@@ -12,5 +12,47 @@ GLuint loadBMP_custom(const char * imagepath);
 // Load a .DDS file using GLFW's own loader
 GLuint loadDDS(const char * imagepath);
 
+// Read only the header of a .DDS file. format is the matching GL_COMPRESSED_xxx enum.
+bool getDDSInfo(const char * imagepath, unsigned int & width, unsigned int & height, unsigned int & mipMapCount, unsigned int & format);
+
+// Load .DDS files of identical size, mipmap count and format as the layers of one GL_TEXTURE_2D_ARRAY
+GLuint loadDDSArray(const char * const * imagepaths, int count);
+
+// Load a .BMP file as a single layer GL_TEXTURE_2D_ARRAY
+GLuint loadBMPArray_custom(const char * imagepath);
+
+// Split loaders, for reading on worker threads and uploading later on the GL thread.
+// The read functions make no GL calls.
+
+// A memory-mapped .DDS file : every mipmap level, back to back.
+// DXT1/3/5, BC4/BC5 (ATI1/ATI2 or BC4U/BC5U) and the DX10 header's BC1-BC5 and BC7 are read.
+struct DDSImage {
+	unsigned int width;
+	unsigned int height;
+	unsigned int mipMapCount; // At least 1, never more than the full chain
+	unsigned int format;      // GL_COMPRESSED_xxx
+	unsigned char * buffer;   // First level, inside the mapping ; NULL when only the header was read
+	unsigned int bufsize;     // Exact size of all the levels
+	unsigned char * mapping;
+	size_t mappingSize;
+};
+
+// Maps the file ; the levels are validated against the file size. freeDDSImage() unmaps it.
+bool readDDSImage(const char * imagepath, DDSImage & image);
+void freeDDSImage(DDSImage & image);
+// Images of identical size, mipmap count and format, as the layers of one GL_TEXTURE_2D_ARRAY
+GLuint uploadDDSArray(const DDSImage * images, int count);
+
+// 24 bpp BGR pixels ; delete [] them when done
+unsigned char * readBMPImage(const char * imagepath, unsigned int & width, unsigned int & height);
+GLuint uploadBMPArray(const unsigned char * data, unsigned int width, unsigned int height);
+
+// Storage only, for filling layer by layer later (glCompressedTexSubImage3D / glTexSubImage3D)
+GLuint allocateDDSArray(const DDSImage & image, int count);
+// 24 bpp layers ; call glGenerateMipmap once level 0 is filled
+GLuint allocateBMPArray(unsigned int width, unsigned int height, int count);
+// Size in bytes of mipmap level `level` of image, its dimensions and where it starts in image.buffer
+unsigned int getDDSLevel(const DDSImage & image, unsigned int level, unsigned int & width, unsigned int & height, unsigned int & offset);
+
 
 #endif
\ No newline at end of file
@@ -1,12 +1,11 @@
+#include <stdio.h>
 #include <vector>
-#include <map>
+#include <math.h>
 
 #include <glm/glm.hpp>
 
 #include "vboindexer.hpp"
 
-#include <string.h> // for memcmp
-
 
 // Returns true iif v1 can be considered equal to v2
 bool is_near(float v1, float v2){
@@ -23,7 +22,7 @@ bool getSimilarVertexIndex(
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals,
-	unsigned short & result
+	unsigned int & result
 ){
 	// Lame linear search
 	for ( unsigned int i=0; i<out_vertices.size(); i++ ){
@@ -51,7 +50,7 @@ void indexVBO_slow(
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<unsigned int> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals
@@ -60,7 +59,7 @@ void indexVBO_slow(
 	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
 
 		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
+		unsigned int index;
 		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
 
 		if ( found ){ // A similar vertex is already in the VBO, use it instead !
@@ -69,55 +68,139 @@ void indexVBO_slow(
 			out_vertices.push_back( in_vertices[i]);
 			out_uvs     .push_back( in_uvs[i]);
 			out_normals .push_back( in_normals[i]);
-			out_indices .push_back( (unsigned short)out_vertices.size() - 1 );
+			out_indices .push_back( (unsigned int)out_vertices.size() - 1 );
 		}
 	}
 }
 
-struct PackedVertex{
-	glm::vec3 position;
-	glm::vec2 uv;
-	glm::vec3 normal;
-	bool operator<(const PackedVertex that) const{
-		return memcmp((void*)this, (void*)&that, sizeof(PackedVertex))>0;
+// Spatial hash for vertex welding.
+// Positions are bucketed into cells twice as wide as the is_near() epsilon,
+// so every candidate within epsilon lies in one of 2x2x2 neighbouring cells.
+// Each cell keeps a chain of the already-exported vertices it contains.
+// The UV and normal are then compared exactly like getSimilarVertexIndex does,
+// and the lowest matching index wins, so the result is the same as indexVBO_slow.
+class VertexWelder{
+public:
+	VertexWelder(size_t maxVertices){
+		size_t capacity = 16;
+		while (capacity < maxVertices * 2) capacity *= 2; // Load factor <= 0.5, never needs to grow
+		cells.resize(capacity);
+		mask = capacity - 1;
+		next.reserve(maxVertices);
+	}
+
+	bool find(
+		const glm::vec3 & in_vertex,
+		const glm::vec2 & in_uv,
+		const glm::vec3 & in_normal,
+		const std::vector<glm::vec3> & out_vertices,
+		const std::vector<glm::vec2> & out_uvs,
+		const std::vector<glm::vec3> & out_normals,
+		unsigned int & result
+	) const{
+		int base[3], side[3];
+		for (int a=0; a<3; a++){
+			float scaled = in_vertex[a] / CELL_SIZE;
+			base[a] = (int)floorf(scaled);
+			side[a] = (scaled - base[a]) < 0.5f ? -1 : 1; // Which neighbour the epsilon range spills into
+		}
+
+		bool found = false;
+		for (int corner=0; corner<8; corner++){
+			int cx = base[0] + ((corner & 1) ? side[0] : 0);
+			int cy = base[1] + ((corner & 2) ? side[1] : 0);
+			int cz = base[2] + ((corner & 4) ? side[2] : 0);
+			const Cell * cell = lookup(cx, cy, cz);
+			if (cell == NULL) continue;
+
+			for (unsigned int i = cell->head; i != END; i = next[i]){
+				if (found && i >= result) continue;
+				if (
+					is_near( in_vertex.x , out_vertices[i].x ) &&
+					is_near( in_vertex.y , out_vertices[i].y ) &&
+					is_near( in_vertex.z , out_vertices[i].z ) &&
+					is_near( in_uv.x     , out_uvs     [i].x ) &&
+					is_near( in_uv.y     , out_uvs     [i].y ) &&
+					is_near( in_normal.x , out_normals [i].x ) &&
+					is_near( in_normal.y , out_normals [i].y ) &&
+					is_near( in_normal.z , out_normals [i].z )
+				){
+					result = i;
+					found = true;
+				}
+			}
+		}
+		return found;
+	}
+
+	// Registers out vertex number `index` (must be the next one, in order)
+	void insert(const glm::vec3 & position, unsigned int index){
+		int cx = (int)floorf(position.x / CELL_SIZE);
+		int cy = (int)floorf(position.y / CELL_SIZE);
+		int cz = (int)floorf(position.z / CELL_SIZE);
+
+		// Open addressing, linear probing
+		size_t slot = hash(cx, cy, cz) & mask;
+		while (cells[slot].used && !(cells[slot].x == cx && cells[slot].y == cy && cells[slot].z == cz))
+			slot = (slot + 1) & mask;
+
+		Cell & cell = cells[slot];
+		if (!cell.used){
+			cell.used = true;
+			cell.x = cx; cell.y = cy; cell.z = cz;
+			cell.head = END;
+		}
+		next.push_back(cell.head);
+		cell.head = index;
+	}
+
+private:
+	static constexpr float CELL_SIZE = 0.02f; // 2 * is_near() epsilon
+	static constexpr unsigned int END = 0xFFFFFFFF;
+
+	struct Cell{
+		int x = 0, y = 0, z = 0;
+		unsigned int head = END;
+		bool used = false;
 	};
-};
 
-bool getSimilarVertexIndex_fast( 
-	PackedVertex & packed, 
-	std::map<PackedVertex,unsigned short> & VertexToOutIndex,
-	unsigned short & result
-){
-	std::map<PackedVertex,unsigned short>::iterator it = VertexToOutIndex.find(packed);
-	if ( it == VertexToOutIndex.end() ){
-		return false;
-	}else{
-		result = it->second;
-		return true;
+	std::vector<Cell> cells;
+	std::vector<unsigned int> next; // Next vertex in the same cell, indexed by out vertex
+	size_t mask;
+
+	static size_t hash(int x, int y, int z){
+		return ((size_t)(unsigned int)x * 73856093u) ^ ((size_t)(unsigned int)y * 19349663u) ^ ((size_t)(unsigned int)z * 83492791u);
 	}
-}
+
+	const Cell * lookup(int x, int y, int z) const{
+		size_t slot = hash(x, y, z) & mask;
+		while (cells[slot].used){
+			if (cells[slot].x == x && cells[slot].y == y && cells[slot].z == z)
+				return &cells[slot];
+			slot = (slot + 1) & mask;
+		}
+		return NULL;
+	}
+};
 
 void indexVBO(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<unsigned int> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals
 ){
-	std::map<PackedVertex,unsigned short> VertexToOutIndex;
+	VertexWelder welder(in_vertices.size());
 
 	// For each input vertex
 	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
 
-		PackedVertex packed = {in_vertices[i], in_uvs[i], in_normals[i]};
-		
-
 		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex_fast( packed, VertexToOutIndex, index);
+		unsigned int index;
+		bool found = welder.find(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
 
 		if ( found ){ // A similar vertex is already in the VBO, use it instead !
 			out_indices.push_back( index );
@@ -125,19 +208,15 @@ void indexVBO(
 			out_vertices.push_back( in_vertices[i]);
 			out_uvs     .push_back( in_uvs[i]);
 			out_normals .push_back( in_normals[i]);
-			unsigned short newindex = (unsigned short)out_vertices.size() - 1;
+			unsigned int newindex = out_vertices.size() - 1;
 			out_indices .push_back( newindex );
-			VertexToOutIndex[ packed ] = newindex;
+			welder.insert( in_vertices[i], newindex );
 		}
 	}
 }
 
 
 
-
-
-
-
 void indexVBO_TBN(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
@@ -145,19 +224,21 @@ void indexVBO_TBN(
 	std::vector<glm::vec3> & in_tangents,
 	std::vector<glm::vec3> & in_bitangents,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<unsigned int> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals,
 	std::vector<glm::vec3> & out_tangents,
 	std::vector<glm::vec3> & out_bitangents
 ){
+	VertexWelder welder(in_vertices.size());
+
 	// For each input vertex
 	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
 
 		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
+		unsigned int index;
+		bool found = welder.find(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
 
 		if ( found ){ // A similar vertex is already in the VBO, use it instead !
 			out_indices.push_back( index );
@@ -171,7 +252,111 @@ void indexVBO_TBN(
 			out_normals .push_back( in_normals[i]);
 			out_tangents .push_back( in_tangents[i]);
 			out_bitangents .push_back( in_bitangents[i]);
-			out_indices .push_back( (unsigned short)out_vertices.size() - 1 );
+			unsigned int newindex = out_vertices.size() - 1;
+			out_indices .push_back( newindex );
+			welder.insert( in_vertices[i], newindex );
+		}
+	}
+}
+
+// Generated mesh for indexVBO_selfTest : 3000 corners drawn from 400 points on a grid of welder cells,
+// each nudged by up to 0.004 per axis, so near-equal copies straddle cell boundaries and chains of
+// them (a near b, b near c, a not near c) make the order of the matches matter.
+static void selfTestMesh(
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs,
+	std::vector<glm::vec3> & normals,
+	std::vector<glm::vec3> & tangents,
+	std::vector<glm::vec3> & bitangents
+){
+	unsigned int seed = 12345;
+	auto random = [&seed](int range){ seed = seed * 1664525u + 1013904223u; return (int)((seed >> 8) % range); };
+	const float nudges[3] = { -0.004f, 0.0f, 0.004f };
+	for ( int i=0; i<3000; i++ ){
+		int point = random(400);
+		glm::vec3 position((point % 8 - 4) * 0.02f, (point / 8 % 8 - 4) * 0.02f, (point / 64 - 3) * 0.02f);
+		vertices.push_back( position + glm::vec3(nudges[random(3)], nudges[random(3)], nudges[random(3)]) );
+		uvs.push_back( glm::vec2((point % 2) * 0.5f + nudges[random(3)], 0.25f) );
+		normals.push_back( random(4) == 0 ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 1.0f) );
+		tangents.push_back( glm::vec3(random(100) * 0.01f, 1.0f, 0.0f) );
+		bitangents.push_back( glm::vec3(0.0f, random(100) * 0.01f, 1.0f) );
+	}
+}
+
+bool indexVBO_selfTest(){
+	std::vector<glm::vec3> vertices, normals, tangents, bitangents;
+	std::vector<glm::vec2> uvs;
+	selfTestMesh(vertices, uvs, normals, tangents, bitangents);
+
+	std::vector<unsigned int> slowIndices, fastIndices, tbnIndices;
+	std::vector<glm::vec3> slowVertices, slowNormals, fastVertices, fastNormals, tbnVertices, tbnNormals, tbnTangents, tbnBitangents;
+	std::vector<glm::vec2> slowUVs, fastUVs, tbnUVs;
+	indexVBO_slow(vertices, uvs, normals, slowIndices, slowVertices, slowUVs, slowNormals);
+	indexVBO(vertices, uvs, normals, fastIndices, fastVertices, fastUVs, fastNormals);
+	indexVBO_TBN(vertices, uvs, normals, tangents, bitangents, tbnIndices, tbnVertices, tbnUVs, tbnNormals, tbnTangents, tbnBitangents);
+
+	// indexVBO_TBN sums the tangent frames of the corners it welds, in input order
+	std::vector<glm::vec3> slowTangents(slowVertices.size(), glm::vec3(0.0f)), slowBitangents(slowVertices.size(), glm::vec3(0.0f));
+	for ( unsigned int i=0; i<slowIndices.size(); i++ ){
+		slowTangents[slowIndices[i]] += tangents[i];
+		slowBitangents[slowIndices[i]] += bitangents[i];
+	}
+
+	bool same = fastIndices == slowIndices && fastVertices == slowVertices && fastUVs == slowUVs && fastNormals == slowNormals &&
+		tbnIndices == slowIndices && tbnVertices == slowVertices && tbnUVs == slowUVs && tbnNormals == slowNormals &&
+		tbnTangents == slowTangents && tbnBitangents == slowBitangents;
+	if (!same) printf("indexVBO self-test failed : indexVBO %u, indexVBO_TBN %u, indexVBO_slow %u vertices\n",
+		(unsigned int)fastVertices.size(), (unsigned int)tbnVertices.size(), (unsigned int)slowVertices.size());
+	return same;
+}
+
+void splitIndexedMesh(
+	const std::vector<unsigned int> & in_indices,
+	unsigned int in_vertexCount,
+	unsigned int maxChunkVertices,
+
+	std::vector<unsigned int> & out_remap,
+	std::vector<unsigned short> & out_indices,
+	std::vector<IndexedChunk> & out_chunks
+){
+	// stamp[v] == chunk number when source vertex v is already part of the current chunk
+	std::vector<unsigned int> stamp(in_vertexCount, 0xFFFFFFFF);
+	std::vector<unsigned int> local(in_vertexCount, 0);
+
+	IndexedChunk chunk = {0, 0, 0, 0};
+	unsigned int chunkID = 0;
+
+	// Triangles are kept whole and in their original order
+	for ( unsigned int t=0; t+2<in_indices.size(); t+=3 ){
+		unsigned int newVertices = 0;
+		for ( int k=0; k<3; k++ ){
+			unsigned int v = in_indices[t+k];
+			bool seen = stamp[v] == chunkID;
+			for ( int p=0; p<k; p++ ) seen = seen || in_indices[t+p] == v; // Degenerate triangles
+			if ( !seen ) newVertices++;
+		}
+
+		// Full : close this chunk and start the next one
+		if ( chunk.vertexCount + newVertices > maxChunkVertices ){
+			out_chunks.push_back(chunk);
+			chunkID++;
+			chunk.firstIndex = out_indices.size();
+			chunk.indexCount = 0;
+			chunk.baseVertex = out_remap.size();
+			chunk.vertexCount = 0;
+		}
+
+		for ( int k=0; k<3; k++ ){
+			unsigned int v = in_indices[t+k];
+			if ( stamp[v] != chunkID ){
+				stamp[v] = chunkID;
+				local[v] = chunk.vertexCount++;
+				out_remap.push_back(v);
+			}
+			out_indices.push_back( (unsigned short)local[v] );
 		}
+		chunk.indexCount += 3;
 	}
+	if ( chunk.indexCount > 0 )
+		out_chunks.push_back(chunk);
 }
@@ -6,7 +6,20 @@ void indexVBO(
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+);
+
+
+// Reference implementation (quadratic linear search), kept to validate indexVBO against
+void indexVBO_slow(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned int> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals
@@ -20,7 +33,7 @@ void indexVBO_TBN(
 	std::vector<glm::vec3> & in_tangents,
 	std::vector<glm::vec3> & in_bitangents,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<unsigned int> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals,
@@ -28,4 +41,30 @@ void indexVBO_TBN(
 	std::vector<glm::vec3> & out_bitangents
 );
 
+// Runs indexVBO, indexVBO_TBN and indexVBO_slow on a generated mesh with near-equal vertices across
+// the welder's cells. Returns true if all three give the same index and vertex streams.
+bool indexVBO_selfTest();
+
+// A run of triangles whose (16 bit) indices are relative to baseVertex
+struct IndexedChunk {
+	unsigned int firstIndex;
+	unsigned int indexCount;
+	unsigned int baseVertex;
+	unsigned int vertexCount;
+};
+
+// Splits an indexed mesh into chunks of at most maxChunkVertices vertices, so each chunk
+// can be drawn with 16 bit indices (glDrawElementsBaseVertex).
+// out_remap[i] is the input vertex that output vertex i is a copy of ; vertices shared
+// by two chunks are duplicated.
+void splitIndexedMesh(
+	const std::vector<unsigned int> & in_indices,
+	unsigned int in_vertexCount,
+	unsigned int maxChunkVertices,
+
+	std::vector<unsigned int> & out_remap,
+	std::vector<unsigned short> & out_indices,
+	std::vector<IndexedChunk> & out_chunks
+);
+
 #endif
\ No newline at end of file
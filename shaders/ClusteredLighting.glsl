@@ -0,0 +1,64 @@
+// Phong lighting from the clustered lights, shared by the forward ShadowMapping.fragmentshader and
+// the deferred DeferredLighting.fragmentshader so both paths shade a surface exactly alike.
+#include "Lights.glsl"
+
+vec2 poissonDisk[4] = vec2[](
+	vec2(-0.94201624, -0.39906216),
+	vec2(0.94558609, -0.76890725),
+	vec2(-0.094184101, -0.92938870),
+	vec2(0.34495938, 0.29387760)
+);
+
+// Light i's shadow at Position_worldspace : 4 PCF taps of its layer, 0 in shadow to 1 lit.
+// A light without a layer is only stopped by its room's walls.
+float LightShadow(int i, vec3 Position_worldspace){
+	int layer = LightShadowLayer(i);
+	if (layer < 0) return LightRoomMask(i, Position_worldspace);
+	mat4 DepthBiasMVP = LightDepthBiasMVP(i);
+	vec2 texelSize = 1.0 / vec2(textureSize(shadowMapArray, 0).xy);
+	vec4 ShadowCoord_Array = DepthBiasMVP * vec4(Position_worldspace, 1.0);
+	vec3 projCoords = ShadowCoord_Array.xyz / ShadowCoord_Array.w;
+	float shadow = 0.0;
+	for (int j = 0; j < 4; j++) {
+		shadow += texture(shadowMapArray, vec4(projCoords.xy + poissonDisk[j] * texelSize, float(layer), projCoords.z - ShadowDepthBias));
+	}
+	return shadow / 4.0;
+}
+
+// Ambient plus the diffuse and specular light of every light reaching this fragment's cluster.
+// n and E (towards the eye) are normalized, in camera space.
+vec3 ClusteredLighting(vec3 Position_cameraspace, vec3 Position_worldspace, vec3 n, vec3 E,
+                       vec3 MaterialAmbientColor, vec3 MaterialDiffuseColor, vec3 MaterialSpecularColor, float shininess,
+                       float LED_LightPower, vec4 attenuationModel){
+	vec3 LED_LightColor = vec3(1.0, 1.0, 1.0);
+	vec3 finalColor = MaterialAmbientColor;
+
+	// Find this fragment's cluster
+	ivec2 tile = min(ivec2(gl_FragCoord.xy * ClusterTileScale), ClusterGrid.xy - 1);
+	int slice = clamp(int(log(-Position_cameraspace.z) * ClusterDepthParams.x + ClusterDepthParams.y), 0, ClusterGrid.z - 1);
+	uvec2 lightRange = texelFetch(ClusterRanges, (slice * ClusterGrid.y + tile.y) * ClusterGrid.x + tile.x).xy;
+
+	// Loop through the lights that reach this cluster
+	for (uint k = 0u; k < lightRange.y; k++) {
+
+		int i = int(texelFetch(ClusterLightIndices, int(lightRange.x + k)).r);
+		vec4 lightSphere = LightSphere(i);
+
+		vec3 fragmentToLight_cameraspace = lightSphere.xyz - Position_cameraspace;
+		float distance = length(fragmentToLight_cameraspace);
+		if (distance > lightSphere.w) continue; // Clusters are boxes, the light's reach is a sphere
+		vec3 l_led = normalize(fragmentToLight_cameraspace);
+		vec3 R_led = reflect(-l_led, n);
+
+		float cosTheta_led = clamp(dot(n, l_led), 0.0, 1.0);
+		float cosAlpha_led = clamp(dot(E, R_led), 0.0, 1.0);
+		float attenuation = Attenuation(attenuationModel, distance);
+
+		float shadow = LightShadow(i, Position_worldspace);
+
+		finalColor += shadow * attenuation * LED_LightColor *
+			(MaterialDiffuseColor * LED_LightPower * cosTheta_led +
+			 MaterialSpecularColor * LED_LightPower * pow(cosAlpha_led, shininess));
+	}
+	return finalColor;
+}
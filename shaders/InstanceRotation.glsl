@@ -0,0 +1,25 @@
+// Per-instance rotation, applied before the model matrix (InstanceAnimation in main.cpp).
+// Included by every vertex shader that draws scene instances : the camera's depth pre-pass is drawn with
+// DepthRTT.vertexshader and tested GL_EQUAL against ShadowMapping.vertexshader, so all of them must turn
+// vertices by exactly the same code.
+layout(location = 10) in vec4 instanceRotationAxis;   // Axis, angular velocity (radians per second)
+layout(location = 11) in vec4 instanceRotationPivot;  // Point on the axis, sweep (0 for full turns)
+
+// Seconds. The lighting shaders read it from their FrameUniforms block (Lights.glsl, which defines
+// FRAME_UNIFORMS_TIME) ; the depth shaders get it as a plain uniform.
+#ifndef FRAME_UNIFORMS_TIME
+uniform float Time;
+#endif
+
+// Rotation of this instance at the current Time
+mat3 InstanceRotation(){
+	float angle = instanceRotationAxis.w * Time;
+	if (instanceRotationPivot.w != 0.0) angle = instanceRotationPivot.w * sin(angle);
+	vec3 a = instanceRotationAxis.xyz;
+	float c = cos(angle);
+	float s = sin(angle);
+	vec3 t = (1.0 - c) * a;
+	return mat3(t.x * a + vec3(c, s * a.z, -s * a.y),
+	            t.y * a + vec3(-s * a.z, c, s * a.x),
+	            t.z * a + vec3(s * a.y, -s * a.x, c));
+}
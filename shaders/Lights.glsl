@@ -0,0 +1,55 @@
+// What every lighting program reads about the lights : the per-frame uniform block, the light table and
+// the attenuation models. Included by ShadowMapping.vertexshader (Gouraud), ClusteredLighting.glsl and
+// through it the forward and deferred fragment shaders.
+
+// Per-frame values, one std140 buffer shared by every lighting program (FrameUniformBlock in main.cpp)
+layout(std140) uniform FrameUniforms {
+	mat4 V;
+	mat4 VP;
+	mat4 InvView;
+	mat4 InvProjection;
+	ivec3 ClusterGrid;          // Tiles x, tiles y, depth slices
+	int LightCount;             // Entries in LightData
+	vec2 ClusterTileScale;      // Tiles per pixel
+	vec2 ClusterDepthParams;    // slice = log(depth) * x + y
+	float ShadowDepthBias;      // Negative with reverse-Z
+	float Time;                 // Seconds, drives the instance rotations
+};
+#define FRAME_UNIFORMS_TIME     // InstanceRotation.glsl reads Time from here
+
+uniform sampler2DArrayShadow shadowMapArray;    // One layer per light
+
+// Clustered lights (AssignLightClusters in main.cpp) : every light of the rooms the camera sees
+uniform samplerBuffer LightData;            // 6 texels per light : see the accessors below
+uniform usamplerBuffer ClusterRanges;       // Per cluster : first index, light count
+uniform usamplerBuffer ClusterLightIndices;
+
+// Camera-space position, radius of influence
+vec4 LightSphere(int i){
+	return texelFetch(LightData, i * 6);
+}
+
+// shadowMapArray layer of light i, negative for a light without a shadow map
+int LightShadowLayer(int i){
+	return int(texelFetch(LightData, i * 6 + 1).x);
+}
+
+// World space to light i's shadow map, for a light with a layer
+mat4 LightDepthBiasMVP(int i){
+	return mat4(texelFetch(LightData, i * 6 + 2), texelFetch(LightData, i * 6 + 3),
+	            texelFetch(LightData, i * 6 + 4), texelFetch(LightData, i * 6 + 5));
+}
+
+// A light without a layer lights only its own room, whose world-space box takes the matrix's place :
+// 1 inside it, 0 behind the walls its shadow map would have caught
+float LightRoomMask(int i, vec3 Position_worldspace){
+	vec3 roomMin = texelFetch(LightData, i * 6 + 2).xyz;
+	vec3 roomMax = texelFetch(LightData, i * 6 + 3).xyz;
+	return all(greaterThanEqual(Position_worldspace, roomMin)) && all(lessThanEqual(Position_worldspace, roomMax)) ? 1.0 : 0.0;
+}
+
+// model is ATTENUATION_DEFAULT or ATTENUATION_SPECULAR_MAPPED : factor, base, linear, quadratic
+// (LIGHT_ATTENUATION in main.cpp, which also sizes the light spheres from it)
+float Attenuation(vec4 model, float distance){
+	return model.x / dot(model.yzw, vec3(1.0, distance, distance * distance));
+}
@@ -7,7 +7,7 @@
  * - **Texture Arrays:** Optimized shadow storage for 9 simultaneous light sources.
  * - **Tangent Space Normal Mapping:** High-fidelity surface detail simulation.
  * - **Hardware Instancing:** GPU-accelerated rendering for repeated geometry (benches, fans).
- * - **Transparency:** Alpha blending with manual depth sorting for glass materials.
+ * - **Transparency:** Glass instances radix-sorted back to front each frame, or weighted blended OIT.
  *
  * @author Moksham
  * @date January 2026
@@ -18,11 +18,22 @@
 // 1. INCLUDES & DEPENDENCIES
 // =================================================================
 
+#include <cassert>
 #include <cstdio>
 #include <cstdlib>
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <map>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 // OpenGL Extension Wrangler
 #include <GL/glew.h>
@@ -38,10 +49,16 @@ using namespace glm;
 // Project Utilities (Credit: opengl-tutorial.org)
 #include <common/shader.hpp>
 #include <common/texture.hpp>
+#include <common/normalmap.hpp>
 #include <common/controls.hpp>
-#include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
-#include <common/tangentspace.hpp>
+#include <common/meshcache.hpp>
+#include <common/profiler.hpp>
+#include <common/camerapath.hpp>
+#include <common/jobsystem.hpp>
+#include <common/streaming.hpp>
+#include <common/scene.hpp>
+#include <common/framecapture.hpp>
 
 // =================================================================
 // 2. CONFIGURATION & CONSTANTS
@@ -52,11 +69,157 @@ constexpr int WINDOW_HEIGHT = 1152;
 const char* WINDOW_TITLE = "OpenGL Classroom Simulation - Final";
 
 // Shadow Mapping Settings
-// We use 1024x1024 resolution for the depth map.
-// NUM_LIGHTS = 9 corresponds to the 3x3 grid of lights in the ceiling.
-constexpr int SHADOW_WIDTH = 1024;
-constexpr int SHADOW_HEIGHT = 1024;
+// NUM_LIGHTS = 9 shadow layers: the classroom's 3x3 ceiling grid, or a larger scene's lights nearest the
+// camera in the rooms it sees (see AssignLightSlots). Any other light is shaded without a shadow.
+// Resolution and depth format are runtime settings: see SHADOW_QUALITY_PRESETS (cycled with H).
 constexpr int NUM_LIGHTS = 9;
+constexpr float LIGHT_FOV_DEGREES = 120.0f;
+constexpr float LIGHT_ASPECT = 1.5f;
+constexpr float LIGHT_MIN_NEAR = 5.0f;    // Keeps the ceiling and light panels just below each light out of its map
+constexpr float SHADOW_DEPTH_BIAS = 0.010f;
+
+struct ShadowQualityPreset {
+    const char* name;
+    int resolution;        // Size of every layer of the shadow map array
+    GLenum depthFormat;
+    bool reverseZ;         // Only taken when ARB_clip_control is available
+};
+const ShadowQualityPreset SHADOW_QUALITY_PRESETS[] = {
+    { "Low",    512,  GL_DEPTH_COMPONENT16,  false },
+    { "Medium", 1024, GL_DEPTH_COMPONENT16,  false },
+    { "High",   2048, GL_DEPTH_COMPONENT32F, true  },
+};
+constexpr int NUM_SHADOW_QUALITY_PRESETS = sizeof(SHADOW_QUALITY_PRESETS) / sizeof(SHADOW_QUALITY_PRESETS[0]);
+constexpr int DEFAULT_SHADOW_QUALITY = 1;
+constexpr int MAX_LAYERS_PER_PASS = 16;   // LayerViewProjections[] size in DepthRTTLayered.vertexshader
+
+// Clustered Lighting
+// The view frustum is split into screen tiles and exponential depth slices. Each cluster lists the
+// lights whose influence sphere reaches it, and fragments only loop over their cluster's list.
+constexpr int CLUSTER_TILES_X = 16;
+constexpr int CLUSTER_TILES_Y = 12;
+constexpr int CLUSTER_SLICES = 16;
+constexpr int NUM_CLUSTERS = CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES;
+constexpr float LIGHT_CUTOFF = 0.01f;     // Contributions below this (about 2.5/255 on white) are dropped
+constexpr int LIGHT_DATA_TEXELS = 6;      // Per light: camera-space position + radius, shadow layer, 4 bias matrix columns (or room box)
+// Every light of the rooms the camera sees is shaded, nearest first up to this many; only the NUM_LIGHTS
+// nearest of them hold a shadow layer, the others light their own room unshadowed (UNSHADOWED_LIGHT_MARGIN).
+constexpr int MAX_SCENE_LIGHTS = 256;
+static_assert(MAX_SCENE_LIGHTS <= 65536, "Cluster light lists store 16-bit light indices");
+// A light reaching a surface at distance d contributes power * factor / (base + linear*d + quadratic*d^2),
+// with one model for plain surfaces and a brighter, longer one for specular-mapped ones. The lighting
+// shaders are compiled with them (AttenuationDefines()) and LightInfluenceRadius() solves them for the cutoff.
+struct LightAttenuation { float power, factor, base, linear, quadratic; };
+constexpr int NUM_ATTENUATION_MODELS = 2;
+constexpr LightAttenuation LIGHT_ATTENUATION[NUM_ATTENUATION_MODELS] = {
+    { 1.25f, 1.1f,  1.0f, 0.01f,  0.005f  },   // DEFAULT
+    { 10.0f, 0.04f, 5.0f, 0.007f, 0.0007f },  // SPECULAR_MAPPED
+};
+
+// Mesh Loading
+// Meshes over 65536 vertices are split into 16-bit index chunks (true) or kept whole with 32-bit indices (false).
+constexpr bool SPLIT_LARGE_MESHES = true;
+// Triangles are always stored in vertex cache order; this also sorts their clusters outside-in against overdraw.
+constexpr bool OPTIMIZE_OVERDRAW = true;
+// Compact vertices: 16-bit positions, half-float UVs and octahedral normals/tangents (16 or 20 bytes
+// instead of 32 or 56). The dequantization is folded into each mesh's instance matrices.
+constexpr bool QUANTIZE_VERTICES = true;
+constexpr unsigned int MESH_LOAD_FLAGS = (SPLIT_LARGE_MESHES ? MESH_CACHE_SPLIT_16BIT : 0) |
+    (OPTIMIZE_OVERDRAW ? MESH_CACHE_OPTIMIZE_OVERDRAW : 0) | (QUANTIZE_VERTICES ? MESH_CACHE_QUANTIZED : 0);
+
+// Levels of Detail
+// The heaviest props carry a simplified index chain in their mesh cache (MESH_CACHE_BUILD_LODS). The camera
+// pass draws each instance with the coarsest level whose error stays under LOD_PIXEL_ERROR on screen;
+// shadow passes always take the last one (depth-only when the seams could be welded).
+constexpr float LOD_PIXEL_ERROR = 1.0f;
+
+// Geometry Arenas
+// One shared vertex/index store per vertex layout (plain, tangent space) and index type (16, 32 bit).
+constexpr int NUM_ARENAS = 4;
+// Instance matrices updated on the CPU are written to one of this many copies of the instance buffer,
+// persistently mapped and fenced, so the frames still in flight keep reading the others.
+constexpr int INSTANCE_BUFFER_REGIONS = 3;
+
+// Scene (--scene)
+// Meshes, instances and lights come from a scene file (see common/scene.hpp), grouped into rooms.
+// Each pass only walks the rooms it can reach: the camera through the portals it sees, a light its own
+// room and the ones next door. Fans turn in the vertex shaders from the frame's Time (InstanceAnimation).
+const char* DEFAULT_SCENE_FILE = "assets/scenes/classroom.scene";
+constexpr int MAX_PORTAL_DEPTH = 8;                // Rooms deep the camera's walk through the portals goes
+// A light without a shadow layer lights only the inside of its room's bounds grown by this much (enough
+// for the wall surfaces): the room's walls are the one shadow it can't do without.
+constexpr float UNSHADOWED_LIGHT_MARGIN = 1.0f;
+
+// Materials
+// Size of the Materials[] uniform table (must match the vertex shader).
+constexpr int MAX_MATERIALS = 64;
+constexpr int MATERIAL_NORMAL_MAP = 0x1;
+constexpr int MATERIAL_SPECULAR_MAP = 0x2;
+constexpr int MATERIAL_PLACEHOLDER = 0x4;   // Textures still streaming in: flat grey, no normal/specular map
+
+// Shader Permutations
+// ShadowMapping.* is compiled once per material class (render bucket) and shading model, so the
+// per-pixel branches on bucket and lighting model are resolved by the compiler. Unlit has one model only.
+constexpr int MATERIAL_CLASS_STANDARD = 0;
+constexpr int MATERIAL_CLASS_NORMAL_MAPPED = 1;
+constexpr int MATERIAL_CLASS_GLASS = 2;
+constexpr int MATERIAL_CLASS_UNLIT = 3;
+constexpr int NUM_MATERIAL_CLASSES = 4;
+const char* MATERIAL_CLASS_DEFINES[NUM_MATERIAL_CLASSES] = {
+    "#define MATERIAL_STANDARD\n", "#define MATERIAL_NORMAL_MAPPED\n", "#define MATERIAL_GLASS\n", "#define MATERIAL_UNLIT\n" };
+constexpr int SHADING_PHONG = 0;
+constexpr int SHADING_GOURAUD = 1;          // Toggled with G
+constexpr int NUM_SHADING_MODELS = 2;
+const char* SHADING_MODEL_DEFINES[NUM_SHADING_MODELS] = { "", "#define SHADING_GOURAUD\n" };
+constexpr float GLASS_ALPHA = 0.25f;        // Compiled into the glass permutation as GLASS_ALPHA
+const char* VERTEX_FORMAT_DEFINES = QUANTIZE_VERTICES ? "#define QUANTIZED_VERTICES\n" : "";
+// The deferred G-Buffer pass draws the opaque lit classes only; gbufferPrograms[] is indexed by them
+constexpr int NUM_GBUFFER_CLASSES = 2;
+static_assert(MATERIAL_CLASS_STANDARD < NUM_GBUFFER_CLASSES && MATERIAL_CLASS_NORMAL_MAPPED < NUM_GBUFFER_CLASSES,
+              "gbufferPrograms[] is indexed by the opaque lit material classes");
+
+// Uniform Buffers
+// Binding points of the std140 blocks every lighting program reads (see BindProgramResources()).
+constexpr GLuint FRAME_UNIFORMS_BINDING = 0;   // FrameUniforms: camera, clusters, shadow bias
+constexpr GLuint MATERIAL_TABLE_BINDING = 1;   // MaterialTable: Materials[MAX_MATERIALS]
+
+// Overdraw Reduction (cycled with P)
+// Depth pre-pass: lay down opaque depth with the position-only VAOs, then shade with GL_EQUAL.
+// Front-to-back: one command per instance, sorted by distance so occluders are shaded first.
+constexpr int OVERDRAW_NONE = 0;
+constexpr int OVERDRAW_DEPTH_PREPASS = 1;
+constexpr int OVERDRAW_FRONT_TO_BACK = 2;
+constexpr int NUM_OVERDRAW_MODES = 3;
+const char* OVERDRAW_MODE_NAMES[NUM_OVERDRAW_MODES] = { "Off", "Depth Pre-Pass", "Front-to-Back" };
+
+// Transparency (toggled with T)
+// Sorted: one command per visible glass instance, blended back to front after a radix sort on view depth.
+// Weighted blended OIT (McGuire & Bavoil 2013): panes accumulate in any order into two targets that one
+// full-screen pass resolves over the scene. Approximate where panes overlap, but needs no sort at all.
+constexpr int TRANSPARENCY_SORTED = 0;
+constexpr int TRANSPARENCY_WEIGHTED_OIT = 1;
+constexpr int NUM_TRANSPARENCY_MODES = 2;
+const char* TRANSPARENCY_MODE_NAMES[NUM_TRANSPARENCY_MODES] = { "Sorted", "Weighted Blended OIT" };
+
+// Profiling (overlay toggled with O, or always on with --profile)
+constexpr double PROFILER_TITLE_INTERVAL = 0.5;  // Seconds between window title updates
+constexpr double PROFILER_PRINT_INTERVAL = 2.0;  // Seconds between console breakdowns while the overlay is up
+
+// Benchmark Mode (--benchmark)
+// The camera replays a path at a fixed timestep with vsync off, so runs are comparable across machines.
+constexpr int BENCHMARK_DEFAULT_FRAMES = 600;
+constexpr int BENCHMARK_WARMUP_FRAMES = 30;         // Rendered but not measured (first-use uploads, shadow cache fill)
+constexpr double BENCHMARK_TIMESTEP = 1.0 / 60.0;   // Path time advanced per frame, however long the frame took
+const char* BENCHMARK_DEFAULT_OUTPUT = "benchmark.json";  // The console carries the logs, so the report never goes there
+constexpr double CAMERA_RECORD_INTERVAL = 0.25;     // Seconds between keyframes written by --record-path
+// Default path: a loop around the room, starting and ending at the start-up camera (angle wrapped by 2*pi)
+const CameraKeyframe BENCHMARK_DEFAULT_PATH[] = {
+    {  0.0f, glm::vec3(-30.0f, 30.0f, -46.0f),  0.59f, -0.48f },
+    {  4.0f, glm::vec3( 22.0f, 26.0f, -40.0f), -0.60f, -0.42f },
+    {  8.0f, glm::vec3( 24.0f, 14.0f,  20.0f), -2.40f, -0.20f },
+    { 12.0f, glm::vec3(-20.0f, 22.0f,  40.0f), -3.80f, -0.35f },
+    { 16.0f, glm::vec3(-30.0f, 30.0f, -46.0f), -5.69f, -0.48f },
+};
 
 // Global Window Handle (Required for external input controls)
 GLFWwindow* window;
@@ -66,61 +229,956 @@ GLFWwindow* window;
 // =================================================================
 
 /**
- * @brief Encapsulates a 3D Model's geometry and material data.
- * @note Implements RAII pattern via the Dispose() method for memory cleanup.
+ * @brief One indirect draw, laid out exactly like GL's DrawElementsIndirectCommand.
  */
-struct Mesh {
-    // -- Geometry Buffers (VBOs) --
-    GLuint vertexBuffer = 0;    // Layout 0: Position
-    GLuint uvBuffer = 0;        // Layout 1: UV Coords
-    GLuint normalBuffer = 0;    // Layout 2: Normals
-    GLuint elementBuffer = 0;   // EBO: Indices
-    
-    // -- Normal Mapping (Tangent Space) --
-    GLuint tangentBuffer = 0;   // Layout 3
-    GLuint bitangentBuffer = 0; // Layout 4
+struct DrawCommand {
+    GLuint count;          // Indices in this range
+    GLuint instanceCount;
+    GLuint firstIndex;     // Offset into the arena's element buffer (in indices)
+    GLint  baseVertex;     // Offset into the arena's vertex buffers (in vertices)
+    GLuint baseInstance;   // Offset into the arena's instance buffer (in matrices)
+};
+
+/**
+ * @brief World-space bounding spheres of an arena's instances, one array per component (SoA).
+ * @details Keeps the frustum test a flat loop over float arrays, which the compiler vectorizes.
+ */
+struct InstanceBounds {
+    std::vector<float> x, y, z, radius;
+
+    void Resize(size_t count) { x.resize(count); y.resize(count); z.resize(count); radius.resize(count); }
+    size_t Size() const { return x.size(); }
+
+    // Sphere of instance i: the model-space sphere moved by its matrix, scaled by the largest axis
+    void Set(size_t i, const glm::mat4& model, const glm::vec3& center, float r) {
+        glm::vec3 c = glm::vec3(model * glm::vec4(center, 1.0f));
+        float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+        x[i] = c.x; y[i] = c.y; z[i] = c.z;
+        radius[i] = r * scale;
+    }
+};
 
-    // -- Materials --
-    GLuint textureID = 0;         // Diffuse Map
-    GLuint normalTextureID = 0;   // Normal Map
-    GLuint specularTextureID = 0; // Specular Map
+/**
+ * @brief Rotation the vertex shaders apply to one instance before its model matrix (Layouts 10-11).
+ * @details The angle is angularVelocity * Time, or sweep * sin(angularVelocity * Time) for an oscillating
+ * instance. The default (angularVelocity 0, pivot at the origin) leaves the vertices untouched.
+ */
+struct InstanceAnimation {
+    glm::vec3 axis = glm::vec3(0.0f, 1.0f, 0.0f);  // Unit length, model space
+    float angularVelocity = 0.0f;                   // Radians per second
+    glm::vec3 pivot = glm::vec3(0.0f);              // A point on the axis: model space on a Mesh, vertex space in the arena
+    float sweep = 0.0f;                             // 0 for full turns
+};
+static_assert(sizeof(InstanceAnimation) == 32, "InstanceAnimation is read as two vec4 attributes");
 
+/**
+ * @brief Shared GPU storage for every mesh with the same vertex layout and index type.
+ * @details Meshes are appended on the CPU while the scene loads (Pack), then the whole arena
+ * is uploaded at once (Upload). A mesh only keeps its offsets, so every mesh in a render
+ * bucket is drawn from the same VAO and buffers.
+ */
+struct GeometryArena {
+    bool hasTangents = false;               // MeshVertexTBN instead of MeshVertex
+    bool quantized = false;                 // MeshVertexPacked(TBN), see QUANTIZE_VERTICES
+    GLenum indexType = GL_UNSIGNED_SHORT;
+    GLsizei vertexStride = 0;
+    GLsizei positionStride = sizeof(glm::vec3);  // 8 bytes (4 shorts) when quantized
+
+    // -- CPU Staging (released after Upload) --
+    std::vector<unsigned char> vertexData;  // Interleaved vertices
+    std::vector<unsigned char> positionData; // Positions only, for the depth pass
+    std::vector<unsigned char> indexData;
+    std::vector<glm::mat4> instances;       // Every packed mesh's model matrices, back to back (kept: see UpdateInstances)
+    std::vector<GLint> instanceMaterials;   // Material index of each instance
+    std::vector<InstanceAnimation> instanceAnimations;  // GPU rotation of each instance, pivots in vertex space
+    InstanceBounds bounds;                  // Culling spheres of each instance (kept after Upload)
+    unsigned int vertexCount = 0;
     unsigned int indexCount = 0;
+
+    // -- GPU Buffers --
+    GLuint vertexBuffer = 0;    // Layouts 0-2 (+ 3-4 Tangent/Bitangent)
+    GLuint positionBuffer = 0;  // Tightly packed positions
+    GLuint elementBuffer = 0;
+    GLuint instanceBuffer = 0;  // Layouts 5-8
+    GLuint materialBuffer = 0;  // Layout 9
+    GLuint animationBuffer = 0; // Layouts 10-11
+
+    // -- Vertex Arrays (VAOs) --
+    GLuint vao = 0;             // Full attribute set + instances, for the lighting pass
+    GLuint depthVao = 0;        // Positions + instances, for the shadow pass
+
+    // -- Instance Updates --
+    // instanceBuffer starts as one plain copy of the matrices. With ARB_buffer_storage, the first update
+    // replaces it with INSTANCE_BUFFER_REGIONS copies mapped once for good (arenas never updated keep the
+    // plain copy). A changed set is then written into the next copy once the GPU has finished reading it,
+    // and the attributes move there (FlushInstances); without the extension one copy is updated in place.
+    bool persistentInstances = false;                       // Switch to mapped copies on the first update
+    glm::mat4* instanceMapping = nullptr;
+    GLuint instanceRegion = 0;                              // Copy the instance attributes point at
+    GLsync instanceFences[INSTANCE_BUFFER_REGIONS] = {};    // Set when the attributes leave a copy
+    bool instancesDirty = false;                            // instances changed since the last flush
+
+    bool IsEmpty() const { return indexCount == 0; }
+    GLsizei IndexSize() const { return indexType == GL_UNSIGNED_INT ? sizeof(unsigned int) : sizeof(unsigned short); }
+
+    // Appends one cached mesh. outRanges receives its draw ranges rebased onto the arena.
+    void Pack(const MeshData& data, std::vector<MeshDrawRange>& outRanges) {
+        const MeshCacheHeader& header = data.header();
+        const unsigned char* vertices = (const unsigned char*)data.vertices();
+        const unsigned char* indices = (const unsigned char*)data.indices();
+        vertexStride = header.vertexStride;
+        positionStride = quantized ? sizeof(MeshVertexPacked::position) : sizeof(glm::vec3);
+
+        vertexData.insert(vertexData.end(), vertices, vertices + (size_t)header.vertexCount * header.vertexStride);
+        indexData.insert(indexData.end(), indices, indices + (size_t)header.indexCount * header.indexSize);
+        // Every vertex format starts with its position
+        for (unsigned int i = 0; i < header.vertexCount; i++) {
+            const unsigned char* position = vertices + (size_t)i * header.vertexStride;
+            positionData.insert(positionData.end(), position, position + positionStride);
+        }
+
+        outRanges.assign(data.ranges(), data.ranges() + header.rangeCount);
+        for (MeshDrawRange& range : outRanges) {
+            range.firstIndex += indexCount;
+            range.baseVertex += vertexCount;
+        }
+        vertexCount += header.vertexCount;
+        indexCount += header.indexCount;
+    }
+
+    // Creates the buffers and both VAOs. Only the instance data is uploaded here: vertices and
+    // indices are streamed in one mesh at a time by StreamMesh(), then ReleaseStaging() frees them.
+    void Upload(bool persistent) {
+        persistentInstances = persistent;
+
+        // --- Lighting pass: one interleaved stream ---
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+
+        glGenBuffers(1, &vertexBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, vertexData.size(), nullptr, GL_STATIC_DRAW);
+
+        if (quantized) {
+            // Unpacked by the fetch: normalized shorts, halves and 2_10_10_10 (decoded in ShadowMapping.vertexshader)
+            glEnableVertexAttribArray(0); glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, vertexStride, (void*)offsetof(MeshVertexPacked, position));
+            glEnableVertexAttribArray(1); glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, vertexStride, (void*)offsetof(MeshVertexPacked, uv));
+            glEnableVertexAttribArray(2); glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, vertexStride, (void*)offsetof(MeshVertexPacked, normal));
+            if (hasTangents) {
+                glEnableVertexAttribArray(3); glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, vertexStride, (void*)offsetof(MeshVertexPackedTBN, tangent));
+            }
+        } else {
+            glEnableVertexAttribArray(0); glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertexStride, (void*)offsetof(MeshVertex, position));
+            glEnableVertexAttribArray(1); glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, vertexStride, (void*)offsetof(MeshVertex, uv));
+            glEnableVertexAttribArray(2); glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, vertexStride, (void*)offsetof(MeshVertex, normal));
+            if (hasTangents) {
+                glEnableVertexAttribArray(3); glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, vertexStride, (void*)offsetof(MeshVertexTBN, tangent));
+                glEnableVertexAttribArray(4); glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, vertexStride, (void*)offsetof(MeshVertexTBN, bitangent));
+            }
+        }
+
+        glGenBuffers(1, &elementBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size(), nullptr, GL_STATIC_DRAW);
+
+        glGenBuffers(1, &instanceBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(glm::mat4), instances.data(), GL_DYNAMIC_DRAW);
+        glGenBuffers(1, &materialBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, materialBuffer);
+        glBufferData(GL_ARRAY_BUFFER, instanceMaterials.size() * sizeof(GLint), instanceMaterials.data(), GL_STATIC_DRAW);
+        glGenBuffers(1, &animationBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, animationBuffer);
+        glBufferData(GL_ARRAY_BUFFER, instanceAnimations.size() * sizeof(InstanceAnimation), instanceAnimations.data(), GL_STATIC_DRAW);
+        AttachInstanceAttributes(0);
+
+        // --- Shadow pass: positions only (12 or 8 bytes per vertex instead of the full stride) ---
+        glGenVertexArrays(1, &depthVao);
+        glBindVertexArray(depthVao);
+
+        glGenBuffers(1, &positionBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+        glBufferData(GL_ARRAY_BUFFER, positionData.size(), nullptr, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, quantized ? GL_UNSIGNED_SHORT : GL_FLOAT, quantized ? GL_TRUE : GL_FALSE, positionStride, nullptr);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+        AttachInstanceAttributes(0);
+
+        glBindVertexArray(0);
+    }
+
+    // Queues one packed mesh's vertices, positions and indices (arena element offsets and counts).
+    // The staging copies must outlive the uploads: release them from a later streamer callback.
+    void StreamMesh(StreamingUploader& streamer, unsigned int firstVertex, unsigned int meshVertexCount,
+                    unsigned int firstIndex, unsigned int meshIndexCount) const {
+        streamer.queueBuffer(vertexBuffer, (size_t)firstVertex * vertexStride,
+                             vertexData.data() + (size_t)firstVertex * vertexStride, (size_t)meshVertexCount * vertexStride);
+        streamer.queueBuffer(positionBuffer, (size_t)firstVertex * positionStride,
+                             positionData.data() + (size_t)firstVertex * positionStride, (size_t)meshVertexCount * positionStride);
+        streamer.queueBuffer(elementBuffer, (size_t)firstIndex * IndexSize(),
+                             indexData.data() + (size_t)firstIndex * IndexSize(), (size_t)meshIndexCount * IndexSize());
+    }
+
+    void ReleaseStaging() {
+        std::vector<unsigned char>().swap(vertexData);
+        std::vector<unsigned char>().swap(positionData);
+        std::vector<unsigned char>().swap(indexData);
+    }
+
+    // Replaces count matrices from firstInstance on. With the persistent copies they are drawn from
+    // the next FlushInstances() on; otherwise right away.
+    void UpdateInstances(GLuint firstInstance, const glm::mat4* matrices, size_t count) {
+        std::copy(matrices, matrices + count, instances.begin() + firstInstance);
+        if (instanceMapping) {
+            instancesDirty = true;
+            return;
+        }
+        if (persistentInstances && MapInstanceCopies()) return;
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, firstInstance * sizeof(glm::mat4), count * sizeof(glm::mat4), matrices);
+    }
+
+    // Moves the instances into INSTANCE_BUFFER_REGIONS persistently mapped copies, all holding the
+    // current matrices. Returns false (and stays on the plain buffer from then on) if mapping fails.
+    bool MapInstanceCopies() {
+        persistentInstances = false;
+        size_t instanceBytes = instances.size() * sizeof(glm::mat4);
+        GLuint buffer = 0;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        // Coherent, so writes need no flush before the draws that read them
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, instanceBytes * INSTANCE_BUFFER_REGIONS, nullptr, flags);
+        instanceMapping = (glm::mat4*)glMapBufferRange(GL_ARRAY_BUFFER, 0, instanceBytes * INSTANCE_BUFFER_REGIONS, flags);
+        if (!instanceMapping) {
+            glDeleteBuffers(1, &buffer);
+            return false;
+        }
+        for (int region = 0; region < INSTANCE_BUFFER_REGIONS; region++) {
+            memcpy(instanceMapping + region * instances.size(), instances.data(), instanceBytes);
+        }
+        // Draws already submitted keep the old buffer alive until they are done with it
+        glDeleteBuffers(1, &instanceBuffer);
+        instanceBuffer = buffer;
+        instanceRegion = 0;
+
+        glBindVertexArray(vao);
+        AttachInstanceAttributes(0);
+        glBindVertexArray(depthVao);
+        AttachInstanceAttributes(0);
+        glBindVertexArray(0);
+        return true;
+    }
+
+    // Publishes the instances changed since the last call into the next copy of the instance buffer.
+    // Call once per frame, before anything is drawn from this arena.
+    void FlushInstances() {
+        if (!instancesDirty) return;
+        // Everything submitted so far reads the current copy
+        instanceFences[instanceRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        instanceRegion = (instanceRegion + 1) % INSTANCE_BUFFER_REGIONS;
+        if (GLsync fence = instanceFences[instanceRegion]) {
+            // Only blocks when the copies are cycled faster than the GPU drains the frames reading them
+            GLenum status;
+            do status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+            while (status == GL_TIMEOUT_EXPIRED);
+            glDeleteSync(fence);
+            instanceFences[instanceRegion] = 0;
+        }
+        memcpy(instanceMapping + instanceRegion * instances.size(), instances.data(), instances.size() * sizeof(glm::mat4));
+        instancesDirty = false;
+
+        glBindVertexArray(vao);
+        AttachInstanceAttributes(0);
+        glBindVertexArray(depthVao);
+        AttachInstanceAttributes(0);
+        glBindVertexArray(0);
+    }
+
+    // Points Layouts 5-11 of the bound VAO at the instance buffers, starting at firstInstance.
+    // A mat4 attribute occupies 4 consecutive locations, one vec4 column each.
+    void AttachInstanceAttributes(GLuint firstInstance, GLuint divisor = 1) const {
+        size_t matrixOffset = ((size_t)instanceRegion * instances.size() + firstInstance) * sizeof(glm::mat4);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        for (int col = 0; col < 4; col++) {
+            GLuint loc = 5 + col;
+            glEnableVertexAttribArray(loc);
+            glVertexAttribPointer(loc, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(matrixOffset + sizeof(glm::vec4) * col));
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, materialBuffer);
+        glEnableVertexAttribArray(9);
+        glVertexAttribIPointer(9, 1, GL_INT, sizeof(GLint), (void*)(sizeof(GLint) * firstInstance));
+
+        // Axis + angular velocity, then pivot + sweep
+        glBindBuffer(GL_ARRAY_BUFFER, animationBuffer);
+        size_t animationOffset = sizeof(InstanceAnimation) * firstInstance;
+        glEnableVertexAttribArray(10);
+        glVertexAttribPointer(10, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceAnimation), (void*)(animationOffset + offsetof(InstanceAnimation, axis)));
+        glEnableVertexAttribArray(11);
+        glVertexAttribPointer(11, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceAnimation), (void*)(animationOffset + offsetof(InstanceAnimation, pivot)));
+        SetInstanceDivisor(divisor);
+    }
+
+    // Advance the instance attributes of the bound VAO every `divisor` instances (1 = once per instance).
+    // The layered shadow pass draws each instance once per layer, so it uses the layer count.
+    void SetInstanceDivisor(GLuint divisor) const {
+        for (GLuint loc = 5; loc <= 11; loc++) glVertexAttribDivisor(loc, divisor);
+    }
+
+    // Release GPU memory
+    void Dispose() {
+        if (vertexBuffer) glDeleteBuffers(1, &vertexBuffer);
+        if (positionBuffer) glDeleteBuffers(1, &positionBuffer);
+        if (elementBuffer) glDeleteBuffers(1, &elementBuffer);
+        if (instanceBuffer) glDeleteBuffers(1, &instanceBuffer);
+        if (materialBuffer) glDeleteBuffers(1, &materialBuffer);
+        if (animationBuffer) glDeleteBuffers(1, &animationBuffer);
+        for (GLsync fence : instanceFences) if (fence) glDeleteSync(fence);
+        if (vao) glDeleteVertexArrays(1, &vao);
+        if (depthVao) glDeleteVertexArrays(1, &depthVao);
+    }
+};
+
+/**
+ * @brief A surface's textures, each one a layer of a shared GL_TEXTURE_2D_ARRAY.
+ * @details The layers are mirrored into the Materials[] uniform and every instance carries its
+ * material index (Layout 9), so meshes whose textures live in the same arrays share one draw.
+ */
+struct Material {
+    std::string diffusePath, normalPath, specularPath;  // Empty when unused
+
+    GLuint diffuseArray = 0;   GLint diffuseLayer = 0;
+    GLuint normalArray = 0;    GLint normalLayer = 0;
+    GLuint specularArray = 0;  GLint specularLayer = 0;
+    int pendingTextures = 0;   // Layers not streamed in yet; drawn as a placeholder until 0
+
+    int Flags() const {
+        if (pendingTextures > 0) return MATERIAL_PLACEHOLDER;
+        return (normalArray ? MATERIAL_NORMAL_MAP : 0) | (specularArray ? MATERIAL_SPECULAR_MAP : 0);
+    }
+};
+
+/**
+ * @brief Meshes drawn together: one arena, one set of texture arrays.
+ * @details The meshes are fixed when the scene is baked. Each pass re-culls their instances and
+ * rewrites [firstCommand, firstCommand + commandCount) with one command per run of visible instances.
+ */
+struct DrawBatch {
+    const GeometryArena* arena;
+    GLuint diffuseArray, normalArray, specularArray;  // Unused (0) in the shadow pass
+    std::vector<const struct Mesh*> meshes;
+    GLuint firstCommand = 0;
+    GLsizei commandCount = 0;
+    float nearestDistance = 0.0f;                     // Squared, set by SortFrontToBack()
+};
+
+/**
+ * @brief Encapsulates a 3D Model's geometry and material data.
+ * @note Owns no GL objects: geometry belongs to its GeometryArena, textures to the material table.
+ */
+struct Mesh {
+    // -- Geometry --
+    // Vertices, indices and instance matrices live in a shared GeometryArena; the mesh only keeps offsets.
+    GeometryArena* arena = nullptr;
+    std::vector<MeshDrawRange> drawRanges;  // Arena-relative, one per 16-bit chunk (usually just one) and level of detail
+    std::vector<MeshLod> lods;              // Levels of detail, each a slice of drawRanges; lods[0] is the full mesh
+    GLuint baseInstance = 0;                // First matrix in arena->instanceBuffer
+    std::vector<GLuint> roomStarts;         // Instances [roomStarts[r], roomStarts[r + 1]) are in room r
+    unsigned int firstVertex = 0, vertexCount = 0;  // Slice of the arena's vertex data (for streaming)
+    unsigned int firstIndex = 0;
+    bool resident = false;                  // Geometry streamed in; culled until then
+
+    // -- Material --
+    int material = -1;            // Index into the material table
+
+    unsigned int indexCount = 0;            // Every level's indices
     bool hasNormalMap = false;
 
+    // Quantized vertex space to model space (identity for float vertices); see InstanceMatrices()
+    glm::mat4 dequantize = glm::mat4(1.0f);
+
+    // -- Bounds (model space) --
+    // Bounding sphere around the indexed vertices (stored in the mesh cache), used for culling and shadow cache invalidation.
+    glm::vec3 boundsCenter = glm::vec3(0.0f);
+    float boundsRadius = 0.0f;
+    glm::vec3 boundsMin = glm::vec3(0.0f);  // Axis-aligned box, used to fit the light depth ranges
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+
+    // -- Shadow Caching --
+    // Dynamic casters (e.g. animated fans) are redrawn every frame on top of the cached static layer.
+    bool isDynamic = false;
+
     // -- Hardware Instancing --
     // Stores transformation matrices for every instance of this object.
+    // They are copied into the arena's instance buffer (Layouts 5-8) when the scene is baked.
     std::vector<glm::mat4> modelMatrices;
-
-    void addInstance(const glm::mat4& matrix) {
+    // GPU rotation of each instance (Layouts 10-11), or empty when none moves
+    std::vector<InstanceAnimation> animations;
+
+    // A turning instance makes the mesh a dynamic shadow caster
+    void addInstance(const glm::mat4& matrix, const InstanceAnimation& animation = InstanceAnimation()) {
+        if (animation.angularVelocity != 0.0f) {
+            animations.resize(modelMatrices.size());
+            isDynamic = true;
+        }
+        if (!animations.empty()) animations.push_back(animation);
         modelMatrices.push_back(matrix);
     }
 
-    // Release GPU memory
+    // Model-space sphere around everything instance i covers while it turns: centred on the axis
+    void InstanceSphere(size_t i, glm::vec3& center, float& radius) const {
+        center = boundsCenter;
+        radius = boundsRadius;
+        if (animations.empty() || animations[i].angularVelocity == 0.0f) return;
+        const InstanceAnimation& a = animations[i];
+        center = a.pivot + a.axis * glm::dot(boundsCenter - a.pivot, a.axis);
+        radius += glm::length(boundsCenter - center);
+    }
+
+    // The matrices the vertex shaders see: model matrix * dequantize (culling keeps the plain model matrices)
+    std::vector<glm::mat4> InstanceMatrices() const {
+        std::vector<glm::mat4> matrices(modelMatrices.size());
+        for (size_t i = 0; i < modelMatrices.size(); i++) matrices[i] = modelMatrices[i] * dequantize;
+        return matrices;
+    }
+
+    // Re-uploads moved instances into this mesh's slice of the arena (through its persistent copies when
+    // available). The instance count is fixed once baked. A static caster's shadow layers must be
+    // invalidated before and after the move; turning instances need no upload at all (addInstance with an animation).
+    void UploadInstances() {
+        std::vector<glm::mat4> matrices = InstanceMatrices();
+        arena->UpdateInstances(baseInstance, matrices.data(), matrices.size());
+        UpdateInstanceBounds();
+    }
+
+    // Refreshes this mesh's culling spheres in arena->bounds
+    void UpdateInstanceBounds() {
+        for (size_t i = 0; i < modelMatrices.size(); i++) {
+            glm::vec3 center;
+            float radius;
+            InstanceSphere(i, center, radius);
+            arena->bounds.Set(baseInstance + i, modelMatrices[i], center, radius);
+        }
+    }
+};
+
+/**
+ * @brief A mesh file being read and indexed on a worker thread.
+ * @details Finished loads are packed into their arena on the main thread, in declaration order,
+ * so the arena layout does not depend on which worker finishes first.
+ */
+struct MeshLoad {
+    Mesh* mesh;
+    std::string objPath;
+    unsigned int flags;      // MESH_CACHE_XXX
+    MeshData data;
+    bool loaded = false;     // loadMeshCached() succeeded
+    bool done = false;       // The worker has finished (set on the main thread)
+};
+
+/**
+ * @brief A program compiling on the driver's threads, and what to do with it once linked.
+ */
+struct ShaderLoad {
+    PendingProgram pending;
+    std::function<void(GLuint)> onLinked;    // Uniform lookups and sampler units
+};
+
+/**
+ * @brief A texture file read on a worker thread, kept until the streamer has uploaded it.
+ */
+struct LoadedTexture {
+    bool loaded = false;
+    DDSImage dds = {};                 // .dds files
+    unsigned char* bmp = nullptr;      // .bmp files (24 bpp)
+    unsigned int bmpWidth = 0, bmpHeight = 0;
+};
+
+/**
+ * @brief View frustum as 6 inward-facing planes (ax + by + cz + d >= 0 is inside).
+ * @note Planes are extracted directly from a view-projection matrix (Gribb/Hartmann).
+ */
+struct Frustum {
+    glm::vec4 planes[6];
+
+    static Frustum FromMatrix(const glm::mat4& vp) {
+        Frustum f;
+        glm::vec4 row0(vp[0][0], vp[1][0], vp[2][0], vp[3][0]);
+        glm::vec4 row1(vp[0][1], vp[1][1], vp[2][1], vp[3][1]);
+        glm::vec4 row2(vp[0][2], vp[1][2], vp[2][2], vp[3][2]);
+        glm::vec4 row3(vp[0][3], vp[1][3], vp[2][3], vp[3][3]);
+        f.planes[0] = row3 + row0; f.planes[1] = row3 - row0; // Left, Right
+        f.planes[2] = row3 + row1; f.planes[3] = row3 - row1; // Bottom, Top
+        f.planes[4] = row3 + row2; f.planes[5] = row3 - row2; // Near, Far
+        for (auto& p : f.planes) p /= glm::length(glm::vec3(p));
+        return f;
+    }
+
+    bool IntersectsSphere(const glm::vec3& center, float radius) const {
+        for (const auto& p : planes) {
+            if (glm::dot(glm::vec3(p), center) + p.w < -radius) return false;
+        }
+        return true;
+    }
+
+    // visible[i] = 1 when sphere first + i overlaps the frustum, for count spheres.
+    // Plane-major, so each inner loop is branch-free over the SoA arrays.
+    void CullSpheres(const InstanceBounds& bounds, size_t first, size_t count, unsigned char* visible) const {
+        memset(visible, 1, count);
+        const float* x = bounds.x.data() + first;
+        const float* y = bounds.y.data() + first;
+        const float* z = bounds.z.data() + first;
+        const float* r = bounds.radius.data() + first;
+        unsigned char* v = visible;
+        for (const auto& p : planes) {
+            for (size_t i = 0; i < count; i++) {
+                float d = p.x * x[i] + p.y * y[i] + p.z * z[i] + p.w;
+                v[i] &= (unsigned char)(d >= -r[i]);
+            }
+        }
+    }
+
+    // True if any instance of the mesh overlaps the frustum.
+    bool IntersectsMesh(const Mesh& mesh) const {
+        for (size_t i = 0; i < mesh.modelMatrices.size(); i++) {
+            const glm::mat4& m = mesh.modelMatrices[i];
+            glm::vec3 sphereCenter;
+            float sphereRadius;
+            mesh.InstanceSphere(i, sphereCenter, sphereRadius);
+            glm::vec3 center = glm::vec3(m * glm::vec4(sphereCenter, 1.0f));
+            float scale = std::max(glm::length(glm::vec3(m[0])), std::max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+            if (IntersectsSphere(center, sphereRadius * scale)) return true;
+        }
+        return false;
+    }
+};
+
+/**
+ * @brief How the current pass picks each instance's level of detail (see Mesh::lods).
+ * @details The camera takes the coarsest level whose error, scaled by the instance and projected at the
+ * nearest point of its sphere, stays under LOD_PIXEL_ERROR. Shadow passes take the last level outright.
+ */
+struct LodSelection {
+    bool shadowPass = true;
+    glm::vec3 eye = glm::vec3(0.0f);
+    float pixelsPerUnit = 0.0f;     // Pixels covered by one world unit at distance 1
+
+    static LodSelection ForCamera(const glm::mat4& view, const glm::mat4& projection, int viewportHeight) {
+        LodSelection s;
+        s.shadowPass = false;
+        s.eye = glm::vec3(glm::inverse(view)[3]);
+        s.pixelsPerUnit = projection[1][1] * 0.5f * viewportHeight;
+        return s;
+    }
+    static LodSelection ForShadows() { return LodSelection(); }
+
+    // Level for the instance whose culling sphere is bounds[instance]
+    GLuint Select(const Mesh& mesh, const InstanceBounds& bounds, GLuint instance) const {
+        GLuint level = (GLuint)mesh.lods.size() - 1;
+        if (shadowPass || level == 0) return level;
+        if (mesh.lods[level].flags & MESH_LOD_DEPTH_ONLY) level--;
+
+        glm::vec3 d = glm::vec3(bounds.x[instance], bounds.y[instance], bounds.z[instance]) - eye;
+        float radius = bounds.radius[instance];
+        float distance = glm::length(d) - radius;
+        if (distance <= 0.0f) return 0;  // Inside the sphere
+        float pixelsPerModelUnit = pixelsPerUnit * (mesh.boundsRadius > 0.0f ? radius / mesh.boundsRadius : 1.0f) / distance;
+        while (level > 0 && mesh.lods[level].error * pixelsPerModelUnit > LOD_PIXEL_ERROR) level--;
+        return level;
+    }
+};
+
+/**
+ * @brief One room of the scene: what a pass culls, lights and shadows by.
+ * @details Rooms see each other only through their portals. Every mesh keeps its instances grouped by
+ * room (Mesh::roomStarts), so culling and command building only touch the rooms a pass reached.
+ */
+struct Room {
+    std::string name;
+    glm::vec3 boundsMin, boundsMax;          // Where the camera has to be to stand in it
+    std::vector<int> portals;                // Into ClassroomSimulator::portals
+    std::vector<int> lights;                 // Into ClassroomSimulator::lights
+    std::vector<int> overlapping;            // Other rooms whose instances reach into this one: walked along with it
+    glm::vec3 casterMin = glm::vec3(FLT_MAX);// Box around every shadow caster reaching into it
+    glm::vec3 casterMax = glm::vec3(-FLT_MAX);
+
+    bool Contains(const glm::vec3& p) const {
+        return p.x >= boundsMin.x && p.y >= boundsMin.y && p.z >= boundsMin.z &&
+               p.x <= boundsMax.x && p.y <= boundsMax.y && p.z <= boundsMax.z;
+    }
+};
+
+/**
+ * @brief A light of the scene, shaded while its room is visible and shadowed while it holds one of the NUM_LIGHTS slots.
+ */
+struct Light {
+    glm::vec3 position;
+    int room;
+    std::vector<unsigned char> shadowRooms;  // Per room: walked by its shadow pass (its own, and those behind its portals)
+    glm::vec3 casterMin, casterMax;          // Box around the casters in those rooms, to fit its depth range
+};
+
+/**
+ * @brief Current shadow map configuration, set from a preset by ApplyShadowQuality().
+ * @details Every light renders into a whole array layer of the preset's resolution.
+ */
+struct ShadowSettings {
+    int resolution = 1024;
+    GLenum depthFormat = GL_DEPTH_COMPONENT16;
+    bool reverseZ = false;          // Near = 1, far = 0 in a [0,1] clip range (glClipControl)
+};
+
+/**
+ * @brief Per-frame light table and cluster lists, read by the lighting shaders through buffer textures.
+ * @details Buffer textures keep the shaders independent of the light count (no fixed-size uniform
+ * arrays) and work on plain GL 3.3. Rebuilt on the CPU every frame by AssignLightClusters().
+ */
+struct LightClusterGrid {
+    // -- CPU Staging (kept, reused every frame) --
+    std::vector<glm::vec4> lightData;       // LIGHT_DATA_TEXELS per light
+    std::vector<GLuint> clusterRanges;      // Per cluster: first entry in lightIndices, light count
+    std::vector<GLushort> lightIndices;     // Light table indices, cluster by cluster
+    int lightCount = 0;
+    std::vector<glm::vec3> centers;         // Per light: camera-space position
+    std::vector<int> firstSlice, lastSlice; // Per light: depth slices its sphere reaches (empty if last < first)
+    std::vector<int> layerOfLight;          // Per scene light: shadow layer, -1 for none
+    glm::vec2 tileScale = glm::vec2(0.0f);  // Shader: tile = fragCoord * tileScale
+    glm::vec2 depthParams = glm::vec2(0.0f);// Shader: slice = log(depth) * x + y
+
+    // -- GPU Buffers & their Buffer Textures --
+    GLuint lightBuffer = 0, lightTexture = 0;       // GL_RGBA32F, Texture unit 4
+    GLuint clusterBuffer = 0, clusterTexture = 0;   // GL_RG32UI,  Texture unit 5
+    GLuint indexBuffer = 0, indexTexture = 0;       // GL_R16UI,   Texture unit 6
+
+    void Init() {
+        const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+        GLuint* buffers[3] = { &lightBuffer, &clusterBuffer, &indexBuffer };
+        GLuint* textures[3] = { &lightTexture, &clusterTexture, &indexTexture };
+        for (int i = 0; i < 3; i++) {
+            glGenBuffers(1, buffers[i]);
+            glBindBuffer(GL_TEXTURE_BUFFER, *buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+            glGenTextures(1, textures[i]);
+            glBindTexture(GL_TEXTURE_BUFFER, *textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], *buffers[i]);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // Respecifies (orphans) all three buffers with this frame's contents
+    void Upload() const {
+        glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, lightData.size() * sizeof(glm::vec4), lightData.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, clusterBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, clusterRanges.size() * sizeof(GLuint), clusterRanges.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(lightIndices.size(), 1) * sizeof(GLushort), lightIndices.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void Bind() const {
+        glActiveTexture(GL_TEXTURE4); glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+        glActiveTexture(GL_TEXTURE5); glBindTexture(GL_TEXTURE_BUFFER, clusterTexture);
+        glActiveTexture(GL_TEXTURE6); glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+    }
+
     void Dispose() {
-        if (vertexBuffer) glDeleteBuffers(1, &vertexBuffer);
-        if (uvBuffer) glDeleteBuffers(1, &uvBuffer);
-        if (normalBuffer) glDeleteBuffers(1, &normalBuffer);
-        if (elementBuffer) glDeleteBuffers(1, &elementBuffer);
-        if (textureID) glDeleteTextures(1, &textureID);
+        if (lightTexture) glDeleteTextures(1, &lightTexture);
+        if (clusterTexture) glDeleteTextures(1, &clusterTexture);
+        if (indexTexture) glDeleteTextures(1, &indexTexture);
+        if (lightBuffer) glDeleteBuffers(1, &lightBuffer);
+        if (clusterBuffer) glDeleteBuffers(1, &clusterBuffer);
+        if (indexBuffer) glDeleteBuffers(1, &indexBuffer);
+    }
+};
+
+/**
+ * @brief CPU copy of the std140 FrameUniforms block the lighting shaders include from shaders/Lights.glsl.
+ * @details Filled once per frame after the camera and light clusters are known, and read by
+ * every forward, G-Buffer and deferred lighting program through FRAME_UNIFORMS_BINDING.
+ */
+struct FrameUniformBlock {
+    glm::mat4 V;
+    glm::mat4 VP;
+    glm::mat4 InvView;
+    glm::mat4 InvProjection;
+    glm::ivec3 ClusterGrid;        // Tiles x, tiles y, depth slices
+    GLint LightCount;              // Shares the 16-byte slot ClusterGrid leaves over
+    glm::vec2 ClusterTileScale;
+    glm::vec2 ClusterDepthParams;
+    float ShadowDepthBias;
+    float Time;                    // Seconds, drives InstanceAnimation
+    float padding[2];              // std140 rounds the block up to 16 bytes
+};
+static_assert(offsetof(FrameUniformBlock, LightCount) == 268 && offsetof(FrameUniformBlock, ShadowDepthBias) == 288 &&
+              offsetof(FrameUniformBlock, Time) == 292 && sizeof(FrameUniformBlock) == 304, "FrameUniformBlock must match the std140 layout of FrameUniforms");
+
+/**
+ * @brief Sets everything about a lighting program that never changes: sampler units and uniform block bindings.
+ * @details All lighting programs share one unit per texture and one binding point per block, so this
+ * runs once per program at link time and nothing is rebound per draw. Names a program lacks are skipped.
+ */
+static void BindProgramResources(GLuint program) {
+    glUseProgram(program);
+    const char* samplers[] = {
+        "myTextureSampler", "shadowMapArray", "NormalTextureSampler", "SpecularTextureSampler",  // Units 0-3
+        "LightData", "ClusterRanges", "ClusterLightIndices",                                     // Units 4-6
+        "GBufferAlbedo", "GBufferNormal", "GBufferSpecular", "GBufferDepth",                     // Units 7-10
+        "OITAccumulation", "OITWeight" };                                                        // Units 11-12
+    for (int unit = 0; unit < (int)(sizeof(samplers) / sizeof(samplers[0])); unit++) {
+        glUniform1i(glGetUniformLocation(program, samplers[unit]), unit);
+    }
+
+    const char* blocks[2] = { "FrameUniforms", "MaterialTable" };
+    const GLuint bindings[2] = { FRAME_UNIFORMS_BINDING, MATERIAL_TABLE_BINDING };
+    for (int i = 0; i < 2; i++) {
+        GLuint index = glGetUniformBlockIndex(program, blocks[i]);
+        if (index != GL_INVALID_INDEX) glUniformBlockBinding(program, index, bindings[i]);
+    }
+}
+
+/**
+ * @brief LIGHT_ATTENUATION as permutation defines for the lighting shaders.
+ * @details Each model becomes LIGHT_POWER_<model> and ATTENUATION_<model> = vec4(factor, base, linear, quadratic).
+ */
+static std::string AttenuationDefines() {
+    const char* names[NUM_ATTENUATION_MODELS] = { "DEFAULT", "SPECULAR_MAPPED" };
+    std::string defines;
+    for (int i = 0; i < NUM_ATTENUATION_MODELS; i++) {
+        const LightAttenuation& m = LIGHT_ATTENUATION[i];
+        defines += std::string("#define LIGHT_POWER_") + names[i] + " " + std::to_string(m.power) + "\n";
+        defines += std::string("#define ATTENUATION_") + names[i] + " vec4(" + std::to_string(m.factor) + ", " + std::to_string(m.base) + ", " +
+                   std::to_string(m.linear) + ", " + std::to_string(m.quadratic) + ")\n";
+    }
+    return defines;
+}
+
+
+/**
+ * @brief Colour + depth target that frames are rendered into instead of the window (--benchmark --resolution).
+ */
+struct OffscreenTarget {
+    GLuint framebuffer = 0;
+    GLuint colorBuffer = 0, depthBuffer = 0;
+    int width = 0, height = 0;
+
+    // Returns false if the framebuffer is incomplete
+    bool Init(int w, int h) {
+        width = w;
+        height = h;
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glGenRenderbuffers(1, &colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        if (!complete) printf("Error: Offscreen target is incomplete!\n");
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return complete;
+    }
+
+    void Dispose() {
+        if (framebuffer) glDeleteFramebuffers(1, &framebuffer);
+        if (colorBuffer) glDeleteRenderbuffers(1, &colorBuffer);
+        if (depthBuffer) glDeleteRenderbuffers(1, &depthBuffer);
+        framebuffer = colorBuffer = depthBuffer = 0;
+        width = height = 0;
+    }
+};
 
-        if (hasNormalMap) {
-            glDeleteBuffers(1, &tangentBuffer);
-            glDeleteBuffers(1, &bitangentBuffer);
-            glDeleteTextures(1, &normalTextureID);
-            glDeleteTextures(1, &specularTextureID);
+/**
+ * @brief Render targets of the deferred path, sized to the window.
+ * @details Albedo (RGBA8), camera-space normal + light model (RGBA16F), specular colour (RGBA8)
+ * and depth. Single-sampled, so opaque geometry loses MSAA in this path.
+ */
+struct GBuffer {
+    GLuint framebuffer = 0;
+    GLuint albedoTexture = 0, normalTexture = 0, specularTexture = 0, depthTexture = 0;
+    int width = 0, height = 0;
+
+    // (Re)creates the targets when the size changes. Returns false if the framebuffer is incomplete.
+    bool Resize(int w, int h) {
+        if (w == width && h == height) return true;
+        Dispose();
+        width = w;
+        height = h;
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        const GLenum formats[3] = { GL_RGBA8, GL_RGBA16F, GL_RGBA8 };
+        GLuint* targets[3] = { &albedoTexture, &normalTexture, &specularTexture };
+        for (int i = 0; i < 3; i++) {
+            glGenTextures(1, targets[i]);
+            glBindTexture(GL_TEXTURE_2D, *targets[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, formats[i], w, h, 0, GL_RGBA, GL_FLOAT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, *targets[i], 0);
+        }
+        glGenTextures(1, &depthTexture);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, w, h, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+
+        const GLenum drawBuffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+        glDrawBuffers(3, drawBuffers);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        if (!complete) printf("Error: G-Buffer is incomplete!\n");
+        return complete;
+    }
+
+    // Albedo, normal, specular, depth on texture units 7-10
+    void BindTextures() const {
+        const GLuint textures[4] = { albedoTexture, normalTexture, specularTexture, depthTexture };
+        for (int i = 0; i < 4; i++) {
+            glActiveTexture(GL_TEXTURE7 + i);
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+        }
+    }
+
+    void Dispose() {
+        if (framebuffer) glDeleteFramebuffers(1, &framebuffer);
+        const GLuint textures[4] = { albedoTexture, normalTexture, specularTexture, depthTexture };
+        for (GLuint texture : textures) if (texture) glDeleteTextures(1, &texture);
+        framebuffer = albedoTexture = normalTexture = specularTexture = depthTexture = 0;
+        width = height = 0;
+    }
+};
+
+/**
+ * @brief Accumulation targets of the weighted blended transparency mode.
+ * @details Target 0 sums the weighted premultiplied colours (rgb) and multiplies the revealage (a),
+ * target 1 sums the weights. The depth buffer receives a copy of the scene's before the glass is drawn,
+ * so it takes the scene framebuffer's depth format (a blit needs matching formats).
+ */
+struct OITTarget {
+    GLuint framebuffer = 0;
+    GLuint accumulationTexture = 0, weightTexture = 0, depthBuffer = 0;
+    int width = 0, height = 0;
+    GLenum depthFormat = 0;
+
+    // (Re)creates the targets when the size or depth format changes. Returns false if the framebuffer is incomplete.
+    bool Resize(int w, int h, GLenum sceneDepthFormat) {
+        if (w == width && h == height && sceneDepthFormat == depthFormat) return true;
+        Dispose();
+        width = w;
+        height = h;
+        depthFormat = sceneDepthFormat;
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        const GLenum formats[2] = { GL_RGBA16F, GL_R16F };
+        GLuint* targets[2] = { &accumulationTexture, &weightTexture };
+        for (int i = 0; i < 2; i++) {
+            glGenTextures(1, targets[i]);
+            glBindTexture(GL_TEXTURE_2D, *targets[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, formats[i], w, h, 0, GL_RGBA, GL_FLOAT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, *targets[i], 0);
         }
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, depthFormat, w, h);
+        GLenum attachment = depthFormat == GL_DEPTH24_STENCIL8 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, depthBuffer);
+
+        const GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, drawBuffers);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        if (!complete) printf("Error: OIT framebuffer is incomplete!\n");
+        return complete;
+    }
+
+    // Accumulation, weight on texture units 11-12
+    void BindTextures() const {
+        glActiveTexture(GL_TEXTURE11);
+        glBindTexture(GL_TEXTURE_2D, accumulationTexture);
+        glActiveTexture(GL_TEXTURE12);
+        glBindTexture(GL_TEXTURE_2D, weightTexture);
+    }
+
+    void Dispose() {
+        if (framebuffer) glDeleteFramebuffers(1, &framebuffer);
+        if (accumulationTexture) glDeleteTextures(1, &accumulationTexture);
+        if (weightTexture) glDeleteTextures(1, &weightTexture);
+        if (depthBuffer) glDeleteRenderbuffers(1, &depthBuffer);
+        framebuffer = accumulationTexture = weightTexture = depthBuffer = 0;
+        width = height = 0;
+        depthFormat = 0;
+    }
+};
+
+/**
+ * @brief Command line settings, see ParseLaunchOptions().
+ */
+struct LaunchOptions {
+    const char* profileDumpPath = nullptr;  // --profile <file>: per-frame timings as CSV, or JSON for *.json
+    const char* recordPathFile = nullptr;   // --record-path <file>: save the live camera as a path for --camera-path
+    const char* capturePath = nullptr;      // --capture <file>: read every frame back and write it out (FrameCapture)
+
+    // --benchmark and its settings
+    bool benchmark = false;
+    int benchmarkFrames = BENCHMARK_DEFAULT_FRAMES;  // --frames <n>, after the warm-up
+    const char* cameraPathFile = nullptr;            // --camera-path <file>, else BENCHMARK_DEFAULT_PATH
+    int renderWidth = 0, renderHeight = 0;           // --resolution <w>x<h>: headless, into an offscreen target
+    const char* benchmarkOutput = BENCHMARK_DEFAULT_OUTPUT;  // --output <file>: JSON report
+    int shadowQuality = DEFAULT_SHADOW_QUALITY;      // --shadow-quality <n>
+    int overdrawMode = OVERDRAW_NONE;                // --overdraw <n>
+    bool deferred = false;                           // --deferred
+    int transparencyMode = TRANSPARENCY_SORTED;      // --transparency <n>
+
+    const char* sceneFile = nullptr;                 // --scene <file>, else DEFAULT_SCENE_FILE
+};
+
+/**
+ * @brief min / avg / p95 / p99 / max of a set of timings (nearest-rank percentiles).
+ */
+struct TimingStats {
+    double min = 0.0, avg = 0.0, p95 = 0.0, p99 = 0.0, max = 0.0;
+    size_t count = 0;
+
+    static TimingStats From(std::vector<double> values) {
+        TimingStats stats;
+        stats.count = values.size();
+        if (values.empty()) return stats;
+        std::sort(values.begin(), values.end());
+        double sum = 0.0;
+        for (double v : values) sum += v;
+        auto percentile = [&](double p) { return values[(size_t)std::max(std::ceil(p * values.size()) - 1.0, 0.0)]; };
+        stats.min = values.front();
+        stats.avg = sum / values.size();
+        stats.p95 = percentile(0.95);
+        stats.p99 = percentile(0.99);
+        stats.max = values.back();
+        return stats;
+    }
+
+    void WriteJson(FILE* out) const {
+        fprintf(out, "{\"frames\": %zu, \"min\": %.4f, \"avg\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}",
+                count, min, avg, p95, p99, max);
     }
 };
 
 /**
- * @brief Caches Shader Uniform Locations to avoid string lookups during the render loop.
+ * @brief State of a --benchmark run: the path being replayed and what has been measured so far.
  */
-struct RenderUniforms {
-    GLuint MatrixID, ModelMatrixID, TextureID;
-    GLuint NormalSamplerID, SpecularSamplerID, SmudgeSamplerID;
-    GLuint bUseNormalMapID, bUseSpecularMapID;
-    GLuint AlphaID, UnlitID, bIsGlassID;
+struct BenchmarkRun {
+    std::vector<CameraKeyframe> path;
+    std::vector<double> frameTimes;        // Milliseconds from swap to swap, measured frames only
+    std::vector<ProfileFrame> profiles;    // Every profiled frame, warm-up included (filtered when reporting)
+    std::vector<unsigned long long> measuredProfiles;  // Profiler frame number of each entry of frameTimes
+    int frame = 0;                         // Frames rendered so far, warm-up included
+    double lastSwapTime = 0.0;
 };
 
 // =================================================================
@@ -129,7 +1187,7 @@ struct RenderUniforms {
 
 class ClassroomSimulator {
 public:
-    ClassroomSimulator();
+    explicit ClassroomSimulator(const LaunchOptions& launchOptions);
     ~ClassroomSimulator();
 
     /**
@@ -138,65 +1196,280 @@ public:
     void Run();
 
 private:
+    LaunchOptions options;
+
     // --- System Handles ---
-    GLuint VertexArrayID = 0;
     GLuint FramebufferName = 0;
     GLuint depthTextureArray = 0;
 
+    // --- Geometry Arenas ---
+    // Indexed by ArenaIndex(). All draws are DrawCommands, rebuilt for every pass and mirrored into indirectBuffer.
+    GeometryArena arenas[NUM_ARENAS];
+    std::vector<unsigned char> arenaVisibility[NUM_ARENAS]; // Per-instance result of the current pass's cull
+    LodSelection cullLod;                                   // Level of detail rule of the current pass
+    std::vector<DrawCommand> drawCommands;
+    GLuint indirectBuffer = 0;
+    bool useMultiDrawIndirect = false;          // GL 4.3 path; otherwise one base-vertex draw per command
+    std::vector<DrawBatch> shadowCasterBatches;  // Every caster
+    std::vector<DrawBatch> shadowStaticBatches;  // Casters kept in the cached layer
+    std::vector<DrawBatch> shadowDynamicBatches; // Casters redrawn every frame
+
+    // --- Material Table ---
+    // Textures are grouped into arrays by size and format; see BuildMaterialTable().
+    std::vector<Material> materials;
+    std::vector<GLuint> textureArrays;
+    std::vector<DrawBatch> opaqueBatches;
+    std::vector<DrawBatch> normalMapBatches;
+    std::vector<DrawBatch> transparentBatches;
+    std::vector<DrawBatch> unlitBatches;
+
+    // --- Asset Loading ---
+    // Files are read, parsed and indexed on worker threads; only packing and GL uploads stay on this thread.
+    JobSystem jobs;
+    std::vector<MeshLoad> meshLoads;                    // Queued by LoadStandardMesh() / LoadNormalMapMesh()
+    size_t meshLoadsPacked = 0;                         // meshLoads[0, meshLoadsPacked) are in their arenas
+    std::map<std::string, LoadedTexture> loadedTextures; // Keyed by path, emptied once streamed
+    std::vector<ShaderLoad> shaderLoads;                // Submitted by InitShaders(), linked by FinishShaders()
+
+    // --- Streaming Uploads ---
+    // Geometry and texture layers reach the GPU through a fenced staging ring, a few MB per frame and
+    // nearest to the camera first; meshes are culled and materials drawn as placeholders until then.
+    StreamingUploader streamer;
+    bool materialTableDirty = false;             // A material's last texture arrived; re-upload the table
+
+    // --- Shadow Cache ---
+    // Static casters never move, so each layer is rendered once and kept until invalidated.
+    // With dynamic casters present, static depth lives in staticDepthTextureArray and is
+    // blitted into depthTextureArray each frame before the dynamic casters are drawn on top.
+    GLuint staticFramebuffer = 0;
+    GLuint staticDepthTextureArray = 0;
+    bool shadowLayerDirty[NUM_LIGHTS];
+    bool shadowLayerHadDynamic[NUM_LIGHTS];     // Composite contained dynamic casters last frame
+    glm::vec3 shadowLightPositions[NUM_LIGHTS];  // Positions the cached layers were rendered from
+    glm::mat4 lightViewProjections[NUM_LIGHTS];
+    glm::mat4 depthBiasMVPs[NUM_LIGHTS];
+    bool splitDynamicShadows = true;             // Keep dynamic casters out of the cached layer
+
+    // --- Shadow Quality ---
+    ShadowSettings shadowSettings;
+    int shadowQuality = DEFAULT_SHADOW_QUALITY;  // Index into SHADOW_QUALITY_PRESETS
+    bool hasClipControl = false;                 // GL 4.5 / ARB_clip_control, required for reverse-Z
+
+    // --- Layered Shadow Pass ---
+    // Every layer refreshed this frame in one submission: each instance is drawn once per layer
+    // and routed with gl_Layer, instead of re-walking the batches for each light.
+    bool layeredShadows = true;                  // Toggled with L; off = one submission per layer
+    bool vertexShaderLayer = false;              // gl_Layer writable from the vertex shader (else geometry shader)
+    GLuint layeredDepthProgramID = 0;
+    GLuint layerViewProjectionsID = 0;
+    GLuint layerIndicesID = 0;
+    GLuint layerCountID = 0;
+    GLuint layeredDepthTimeID = 0;
+    std::vector<unsigned char> cullScratch;      // One frustum's result while a pass ORs several
+
+    // --- Overdraw Reduction ---
+    int overdrawMode = OVERDRAW_NONE;
+
+    // --- Transparency ---
+    int transparencyMode = TRANSPARENCY_SORTED;
+    OITTarget oit;
+    GLenum windowDepthFormat = GL_DEPTH24_STENCIL8;  // The window's depth buffer, which the OIT depth copy must match
+    GLuint oitPrograms[NUM_SHADING_MODELS] = {};  // Glass permutations writing the accumulation targets
+    GLuint oitCompositeProgramID = 0;
+    // SortBackToFront() scratch, kept between frames so the sort stops allocating once it has grown
+    std::vector<unsigned int> sortKeys, sortKeysScratch;
+    std::vector<GLuint> sortOrder, sortOrderScratch;
+    std::vector<DrawCommand> sortedCommands;
+
+    // --- Clustered Lighting ---
+    LightClusterGrid lightClusters;
+    float lightInfluenceRadius = 0.0f;           // See LightInfluenceRadius()
+
     // --- Shader Systems ---
-    GLuint programID = 0;       // Main lighting shader
+    // Main lighting shader, one permutation per [material class][shading model]; see ForwardProgram()
+    GLuint forwardPrograms[NUM_MATERIAL_CLASSES][NUM_SHADING_MODELS] = {};
     GLuint depthProgramID = 0;  // Shadow generation shader
-    GLuint depthMatrixID = 0;
-    RenderUniforms uniforms;
-
-    // --- Shader Handles ---
-    GLuint ViewMatrixID;
-    GLuint DepthBiasMatricesID;
-    GLuint ShadowMapArrayID;
-    GLuint ShadingModelID;
-    GLuint ClassroomLightPositionsID;
+    GLuint depthViewProjectionID = 0;
+    GLuint depthTimeID = 0;
+
+    // --- Animation ---
+    double animationStartTime = 0.0;             // glfwGetTime() when the loop started
+
+    // --- Deferred Path ---
+    // Opaque buckets are written to the G-Buffer, then lit by one full-screen pass; glass stays forward.
+    bool deferredShading = false;                // Toggled with F
+    GBuffer gbuffer;
+    GLuint fullScreenVao = 0;                    // Empty; the full-screen triangle comes from gl_VertexID
+    GLuint gbufferPrograms[NUM_GBUFFER_CLASSES] = {};  // By material class: standard, normal mapped
+    GLuint deferredLightingProgramID = 0;
+
+    // --- Uniform Buffers ---
+    // Bound once to their binding points; only their contents change
+    FrameUniformBlock frameUniforms = {};
+    GLuint frameUniformBuffer = 0;
+    GLuint materialUniformBuffer = 0;
+
+    // --- Profiling ---
+    // GPU pass timings, CPU scopes and draw counters; only measured while the overlay is up or dumping.
+    FrameProfiler profiler;
+    bool profilerOverlay = false;                // Toggled with O
+    std::vector<CameraKeyframe> recordedPath;    // --record-path keyframes, saved on exit
+
+    // --- Benchmark Mode ---
+    BenchmarkRun benchmark;
+    OffscreenTarget offscreen;                   // Only created for --resolution
+
+    // --- Frame Capture ---
+    // --capture: frames are read back through fenced pixel pack buffers and written on another thread
+    FrameCapture capture;
 
     // --- Scene Assets ---
-    // Meshes grouped by type for optimized rendering
-    Mesh bench, door, switchObj, exhaust, clock, pipe, projector, screen;
-    Mesh floorMesh, fan, greenboard, podium, table, lightPanel, grid;
-    Mesh windowMesh, wallFan, glass;
-    Mesh wall, ceiling;
+    // One per mesh record of the scene file, in its order. Sized once: everything below points into it.
+    std::vector<Mesh> sceneMeshes;
 
     // --- Render Lists ---
-    // Pointers to meshes, sorted by shader requirements
+    // Pointers to meshes, sorted by shader requirements (the scene file's buckets)
     std::vector<Mesh*> opaqueMeshes;
     std::vector<Mesh*> normalMapMeshes;
     std::vector<Mesh*> transparentMeshes;
+    std::vector<Mesh*> unlitMeshes;
+
+    // --- Rooms & Portals ---
+    std::vector<Room> rooms;
+    std::vector<ScenePortal> portals;
+    std::vector<unsigned char> cameraRooms;      // Per room: reached by the camera this frame (UpdateVisibleRooms)
+    std::vector<unsigned char> cullRooms;        // Per room: walked by the current pass, overlapping rooms included
+    std::vector<unsigned char> roomScratch;      // Several lights' rooms while a layered pass ORs them
 
     // --- Lighting State ---
+    // Slot i is shadow layer i; AssignLightSlots() fills them from the scene lights.
+    std::vector<Light> lights;
+    std::vector<int> shadedLights;               // Lights of the visible rooms, nearest first: the light table
+    int lightSlots[NUM_LIGHTS];                  // Index into lights, -1 for an empty slot
     glm::vec3 classroomLightPositions_worldspace[NUM_LIGHTS];
 
     // --- Internal Methods ---
     bool InitSystem();
     bool InitShadowFramebuffer();
+    bool InitShadowCache();
+    void AllocateShadowArrays();
+    void ApplyShadowQuality(int quality);
     void InitShaders();
-    void LoadScene();
+    void CompileProgram(const char* vertexPath, const char* geometryPath, const char* fragmentPath,
+                        const std::string& defines, std::function<void(GLuint)> onLinked);
+    void FinishShaders();
+    GLuint ForwardProgram(int materialClass, int shadingModel) const;
+    bool LoadScene();
     void MainLoop();
+    void UpdateProfilerReport(double& nextTitleTime, double& nextPrintTime);
+    bool InitBenchmark();
+    void AdvanceBenchmark();
+    void WriteBenchmarkReport();
     void Cleanup();
 
     // Utilities
-    Mesh LoadStandardMesh(const char* objPath, const char* ddsPath);
-    Mesh LoadNormalMapMesh(const char* objPath, const char* diffPath, const char* normPath, const char* specPath);
-    void AddObject(Mesh& mesh, glm::vec3 pos, float rotDeg = 0.0f, glm::vec3 rotAxis = glm::vec3(0,1,0), glm::vec3 scale = glm::vec3(1.0f));
+    void LoadStandardMesh(Mesh& mesh, const char* objPath, const char* ddsPath, bool buildLods = false);
+    void LoadNormalMapMesh(Mesh& mesh, const char* objPath, const char* diffPath, const char* normPath, const char* specPath);
+    void StartAssetLoads();
+    void PackFinishedMeshLoads();
+    void FinishAssetLoads();
+    void PackMeshData(Mesh& mesh, const MeshData& data);
+    int AddMaterial(const char* diffusePath, const char* normalPath = "", const char* specularPath = "");
+    void BuildMaterialTable();
+    void UploadMaterialTable();
+    void QueueAssetStreaming();
+    void BakeGeometryArenas();
+    void BuildDrawBatches();
+    void AppendShadowBatches(std::vector<DrawBatch>& batches, int dynamicFilter);
+    void AppendMaterialBatches(std::vector<DrawBatch>& batches, const std::vector<Mesh*>& meshes);
+    void BeginCullPass(const Frustum& frustum, const LodSelection& lod, const std::vector<unsigned char>& roomMask);
+    void BeginCullPass(const Frustum* frusta, int frustumCount, const LodSelection& lod, const std::vector<unsigned char>& roomMask);
+    void EmitVisibleCommands(std::vector<DrawBatch>& batches, GLuint layerCount = 1, bool singleInstances = false);
+    void SortFrontToBack(std::vector<DrawBatch>& batches, const glm::vec3& eye);
+    void SortBackToFront(std::vector<DrawBatch>& batches, const glm::mat4& view);
+    void UploadCommands();
+    void InvalidateShadowCaster(const Mesh& mesh);
+    void UpdateAnimation();
+    int RoomAt(const glm::vec3& position) const;
+    void UpdateVisibleRooms(const glm::mat4& viewProjection, const glm::vec3& eye);
+    void MarkVisibleRooms(int room, int throughPortal, const glm::vec4& screenRect, int depth, const glm::mat4& viewProjection, const glm::vec3& eye);
+    void AssignLightSlots(const glm::vec3& eye);
+    void AssignLightClusters(const glm::mat4& view, const glm::mat4& projection, int width, int height);
+    float LightInfluenceRadius() const;
+    void RenderShadowMaps();
+    void RenderShadowLayer(int lightIdx, bool refreshStatic, bool recomposite, const Frustum& lightFrustum);
+    void RenderShadowLayersLayered(const bool* refreshStatic, const bool* recomposite, const Frustum* lightFrusta);
+    glm::mat4 ComputeLightProjection(const glm::mat4& lightView, const Light& light) const;
     
-    void DrawMesh(const Mesh& mesh, const RenderUniforms& uniforms, const glm::mat4& View, const glm::mat4& Projection, float alpha = 1.0f);
-    void DrawMeshShadow(const Mesh& mesh, GLuint depthMatrixID, const glm::mat4& dProj, const glm::mat4& dView);
+    void SubmitCommands(const GeometryArena& arena, GLuint vertexArray, GLuint firstCommand, GLsizei commandCount, GLuint instanceDivisor = 1);
+    void DrawBatches(const std::vector<DrawBatch>& batches);
+    void DrawDepthBatches(const std::vector<DrawBatch>& batches, GLuint layerCount = 1);
 };
 
 // =================================================================
 // 5. MAIN ENTRY POINT
 // =================================================================
 
-int main(void)
+static bool ParseLaunchOptions(int argc, char** argv, LaunchOptions& options)
+{
+    bool valid = true;
+    for (int i = 1; i < argc && valid; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--profile") == 0 && hasValue) {
+            options.profileDumpPath = argv[++i];
+        } else if (strcmp(argv[i], "--record-path") == 0 && hasValue) {
+            options.recordPathFile = argv[++i];
+        } else if (strcmp(argv[i], "--capture") == 0 && hasValue) {
+            options.capturePath = argv[++i];
+        } else if (strcmp(argv[i], "--benchmark") == 0) {
+            options.benchmark = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && hasValue) {
+            options.benchmarkFrames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--camera-path") == 0 && hasValue) {
+            options.cameraPathFile = argv[++i];
+        } else if (strcmp(argv[i], "--resolution") == 0 && hasValue) {
+            valid = sscanf(argv[++i], "%dx%d", &options.renderWidth, &options.renderHeight) == 2;
+        } else if (strcmp(argv[i], "--output") == 0 && hasValue) {
+            options.benchmarkOutput = argv[++i];
+        } else if (strcmp(argv[i], "--shadow-quality") == 0 && hasValue) {
+            options.shadowQuality = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--overdraw") == 0 && hasValue) {
+            options.overdrawMode = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--deferred") == 0) {
+            options.deferred = true;
+        } else if (strcmp(argv[i], "--transparency") == 0 && hasValue) {
+            options.transparencyMode = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scene") == 0 && hasValue) {
+            options.sceneFile = argv[++i];
+        } else {
+            valid = false;
+        }
+    }
+    valid = valid && options.benchmarkFrames > 0 && options.renderWidth >= 0 && options.renderHeight >= 0 &&
+            options.shadowQuality >= 0 && options.shadowQuality < NUM_SHADOW_QUALITY_PRESETS &&
+            options.overdrawMode >= 0 && options.overdrawMode < NUM_OVERDRAW_MODES &&
+            options.transparencyMode >= 0 && options.transparencyMode < NUM_TRANSPARENCY_MODES;
+    if (!valid) {
+        fprintf(stderr, "Usage: %s [--scene <file.scene>] [--profile <timings.csv|timings.json>] [--record-path <path.txt>]\n"
+                        "       [--capture <frames.ppm|frame%%05d.ppm>]\n"
+                        "       [--benchmark [--frames <n>] [--camera-path <path.txt>] [--resolution <w>x<h>]\n"
+                        "                    [--output <report.json>] [--shadow-quality <0-%d>] [--overdraw <0-%d>] [--deferred]\n"
+                        "                    [--transparency <0-%d>]]\n",
+                argv[0], NUM_SHADOW_QUALITY_PRESETS - 1, NUM_OVERDRAW_MODES - 1, NUM_TRANSPARENCY_MODES - 1);
+    }
+    return valid;
+}
+
+int main(int argc, char** argv)
 {
+    LaunchOptions options;
+    if (!ParseLaunchOptions(argc, argv, options)) return 1;
+
+    // Debug builds check the vertex welder against the reference search before any mesh is indexed
+    assert(indexVBO_selfTest());
+
     // Allocate on heap to prevent stack overflow
-    ClassroomSimulator* app = new ClassroomSimulator();
+    ClassroomSimulator* app = new ClassroomSimulator(options);
     app->Run();
     delete app;
     return 0;
@@ -206,7 +1479,7 @@ int main(void)
 // 6. CLASS IMPLEMENTATION
 // =================================================================
 
-ClassroomSimulator::ClassroomSimulator() {
+ClassroomSimulator::ClassroomSimulator(const LaunchOptions& launchOptions) : options(launchOptions) {
     // Constructor handles zero-initialization via member initializers
 }
 
@@ -218,16 +1491,26 @@ void ClassroomSimulator::Run() {
     // 1. Initialize Window & OpenGL Context
     if (!InitSystem()) return;
 
-    // 2. Compile Shaders & Link Uniforms
+    // 2. Start Compiling Shaders (linked in LoadScene, once the asset loads are under way)
     InitShaders();
 
     // 3. Create FBO for Shadow Mapping
     if (!InitShadowFramebuffer()) return;
     
     // 4. Load Models & Compose Scene
-    LoadScene();
+    if (!LoadScene()) return;
+
+    // 5. Prepare Cached Shadow Layers (needs the final caster list)
+    if (!InitShadowCache()) return;
+
+    // Benchmark: camera path, render target and the settings under test
+    if (options.benchmark && !InitBenchmark()) return;
+    if (options.capturePath && !capture.init(options.capturePath)) return;
+
+    // 6. Stream Geometry & Textures to the GPU (from the start-up camera outwards)
+    QueueAssetStreaming();
     
-    // 5. Enter Infinite Render Loop
+    // 7. Enter Infinite Render Loop
     MainLoop();
 }
 
@@ -244,6 +1527,10 @@ bool ClassroomSimulator::InitSystem() {
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
+    // Headless benchmark: frames go to an offscreen target, so no window needs to show
+    bool headless = options.benchmark && options.renderWidth > 0;
+    glfwWindowHint(GLFW_VISIBLE, headless ? GLFW_FALSE : GLFW_TRUE);
+
     window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, nullptr, nullptr);
     if (window == nullptr) {
         fprintf(stderr, "Failed to open GLFW window.\n");
@@ -251,6 +1538,7 @@ bool ClassroomSimulator::InitSystem() {
         return false;
     }
     glfwMakeContextCurrent(window);
+    if (options.benchmark) glfwSwapInterval(0); // Vsync off: measure the frame, not the display
 
     glewExperimental = true;
     if (glewInit() != GLEW_OK) {
@@ -258,6 +1546,26 @@ bool ClassroomSimulator::InitSystem() {
         return false;
     }
 
+    // Indirect commands need base instances to find each mesh's matrices in the shared instance buffer
+    useMultiDrawIndirect = GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance;
+    printf("Geometry Submission: %s\n", useMultiDrawIndirect ? "Multi-Draw Indirect" : "Base-Vertex Batches");
+    hasClipControl = GLEW_ARB_clip_control;
+    if (!streamer.init(GLEW_ARB_buffer_storage)) {
+        printf("Persistent mapping failed, streaming through glMapBufferRange\n");
+        streamer.cleanup();
+        streamer.init(false);
+    }
+    vertexShaderLayer = GLEW_ARB_shader_viewport_layer_array || GLEW_AMD_vertex_shader_layer;
+    printf("Shadow Pass: Layered (%s)\n", vertexShaderLayer ? "vertex shader gl_Layer" : "geometry shader");
+
+    // Depth blits need identical formats: match the window's depth (and stencil) sizes
+    GLint depthBits = 24, stencilBits = 0, stencilType = GL_NONE;
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_STENCIL, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &stencilType);
+    if (stencilType != GL_NONE) glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_STENCIL, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencilBits);
+    if (stencilBits > 0) windowDepthFormat = GL_DEPTH24_STENCIL8;
+    else windowDepthFormat = depthBits >= 32 ? GL_DEPTH_COMPONENT32 : depthBits <= 16 ? GL_DEPTH_COMPONENT16 : GL_DEPTH_COMPONENT24;
+
     // Input Mode: FPS Style (Capture Mouse)
     glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -270,9 +1578,6 @@ bool ClassroomSimulator::InitSystem() {
     glDepthFunc(GL_LESS);
     glEnable(GL_CULL_FACE);
 
-    glGenVertexArrays(1, &VertexArrayID);
-    glBindVertexArray(VertexArrayID);
-
     return true;
 }
 
@@ -283,19 +1588,18 @@ bool ClassroomSimulator::InitShadowFramebuffer() {
     // Texture Array: Stores 9 depth maps in a single texture object
     glGenTextures(1, &depthTextureArray);
     glBindTexture(GL_TEXTURE_2D_ARRAY, depthTextureArray);
-
-    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT16, 
-                 SHADOW_WIDTH, SHADOW_HEIGHT, NUM_LIGHTS, 
-                 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
     
     // PCF Filtering Parameters
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
 
+    // Storage (size, format) and compare function come from the quality preset
+    ApplyShadowQuality(shadowQuality);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
     glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTextureArray, 0, 0);
     glDrawBuffer(GL_NONE);
     glReadBuffer(GL_NONE);
@@ -307,156 +1611,301 @@ bool ClassroomSimulator::InitShadowFramebuffer() {
     return true;
 }
 
-void ClassroomSimulator::InitShaders() {
-    // Load GLSL Code
-    depthProgramID = LoadShaders("shaders/DepthRTT.vertexshader", "shaders/DepthRTT.fragmentshader");
-    depthMatrixID = glGetUniformLocation(depthProgramID, "depthMVP");
-
-    programID = LoadShaders("shaders/ShadowMapping.vertexshader", "shaders/ShadowMapping.fragmentshader");
-    
-    // Bind Uniforms
-    uniforms.MatrixID          = glGetUniformLocation(programID, "MVP");
-    uniforms.ModelMatrixID     = glGetUniformLocation(programID, "M");
-    uniforms.TextureID         = glGetUniformLocation(programID, "myTextureSampler");
-    uniforms.bUseNormalMapID   = glGetUniformLocation(programID, "bUseNormalMap");
-    uniforms.bUseSpecularMapID = glGetUniformLocation(programID, "bUseSpecularMap");
-    uniforms.NormalSamplerID   = glGetUniformLocation(programID, "NormalTextureSampler");
-    uniforms.SpecularSamplerID = glGetUniformLocation(programID, "SpecularTextureSampler");
-    uniforms.AlphaID           = glGetUniformLocation(programID, "fragmentAlpha");
-    uniforms.UnlitID           = glGetUniformLocation(programID, "bIsUnlit");
-    uniforms.bIsGlassID        = glGetUniformLocation(programID, "bIsGlass");
-    uniforms.SmudgeSamplerID   = glGetUniformLocation(programID, "SmudgeSampler");
-
-    ViewMatrixID              = glGetUniformLocation(programID, "V");
-    DepthBiasMatricesID       = glGetUniformLocation(programID, "DepthBiasMVPs");
-    ShadowMapArrayID          = glGetUniformLocation(programID, "shadowMapArray");
-    ShadingModelID            = glGetUniformLocation(programID, "uShadingModel");
-    ClassroomLightPositionsID = glGetUniformLocation(programID, "ClassroomLightPositions_cameraspace");
-}
-
-void ClassroomSimulator::LoadScene() {
-    printf("Loading Assets (This may take a moment)...\n");
-
-    auto Mod = [](const char* name) { return std::string("assets/models/") + name; };
-    auto Tex = [](const char* name) { return std::string("assets/textures/") + name; };
-
-    // --- 1. Load Opaque Meshes ---
-    bench      = LoadStandardMesh(Mod("bench.obj").c_str(),      Tex("bench.dds").c_str());
-    door       = LoadStandardMesh(Mod("door.obj").c_str(),       Tex("door.dds").c_str());
-    switchObj  = LoadStandardMesh(Mod("switch.obj").c_str(),     Tex("switch.dds").c_str());
-    exhaust    = LoadStandardMesh(Mod("exhaust.obj").c_str(),    Tex("projector.dds").c_str());
-    clock      = LoadStandardMesh(Mod("clock.obj").c_str(),      Tex("clock.dds").c_str());
-    pipe       = LoadStandardMesh(Mod("pipe.obj").c_str(),       Tex("pipe.dds").c_str());
-    projector  = LoadStandardMesh(Mod("projector.obj").c_str(),  Tex("projector.dds").c_str());
-    screen     = LoadStandardMesh(Mod("screen.obj").c_str(),     Tex("screen.dds").c_str());
-    floorMesh  = LoadStandardMesh(Mod("floor.obj").c_str(),      Tex("floor.dds").c_str());
-    fan        = LoadStandardMesh(Mod("fan.obj").c_str(),        Tex("fan.dds").c_str());
-    greenboard = LoadStandardMesh(Mod("greenboard.obj").c_str(), Tex("greenboard.dds").c_str());
-    podium     = LoadStandardMesh(Mod("podium.obj").c_str(),     Tex("podium.dds").c_str());
-    table      = LoadStandardMesh(Mod("table.obj").c_str(),      Tex("table.dds").c_str());
-    lightPanel = LoadStandardMesh(Mod("lightpanel.obj").c_str(), Tex("lightpanel.dds").c_str());
-    grid       = LoadStandardMesh(Mod("grid.obj").c_str(),       Tex("grid.dds").c_str());
-    windowMesh = LoadStandardMesh(Mod("window.obj").c_str(),     Tex("window.dds").c_str());
-    wallFan    = LoadStandardMesh(Mod("wallfan.obj").c_str(),    Tex("wallfan.dds").c_str());
-
-    // --- 2. Load Transparent Meshes ---
-    glass      = LoadStandardMesh(Mod("glass.obj").c_str(),     Tex("glass.dds").c_str());
-
-    // --- 3. Load Normal Mapped Meshes ---
-    // These require Tangent/Bitangent calculation for the shader
-    wall    = LoadNormalMapMesh(Mod("walls.obj").c_str(),   Tex("walls.dds").c_str(),   Tex("normal.bmp").c_str(), Tex("specular.dds").c_str());
-    ceiling = LoadNormalMapMesh(Mod("ceiling.obj").c_str(), Tex("ceiling.dds").c_str(),  Tex("normal.bmp").c_str(), Tex("specular.dds").c_str());
-
-    // --- 4. Populate Render Buckets ---
-    // Grouping pointers allows iterating through types in the render loop
-    opaqueMeshes = { 
-        &bench, &door, &switchObj, &exhaust, &clock, &pipe, &projector, 
-        &screen, &floorMesh, &fan, &greenboard, &podium, &table, &windowMesh, &wallFan 
-    };
-    normalMapMeshes = { &wall, &ceiling, &grid };
-    transparentMeshes = { &glass };
-
-    // --- 5. Scene Composition (Instancing) ---
-    
-    // Benches (5x5 Grid)
-    for (int i = 0; i < 5; i++) {
-        for (int j = 0; j < 5; j++) {
-            if (i == 0 && (j == 3 || j == 4)) continue; // Leave Aisle
-            AddObject(bench, glm::vec3(-16.0f + i * 9.50f, 0.5f, -40.0f + j * 20.0f), 90.0f, glm::vec3(0,1,0));
-        }
-    }
-    
-    // Ceiling Fans (2x3 Grid)
-    glm::vec3 fanStart = glm::vec3(-32.2 + 19.32f, 32.975f, -48.3 + 22.54f);
-    for (int i = 0; i < 2; i++) {
-        for (int j = 0; j < 3; j++) {
-            AddObject(fan, fanStart + glm::vec3(i * 25.76f, 0.0f, j * 25.76f));
-        }
+bool ClassroomSimulator::InitShadowCache() {
+    // Every layer starts dirty; the first frame renders them all.
+    for (int i = 0; i < NUM_LIGHTS; i++) {
+        shadowLayerDirty[i] = true;
+        shadowLayerHadDynamic[i] = false;
+        shadowLightPositions[i] = classroomLightPositions_worldspace[i];
     }
 
-    // Static Geometry
-    AddObject(floorMesh, glm::vec3(0.0f));
-    AddObject(ceiling,   glm::vec3(0.0f, 38.1f, 0.0f));
-    AddObject(wall,      glm::vec3(-32.7f, 19.06f, 0.0f));
-    AddObject(door,      glm::vec3(-31.7f, 12.5f, 48.8f));
-    
-    // Ceiling Grid (Rotated)
-    {
-        glm::mat4 m = glm::translate(glm::mat4(1.0f), glm::vec3(0, 38.8, 0));
-        m = glm::rotate(m, glm::radians(90.0f), glm::vec3(0, 1, 0));
-        m = glm::rotate(m, glm::radians(180.0f), glm::vec3(1, 0, 0));
-        grid.addInstance(m);
+    bool hasDynamicCasters = false;
+    for (Mesh* mesh : opaqueMeshes) hasDynamicCasters |= mesh->isDynamic;
+    for (Mesh* mesh : normalMapMeshes) hasDynamicCasters |= mesh->isDynamic;
+    if (!splitDynamicShadows || !hasDynamicCasters) {
+        splitDynamicShadows = false;
+        return true;
     }
 
-    // Details
-    for (int i = 0; i < 2; i++) {
-        AddObject(greenboard, glm::vec3(-32.2f, 18.6f, i * 36 * 0.8f - 27.7f + 3.6f), 0.0f, glm::vec3(0,1,0), glm::vec3(1, 1, 0.8));
-        AddObject(switchObj, glm::vec3(-10.2f + i * 28.2f, 14.6f, 48.3f), 180.0f, glm::vec3(0,1,0), glm::vec3(0.7f));
-        AddObject(exhaust, glm::vec3(14.23f - i * 21.46f, 34.1f, 48.8f), 0.0f, glm::vec3(0,1,0), glm::vec3(0.857f));
-    }
+    // Second array holding static casters only; blit source for the per-frame composite
+    glGenFramebuffers(1, &staticFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, staticFramebuffer);
 
-    AddObject(podium,    glm::vec3(-20.0f, 0.5f, 28.0f), 290.0f);
-    AddObject(table,     glm::vec3(-9.0f, 0.5f, 13.20f), 90.0f);
-    AddObject(projector, glm::vec3(6.44f, 29.75f, -3.22f), 180.0f);
-    AddObject(screen,    glm::vec3(-31.5f, 30.0f, -9.66f), 0.0f, glm::vec3(0,1,0), glm::vec3(1, 1.2f, 1.5f));
-    AddObject(clock,     glm::vec3(7.60f, 28.0f, -48.0f), 90.0f, glm::vec3(1,0,0));
-    AddObject(pipe,      glm::vec3(-32.2f, 5.0f, -9.0f), 90.0f);
-    AddObject(wallFan,   glm::vec3(-14.0f, 25.0f, 48.3f), 180.0f, glm::vec3(0,1,0), glm::vec3(0.5f));
+    glGenTextures(1, &staticDepthTextureArray);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, staticDepthTextureArray);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    AllocateShadowArrays(); // Same size and format as the sampled array, so it can be blitted
 
-    // Windows & Glass
-    for (int i = 0; i < 8; i++) {
-        glm::vec3 pos(32.70f, 34.1f, -42.26f + 12.075f * i);
-        AddObject(windowMesh, pos, 90.0f);
-        AddObject(glass,      pos, 90.0f, glm::vec3(0,1,0), glm::vec3(1.0f, 1.0f, .250f));
-    }
-    for (int i = 0; i < 6; i++) {
-        glm::vec3 pos(26.83f - 10.73f * i, 34.1f, 48.8f);
-        AddObject(windowMesh, pos, 0.0f, glm::vec3(0,1,0), glm::vec3(0.888f, 1.0f, 1.0f));
-        AddObject(glass,      pos, 0.0f, glm::vec3(0,1,0), glm::vec3(1.0f, 1.0f, 0.25f));
-    }
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticDepthTextureArray, 0, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
 
-    // Lights
-    int lightIdx = 0;
-    for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < 3; j++) {
-            float cx = -22.54f + i * 25.76f;
-            float cz = -25.76f + j * 25.76f;
-            classroomLightPositions_worldspace[lightIdx++] = glm::vec3(cx, 38.6f, cz);
-            // Add visual representation of light
-            AddObject(lightPanel, glm::vec3(cx, 37.675f, cz), 0.0f, glm::vec3(0,1,0), glm::vec3(6.44f, 0.2f, 6.44f));
-        }
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        printf("Error: Static Shadow Framebuffer is incomplete!\n");
+        return false;
     }
+    glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
+    return true;
+}
+
+void ClassroomSimulator::AllocateShadowArrays() {
+    const GLuint shadowArrays[2] = { depthTextureArray, staticDepthTextureArray };
+    for (GLuint array : shadowArrays) {
+        if (!array) continue;
+        glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, shadowSettings.depthFormat, 
+                     shadowSettings.resolution, shadowSettings.resolution, NUM_LIGHTS, 
+                     0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    }
+
+    // Reverse-Z stores nearer surfaces as larger values, so the comparison flips
+    glBindTexture(GL_TEXTURE_2D_ARRAY, depthTextureArray);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, shadowSettings.reverseZ ? GL_GEQUAL : GL_LEQUAL);
+
+    // The old contents are gone; every layer is re-rendered next frame
+    for (bool& dirty : shadowLayerDirty) dirty = true;
+}
+
+void ClassroomSimulator::ApplyShadowQuality(int quality) {
+    const ShadowQualityPreset& preset = SHADOW_QUALITY_PRESETS[quality];
+    shadowQuality = quality;
+    shadowSettings.resolution = preset.resolution;
+    shadowSettings.depthFormat = preset.depthFormat;
+    shadowSettings.reverseZ = preset.reverseZ && hasClipControl;
+    AllocateShadowArrays();
+
+    printf("Shadow Quality: %s (%d x %d, %s depth%s)\n", preset.name, preset.resolution, preset.resolution,
+           preset.depthFormat == GL_DEPTH_COMPONENT32F ? "32F" : "16-bit", shadowSettings.reverseZ ? ", reverse-Z" : "");
+}
+
+void ClassroomSimulator::InitShaders() {
+    // Everything below is only submitted: FinishShaders() looks up the uniforms once the programs link
+    initShaderCache();
+    CompileProgram("shaders/DepthRTT.vertexshader", nullptr, "shaders/DepthRTT.fragmentshader", "",
+                   [this](GLuint program) {
+        depthProgramID = program;
+        depthViewProjectionID = glGetUniformLocation(depthProgramID, "depthVP");
+        depthTimeID = glGetUniformLocation(depthProgramID, "Time");
+    });
+
+    // Same depth pass for all layers at once; the geometry stage is only needed to set gl_Layer
+    CompileProgram("shaders/DepthRTTLayered.vertexshader",
+                   vertexShaderLayer ? nullptr : "shaders/DepthRTTLayered.geometryshader",
+                   "shaders/DepthRTT.fragmentshader", "", [this](GLuint program) {
+        layeredDepthProgramID  = program;
+        layerViewProjectionsID = glGetUniformLocation(layeredDepthProgramID, "LayerViewProjections");
+        layerIndicesID         = glGetUniformLocation(layeredDepthProgramID, "LayerIndices");
+        layerCountID           = glGetUniformLocation(layeredDepthProgramID, "LayerCount");
+        layeredDepthTimeID     = glGetUniformLocation(layeredDepthProgramID, "Time");
+    });
+
+    // One forward permutation per render bucket and shading model; unlit ignores the model
+    for (int materialClass = 0; materialClass < NUM_MATERIAL_CLASSES; materialClass++) {
+        for (int shadingModel = 0; shadingModel < NUM_SHADING_MODELS; shadingModel++) {
+            if (materialClass == MATERIAL_CLASS_UNLIT && shadingModel != SHADING_PHONG) continue;
+            std::string defines = std::string(VERTEX_FORMAT_DEFINES) + MATERIAL_CLASS_DEFINES[materialClass] + SHADING_MODEL_DEFINES[shadingModel] +
+                                  AttenuationDefines();
+            if (materialClass == MATERIAL_CLASS_GLASS) defines += "#define GLASS_ALPHA " + std::to_string(GLASS_ALPHA) + "\n";
+            GLuint* target = &forwardPrograms[materialClass][shadingModel];
+            CompileProgram("shaders/ShadowMapping.vertexshader", nullptr, "shaders/ShadowMapping.fragmentshader", defines,
+                           [target](GLuint program) { *target = program; BindProgramResources(program); });
+            if (materialClass == MATERIAL_CLASS_GLASS) {
+                GLuint* oitTarget = &oitPrograms[shadingModel];
+                CompileProgram("shaders/ShadowMapping.vertexshader", nullptr, "shaders/ShadowMapping.fragmentshader", defines + "#define WEIGHTED_BLENDED_OIT\n",
+                               [oitTarget](GLuint program) { *oitTarget = program; BindProgramResources(program); });
+            }
+        }
+    }
+
+    // Deferred: geometry pass shares the forward vertex shader, lighting pass a full-screen triangle
+    for (int materialClass : { MATERIAL_CLASS_STANDARD, MATERIAL_CLASS_NORMAL_MAPPED }) {
+        GLuint* target = &gbufferPrograms[materialClass];
+        CompileProgram("shaders/ShadowMapping.vertexshader", nullptr, "shaders/GBuffer.fragmentshader",
+                       std::string(VERTEX_FORMAT_DEFINES) + MATERIAL_CLASS_DEFINES[materialClass], [target](GLuint program) { *target = program; BindProgramResources(program); });
+    }
+
+    CompileProgram("shaders/FullScreen.vertexshader", nullptr, "shaders/DeferredLighting.fragmentshader", AttenuationDefines(),
+                   [this](GLuint program) {
+        deferredLightingProgramID = program;
+        BindProgramResources(deferredLightingProgramID);
+    });
+
+    CompileProgram("shaders/FullScreen.vertexshader", nullptr, "shaders/OITComposite.fragmentshader", "",
+                   [this](GLuint program) {
+        oitCompositeProgramID = program;
+        BindProgramResources(oitCompositeProgramID);
+    });
+    glGenVertexArrays(1, &fullScreenVao);
+
+    lightClusters.Init();
+
+    // The shared uniform blocks; the grid size never changes, the rest is rewritten every frame
+    frameUniforms.ClusterGrid = glm::ivec3(CLUSTER_TILES_X, CLUSTER_TILES_Y, CLUSTER_SLICES);
+    glGenBuffers(1, &frameUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniformBlock), nullptr, GL_STREAM_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, frameUniformBuffer);
+    glGenBuffers(1, &materialUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, materialUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, MAX_MATERIALS * 4 * sizeof(GLint), nullptr, GL_DYNAMIC_DRAW); // Flags change as textures stream in
+    glBindBufferBase(GL_UNIFORM_BUFFER, MATERIAL_TABLE_BINDING, materialUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    // Profiler overlay shaders; a dump keeps the profiler running for the whole session
+    profiler.init();
+    if (options.profileDumpPath && profiler.openDump(options.profileDumpPath)) {
+        printf("Profiling to %s\n", options.profileDumpPath);
+    }
+}
+
+// Starts compiling (or loading from the binary cache) one program; onLinked runs in FinishShaders()
+void ClassroomSimulator::CompileProgram(const char* vertexPath, const char* geometryPath, const char* fragmentPath,
+                                        const std::string& defines, std::function<void(GLuint)> onLinked) {
+    ShaderLoad load;
+    load.pending = beginLoadShaders(vertexPath, geometryPath, fragmentPath, defines.c_str());
+    load.onLinked = std::move(onLinked);
+    shaderLoads.push_back(std::move(load));
+}
+
+void ClassroomSimulator::FinishShaders() {
+    double start = glfwGetTime();
+    int cached = 0;
+    for (ShaderLoad& load : shaderLoads) {
+        load.onLinked(finishLoadShaders(load.pending));
+        if (load.pending.fromCache) cached++;
+    }
+    printf("Shaders: %d programs (%d from the binary cache), waited %.0f ms for the driver\n",
+           (int)shaderLoads.size(), cached, (glfwGetTime() - start) * 1000.0);
+    shaderLoads.clear();
+}
+
+// The permutation that draws one render bucket under the current shading model
+GLuint ClassroomSimulator::ForwardProgram(int materialClass, int shadingModel) const {
+    if (materialClass == MATERIAL_CLASS_UNLIT) shadingModel = SHADING_PHONG;
+    return forwardPrograms[materialClass][shadingModel];
+}
+
+bool ClassroomSimulator::LoadScene() {
+    printf("Loading Assets (This may take a moment)...\n");
+
+    // --- 1. Read the Scene File ---
+    // Straight from its binary cache when that is up to date
+    const char* scenePath = options.sceneFile ? options.sceneFile : DEFAULT_SCENE_FILE;
+    double start = glfwGetTime();
+    SceneData scene;
+    if (!loadSceneCached(scenePath, scene)) {
+        printf("Error: Could not load scene %s\n", scenePath);
+        return false;
+    }
+    printf("Scene: %zu meshes, %zu instances, %zu lights in %zu rooms (%zu portals), read in %.1f ms\n",
+           scene.meshes.size(), scene.instances.size(), scene.lights.size(), scene.rooms.size(), scene.portals.size(),
+           (glfwGetTime() - start) * 1000.0);
+
+    // --- 2. Load Meshes into their Render Buckets ---
+    // A normal map means tangents in the vertex format; the bucket picks the shader
+    std::vector<Mesh*>* buckets[] = { &opaqueMeshes, &normalMapMeshes, &transparentMeshes, &unlitMeshes };
+    sceneMeshes.resize(scene.meshes.size());
+    for (size_t m = 0; m < scene.meshes.size(); m++) {
+        const SceneMesh& desc = scene.meshes[m];
+        Mesh& mesh = sceneMeshes[m];
+        if (!desc.normalPath.empty()) {
+            LoadNormalMapMesh(mesh, desc.objPath.c_str(), desc.diffusePath.c_str(), desc.normalPath.c_str(), desc.specularPath.c_str());
+        } else {
+            LoadStandardMesh(mesh, desc.objPath.c_str(), desc.diffusePath.c_str(), (desc.flags & SCENE_MESH_BUILD_LODS) != 0);
+        }
+        buckets[desc.bucket]->push_back(&mesh);
+    }
+
+    // Everything above is only queued: the files load on worker threads while the scene is composed
+    StartAssetLoads();
+
+    // --- 3. Rooms, Portals & Lights ---
+    rooms.resize(scene.rooms.size());
+    for (size_t r = 0; r < rooms.size(); r++) {
+        rooms[r].name = scene.rooms[r].name;
+        rooms[r].boundsMin = scene.rooms[r].boundsMin;
+        rooms[r].boundsMax = scene.rooms[r].boundsMax;
+    }
+    portals = scene.portals;
+    for (size_t p = 0; p < portals.size(); p++) {
+        rooms[portals[p].rooms[0]].portals.push_back((int)p);
+        rooms[portals[p].rooms[1]].portals.push_back((int)p);
+    }
+    lights.resize(scene.lights.size());
+    for (size_t l = 0; l < lights.size(); l++) {
+        lights[l].position = scene.lights[l].position;
+        lights[l].room = (int)scene.lights[l].room;
+        rooms[lights[l].room].lights.push_back((int)l);
+    }
+    for (int& slot : lightSlots) slot = -1;  // Filled each frame from the rooms the camera sees
+    lightInfluenceRadius = LightInfluenceRadius();
+
+    // --- 4. Scene Composition (Instancing) ---
+    // Each mesh's instances are grouped by room and keep the file's order within one
+    std::vector<size_t> order(scene.instances.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return scene.instances[a].room < scene.instances[b].room; });
+    for (Mesh& mesh : sceneMeshes) mesh.roomStarts.assign(rooms.size() + 1, 0);
+    for (size_t i : order) {
+        const SceneInstance& instance = scene.instances[i];
+        InstanceAnimation animation;
+        animation.axis = instance.axis;
+        animation.angularVelocity = instance.angularVelocity;
+        animation.pivot = instance.pivot;
+        animation.sweep = instance.sweep;
+        Mesh& mesh = sceneMeshes[instance.mesh];
+        mesh.addInstance(instance.model, animation);
+        mesh.roomStarts[instance.room + 1]++;
+    }
+    for (Mesh& mesh : sceneMeshes) {
+        for (size_t r = 0; r < rooms.size(); r++) mesh.roomStarts[r + 1] += mesh.roomStarts[r];
+    }
+
+    // --- 5. Link Shaders, Load Textures into the Material Table ---
+    FinishShaders();
+    FinishAssetLoads();
+    BuildMaterialTable();
+
+    // --- 6. Bake Geometry Arenas ---
+    // All meshes are packed by now; allocate the shared buffers and build the draw commands.
+    BakeGeometryArenas();
+    return true;
 }
 
 void ClassroomSimulator::MainLoop() {
     int shadingMode = 0;
     bool gKeyPressed = false;
-    std::vector<glm::mat4> allDepthBiasMVPs;
-    int lightIdx = 0;
+    bool hKeyPressed = false;
+    bool lKeyPressed = false;
+    bool pKeyPressed = false;
+    bool fKeyPressed = false;
+    bool oKeyPressed = false;
+    bool tKeyPressed = false;
+    double nextTitleTime = 0.0;
+    double nextPrintTime = 0.0;
+    double recordStartTime = glfwGetTime();
+    double nextRecordTime = recordStartTime;
+    GLuint sceneFramebuffer = offscreen.framebuffer; // 0 (the window) unless benchmarking offscreen
+    animationStartTime = glfwGetTime();
 
     printf("Initialization Complete. Starting Loop...\n");
 
     do {
+        profiler.enabled = profilerOverlay || profiler.isDumping() || options.benchmark;
+        profiler.beginFrame();
+
+        // --- Streaming Uploads ---
+        if (!streamer.idle()) {
+            glActiveTexture(GL_TEXTURE0); // Layers are filled through this unit; DrawBatches() rebinds it
+            profiler.beginCpuScope("Streaming");
+            profiler.beginGpuScope("Streaming");
+            streamer.update();
+            profiler.endGpuScope();
+            profiler.endCpuScope();
+        }
+        if (materialTableDirty) UploadMaterialTable();
+
         // --- Input Handling ---
         if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS) {
             if (!gKeyPressed) {
@@ -466,127 +1915,443 @@ void ClassroomSimulator::MainLoop() {
             }
         } else { gKeyPressed = false; }
 
-        // ============================================================
-        // PASS 1: SHADOW MAPPING (Depth Generation)
-        // ============================================================
-        // Renders the scene from the perspective of each light source.
-        
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glEnable(GL_CULL_FACE);
-        glCullFace(GL_BACK); 
-        glUseProgram(depthProgramID);
-        allDepthBiasMVPs.clear();
+        if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS) {
+            if (!hKeyPressed) {
+                ApplyShadowQuality((shadowQuality + 1) % NUM_SHADOW_QUALITY_PRESETS);
+                hKeyPressed = true;
+            }
+        } else { hKeyPressed = false; }
 
-        lightIdx = 0;
-        for (int i = 0; i < 3; i++) {
-            for (int j = 0; j < 3; j++) {
-                // Target the specific layer in the Texture Array
-                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTextureArray, 0, lightIdx);
-                glClear(GL_DEPTH_BUFFER_BIT);
+        if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS) {
+            if (!lKeyPressed) {
+                layeredShadows = !layeredShadows;
+                lKeyPressed = true;
+                printf("Shadow Pass: %s\n", layeredShadows ? "Layered" : "Per-Layer");
+            }
+        } else { lKeyPressed = false; }
+
+        if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) {
+            if (!pKeyPressed) {
+                overdrawMode = (overdrawMode + 1) % NUM_OVERDRAW_MODES;
+                pKeyPressed = true;
+                printf("Overdraw Reduction: %s\n", OVERDRAW_MODE_NAMES[overdrawMode]);
+            }
+        } else { pKeyPressed = false; }
+
+        if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS) {
+            if (!fKeyPressed) {
+                deferredShading = !deferredShading;
+                fKeyPressed = true;
+                printf("Renderer: %s\n", deferredShading ? "Deferred (Phong)" : "Forward");
+            }
+        } else { fKeyPressed = false; }
+
+        if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS) {
+            if (!oKeyPressed) {
+                profilerOverlay = !profilerOverlay;
+                oKeyPressed = true;
+                printf("Profiler Overlay: %s\n", profilerOverlay ? "On" : "Off");
+                if (!profilerOverlay && !profiler.isDumping()) glfwSetWindowTitle(window, WINDOW_TITLE);
+            }
+        } else { oKeyPressed = false; }
 
-                // Compute Light View/Projection
-                glm::vec3 lightPos = classroomLightPositions_worldspace[lightIdx];
-                glm::mat4 depthView = glm::lookAt(lightPos, lightPos + glm::vec3(0, -1, 0), glm::vec3(0, 0, -1));
-                glm::mat4 depthProj = glm::perspective(glm::radians(120.0f), 1.5f, 5.0f, 1000.0f);
-                
-                // Draw Shadow Casters
-                for (Mesh* mesh : opaqueMeshes) DrawMeshShadow(*mesh, depthMatrixID, depthProj, depthView);
-                for (Mesh* mesh : normalMapMeshes) DrawMeshShadow(*mesh, depthMatrixID, depthProj, depthView);
-                
-                // Calculate Depth Bias Matrix to map [-1,1] to [0,1]
-                glm::mat4 biasMatrix(0.5, 0.0, 0.0, 0.0, 0.0, 0.5, 0.0, 0.0, 0.0, 0.0, 0.5, 0.0, 0.5, 0.5, 0.5, 1.0);
-                allDepthBiasMVPs.push_back(biasMatrix * depthProj * depthView);
-                lightIdx++;
+        if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS) {
+            if (!tKeyPressed) {
+                transparencyMode = (transparencyMode + 1) % NUM_TRANSPARENCY_MODES;
+                tKeyPressed = true;
+                printf("Transparency: %s\n", TRANSPARENCY_MODE_NAMES[transparencyMode]);
             }
+        } else { tKeyPressed = false; }
+
+        // Update Camera Matrices (View/Projection) first: the rooms it sees decide which lights get shadow layers
+        int w = offscreen.width, h = offscreen.height;
+        if (!sceneFramebuffer) glfwGetFramebufferSize(window, &w, &h);
+        profiler.beginCpuScope("Input & Camera");
+        if (options.benchmark) {
+            CameraKeyframe pose = sampleCameraPath(benchmark.path, (float)(benchmark.frame * BENCHMARK_TIMESTEP));
+            setCameraPose(pose.position, pose.horizontalAngle, pose.verticalAngle, (float)w / (float)h);
+        } else {
+            computeMatricesFromInputs();
         }
+        if (options.recordPathFile && glfwGetTime() >= nextRecordTime) {
+            CameraKeyframe pose;
+            pose.time = (float)(glfwGetTime() - recordStartTime);
+            getCameraPose(pose.position, pose.horizontalAngle, pose.verticalAngle);
+            recordedPath.push_back(pose);
+            nextRecordTime += CAMERA_RECORD_INTERVAL;
+        }
+        glm::mat4 ProjectionMatrix = getProjectionMatrix();
+        glm::mat4 ViewMatrix = getViewMatrix();
+        glm::mat4 ViewProjectionMatrix = ProjectionMatrix * ViewMatrix;
+        glm::vec3 eye = glm::vec3(glm::inverse(ViewMatrix)[3]);
+        UpdateVisibleRooms(ViewProjectionMatrix, eye);
+        profiler.endCpuScope();
+
+        UpdateAnimation();
+
+        // ============================================================
+        // PASS 1: SHADOW MAPPING (Depth Generation)
+        // ============================================================
+        // Renders the scene from the perspective of each light source.
+        // Layers are cached, so this is only real work for lights whose casters changed.
+        profiler.beginCpuScope("Shadow Pass");
+        RenderShadowMaps();
+        profiler.endCpuScope();
 
         // ============================================================
         // PASS 2: MAIN RENDERING (Lighting)
         // ============================================================
         
-        int w, h;
-        glfwGetFramebufferSize(window, &w, &h);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0); // Render to Screen
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer); // Render to Screen
         glViewport(0, 0, w, h);
         glEnable(GL_CULL_FACE);
         glCullFace(GL_BACK);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glUseProgram(programID);
-        glUniform1i(ShadingModelID, shadingMode);
 
-        // Update Camera Matrices (View/Projection)
-        computeMatricesFromInputs();
-        glm::mat4 ProjectionMatrix = getProjectionMatrix();
-        glm::mat4 ViewMatrix = getViewMatrix();
+        // Pass Light Data to Shader (light table and per-cluster light lists)
+        profiler.beginCpuScope("Matrix Prep");
+        AssignLightClusters(ViewMatrix, ProjectionMatrix, w, h);
+        lightClusters.Upload();
+
+        // One upload of the FrameUniforms block serves every lighting program drawn this frame
+        frameUniforms.V = ViewMatrix;
+        frameUniforms.VP = ViewProjectionMatrix;
+        frameUniforms.InvView = glm::inverse(ViewMatrix);
+        frameUniforms.InvProjection = glm::inverse(ProjectionMatrix);
+        frameUniforms.LightCount = lightClusters.lightCount;
+        frameUniforms.ClusterTileScale = lightClusters.tileScale;
+        frameUniforms.ClusterDepthParams = lightClusters.depthParams;
+        frameUniforms.ShadowDepthBias = shadowSettings.reverseZ ? -SHADOW_DEPTH_BIAS : SHADOW_DEPTH_BIAS;
+        glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniformBlock), &frameUniforms, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        profiler.endCpuScope();
+
+        // Cull every bucket against the camera, then draw only what is left
+        profiler.beginCpuScope("Culling & Commands");
+        bool frontToBack = overdrawMode == OVERDRAW_FRONT_TO_BACK;
+        BeginCullPass(Frustum::FromMatrix(ViewProjectionMatrix), LodSelection::ForCamera(ViewMatrix, ProjectionMatrix, h), cameraRooms);
+        EmitVisibleCommands(opaqueBatches, 1, frontToBack);
+        EmitVisibleCommands(normalMapBatches, 1, frontToBack);
+        EmitVisibleCommands(unlitBatches);
+        bool sortedTransparency = transparencyMode == TRANSPARENCY_SORTED;
+        EmitVisibleCommands(transparentBatches, 1, sortedTransparency);
+        if (frontToBack) {
+            SortFrontToBack(opaqueBatches, eye);
+            SortFrontToBack(normalMapBatches, eye);
+        }
+        if (sortedTransparency) SortBackToFront(transparentBatches, ViewMatrix);
+        UploadCommands();
+        profiler.endCpuScope();
+
+        // Deferred: opaque geometry goes to the G-Buffer instead of the screen
+        profiler.beginCpuScope("Main Submission");
+        bool deferred = deferredShading && gbuffer.Resize(w, h);
+        GLuint standardProgram = deferred ? gbufferPrograms[MATERIAL_CLASS_STANDARD] : ForwardProgram(MATERIAL_CLASS_STANDARD, shadingMode);
+        GLuint normalMappedProgram = deferred ? gbufferPrograms[MATERIAL_CLASS_NORMAL_MAPPED] : ForwardProgram(MATERIAL_CLASS_NORMAL_MAPPED, shadingMode);
+        if (deferred) {
+            glBindFramebuffer(GL_FRAMEBUFFER, gbuffer.framebuffer);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            profiler.countStateChange();
+        }
 
-        // Pass Light Data to Shader
-        glm::vec3 lightPosCameraSpace[NUM_LIGHTS];
-        for (int i = 0; i < NUM_LIGHTS; i++) {
-            lightPosCameraSpace[i] = glm::vec3(ViewMatrix * glm::vec4(classroomLightPositions_worldspace[i], 1.0));
+        if (overdrawMode == OVERDRAW_DEPTH_PREPASS) {
+            // Depth only, through the shadow pass's program and position-only VAOs (same commands)
+            profiler.beginGpuScope("Depth Pre-Pass");
+            glUseProgram(depthProgramID);
+            profiler.countStateChange();
+            glUniformMatrix4fv(depthViewProjectionID, 1, GL_FALSE, &ViewProjectionMatrix[0][0]);
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            DrawDepthBatches(opaqueBatches);
+            DrawDepthBatches(normalMapBatches);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+            // Only the front-most surface of each pixel passes now, so each is shaded once
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+            profiler.endGpuScope();
         }
-        glUniform3fv(ClassroomLightPositionsID, NUM_LIGHTS, &lightPosCameraSpace[0][0]);
-        glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
-        glUniformMatrix4fv(DepthBiasMatricesID, NUM_LIGHTS, GL_FALSE, &allDepthBiasMVPs[0][0][0]);
 
-        // Bind Shadow Maps
+        // Bind Shadow Maps & Light Clusters
         glActiveTexture(GL_TEXTURE1);
         glBindTexture(GL_TEXTURE_2D_ARRAY, depthTextureArray);
-        glUniform1i(ShadowMapArrayID, 1);
-        glUniform1i(uniforms.UnlitID, 0);
+        lightClusters.Bind();
+        profiler.countStateChange(4);
 
         // 1. Draw Opaque
-        for (Mesh* mesh : opaqueMeshes) DrawMesh(*mesh, uniforms, ViewMatrix, ProjectionMatrix);
+        profiler.beginGpuScope(deferred ? "Opaque (G-Buffer)" : "Opaque");
+        glUseProgram(standardProgram);
+        profiler.countStateChange();
+        DrawBatches(opaqueBatches);
+        profiler.endGpuScope();
         
         // 2. Draw Normal Mapped
-        for (Mesh* mesh : normalMapMeshes) DrawMesh(*mesh, uniforms, ViewMatrix, ProjectionMatrix);
+        profiler.beginGpuScope(deferred ? "Normal Mapped (G-Buffer)" : "Normal Mapped");
+        glUseProgram(normalMappedProgram);
+        profiler.countStateChange();
+        DrawBatches(normalMapBatches);
+        profiler.endGpuScope();
+        if (overdrawMode == OVERDRAW_DEPTH_PREPASS) {
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+        }
 
-        // 3. Draw Unlit (Light Panels)
-        glUniform1i(uniforms.UnlitID, 1);
-        DrawMesh(lightPanel, uniforms, ViewMatrix, ProjectionMatrix);
-        glUniform1i(uniforms.UnlitID, 0);
+        if (deferred) {
+            // Light every G-Buffer pixel at once; it also writes the scene depth for the forward passes below
+            profiler.beginGpuScope("Deferred Lighting");
+            glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+            glUseProgram(deferredLightingProgramID);
+            gbuffer.BindTextures();
+
+            glDepthFunc(GL_ALWAYS);
+            glBindVertexArray(fullScreenVao);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            glDepthFunc(GL_LESS);
+            profiler.countDraw(1, 1, 1);
+            profiler.countStateChange(7); // Framebuffer, program, VAO and the four G-Buffer textures
+            profiler.endGpuScope();
+        }
 
-        // 4. Draw Transparent (Sorted Last)
+        // 3. Draw Unlit (Light Panels)
+        profiler.beginGpuScope("Unlit");
+        glUseProgram(ForwardProgram(MATERIAL_CLASS_UNLIT, shadingMode));
+        profiler.countStateChange();
+        DrawBatches(unlitBatches);
+        profiler.endGpuScope();
+
+        // 4. Draw Transparent (Last)
+        GLenum sceneDepthFormat = sceneFramebuffer ? GL_DEPTH_COMPONENT24 : windowDepthFormat; // See OffscreenTarget
+        bool weightedOIT = !sortedTransparency && oit.Resize(w, h, sceneDepthFormat);
+        profiler.beginGpuScope(weightedOIT ? "Transparent (OIT)" : "Transparent");
         glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
         glDepthMask(GL_FALSE); // Read-only depth buffer
-        
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, glass.textureID);
-        glUniform1i(uniforms.SmudgeSamplerID, 3);
-        glUniform1i(uniforms.bIsGlassID, 1);
-
-        for (Mesh* mesh : transparentMeshes) DrawMesh(*mesh, uniforms, ViewMatrix, ProjectionMatrix, 0.25f);
+        if (weightedOIT) {
+            // Accumulate against a copy of the scene depth, so opaque surfaces still hide the panes behind them
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFramebuffer);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, oit.framebuffer);
+            glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, oit.framebuffer);
+            const GLfloat clearAccumulation[4] = { 0.0f, 0.0f, 0.0f, 1.0f }; // Revealage starts at 1
+            const GLfloat clearWeight[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            glClearBufferfv(GL_COLOR, 0, clearAccumulation);
+            glClearBufferfv(GL_COLOR, 1, clearWeight);
+
+            // One blend function for both targets (GL 3.3 has no per-target blending): colours and
+            // weights add up, the accumulation's alpha multiplies by (1 - alpha)
+            glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+            glUseProgram(oitPrograms[shadingMode]);
+            profiler.countStateChange(4);
+            DrawBatches(transparentBatches);
+
+            // Resolve: average colour over the scene, which shows through by the revealage
+            glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+            glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+            glUseProgram(oitCompositeProgramID);
+            oit.BindTextures();
+            glDepthFunc(GL_ALWAYS);
+            glBindVertexArray(fullScreenVao);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            glDepthFunc(GL_LESS);
+            profiler.countDraw(1, 1, 1);
+            profiler.countStateChange(5); // Framebuffer, program, VAO and the two accumulation textures
+        } else {
+            // The smudge mask is the glass material's own diffuse layer
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            glUseProgram(ForwardProgram(MATERIAL_CLASS_GLASS, shadingMode));
+            profiler.countStateChange();
+            DrawBatches(transparentBatches);
+        }
 
         // Reset State
-        glUniform1i(uniforms.bIsGlassID, 0);
         glDepthMask(GL_TRUE);
         glDisable(GL_BLEND);
+        profiler.endGpuScope();
+        profiler.endCpuScope();
+
+        // Capture before the overlay; the benchmark's path only starts once streaming is done, and so do its frames
+        if (capture.active() && (!options.benchmark || streamer.idle())) {
+            profiler.beginCpuScope("Capture");
+            capture.update();
+            capture.capture(sceneFramebuffer, w, h);
+            profiler.endCpuScope();
+        }
+
+        // Results are a few frames old: the profiler never waits on the GPU
+        if (profilerOverlay) profiler.drawOverlay(w, h);
 
+        // CPU only: the present is no GL work a GPU timer query could bracket
+        profiler.beginCpuScope("Swap");
         glfwSwapBuffers(window);
+        profiler.endCpuScope();
+        profiler.endFrame();
+        if (options.benchmark) AdvanceBenchmark();
+        else if (profiler.enabled) UpdateProfilerReport(nextTitleTime, nextPrintTime);
         glfwPollEvents();
 
     } while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS && glfwWindowShouldClose(window) == 0);
+
+    if (capture.active()) {
+        capture.finish();
+        printf("Capture: %u frames read back for %s (waited %u times on the GPU, %u on the writer)\n",
+               capture.framesCaptured, options.capturePath, capture.readbackWaits, capture.writerWaits);
+    }
+    if (options.benchmark) WriteBenchmarkReport();
+    if (options.recordPathFile && saveCameraPath(options.recordPathFile, recordedPath)) {
+        printf("Camera path saved to %s (%zu keyframes)\n", options.recordPathFile, recordedPath.size());
+    }
 }
 
-void ClassroomSimulator::Cleanup() {
-    // Release Meshes
-    // We iterate a temporary combined list to ensure we don't miss anything.
-    std::vector<Mesh*> allMeshes = opaqueMeshes;
-    allMeshes.insert(allMeshes.end(), normalMapMeshes.begin(), normalMapMeshes.end());
-    allMeshes.insert(allMeshes.end(), transparentMeshes.begin(), transparentMeshes.end());
-    allMeshes.push_back(&lightPanel);
+bool ClassroomSimulator::InitBenchmark()
+{
+    if (options.cameraPathFile) {
+        if (!loadCameraPath(options.cameraPathFile, benchmark.path)) return false;
+    } else {
+        benchmark.path.assign(std::begin(BENCHMARK_DEFAULT_PATH), std::end(BENCHMARK_DEFAULT_PATH));
+    }
+    if (options.renderWidth > 0 && !offscreen.Init(options.renderWidth, options.renderHeight)) return false;
+
+    // Settings under test, normally cycled from the keyboard
+    if (options.shadowQuality != shadowQuality) ApplyShadowQuality(options.shadowQuality);
+    overdrawMode = options.overdrawMode;
+    deferredShading = options.deferred;
+    transparencyMode = options.transparencyMode;
+    profiler.recordTo = &benchmark.profiles;
+
+    printf("Benchmark: %d frames (+%d warm-up), %zu camera keyframes, %s\n",
+           options.benchmarkFrames, BENCHMARK_WARMUP_FRAMES, benchmark.path.size(), offscreen.framebuffer ? "offscreen" : "window");
+    benchmark.lastSwapTime = glfwGetTime();
+    return true;
+}
+
+// Called after each swap: records the frame time and ends the run after the last measured frame
+void ClassroomSimulator::AdvanceBenchmark()
+{
+    double now = glfwGetTime();
+    if (!streamer.idle()) { benchmark.lastSwapTime = now; return; } // The path starts once everything is resident
+    if (benchmark.frame >= BENCHMARK_WARMUP_FRAMES) {
+        benchmark.frameTimes.push_back((now - benchmark.lastSwapTime) * 1000.0);
+        benchmark.measuredProfiles.push_back(profiler.frameNumber());
+    }
+    benchmark.lastSwapTime = now;
+    benchmark.frame++;
+    if (benchmark.frame >= BENCHMARK_WARMUP_FRAMES + options.benchmarkFrames) glfwSetWindowShouldClose(window, GLFW_TRUE);
+}
 
-    for(Mesh* m : allMeshes) {
-        if (m) m->Dispose();
+/**
+ * @brief Writes the run's frame time and per-pass GPU time statistics as JSON to --output (BENCHMARK_DEFAULT_OUTPUT).
+ */
+void ClassroomSimulator::WriteBenchmarkReport()
+{
+    // The last frames' GPU timings are still in flight
+    profiler.flush();
+
+    // GPU statistics cover the frames the frame times do: not the warm-up, nor the frames spent streaming
+    std::vector<double> gpuTimes;
+    std::map<std::string, std::vector<double>> passTimes;
+    const std::vector<unsigned long long>& measured = benchmark.measuredProfiles;
+    for (const ProfileFrame& frame : benchmark.profiles) {
+        if (!std::binary_search(measured.begin(), measured.end(), frame.frame) || frame.gpuMs < 0.0) continue;
+        gpuTimes.push_back(frame.gpuMs);
+        for (const ProfileScope& scope : frame.gpu) passTimes[scope.name].push_back(scope.ms);
     }
+    TimingStats frameStats = TimingStats::From(benchmark.frameTimes);
+    TimingStats gpuStats = TimingStats::From(gpuTimes);
+
+    FILE* out = fopen(options.benchmarkOutput, "w");
+    if (!out) {
+        printf("Impossible to write benchmark report %s\n", options.benchmarkOutput);
+        return;
+    }
+    int w = offscreen.width, h = offscreen.height;
+    if (!offscreen.framebuffer) glfwGetFramebufferSize(window, &w, &h);
+    fprintf(out, "{\n  \"renderer\": \"%s\",\n  \"glVersion\": \"%s\",\n",
+            (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
+    fprintf(out, "  \"resolution\": [%d, %d],\n  \"offscreen\": %s,\n", w, h, offscreen.framebuffer ? "true" : "false");
+    fprintf(out, "  \"frames\": %d,\n  \"warmupFrames\": %d,\n  \"timestep\": %.6f,\n  \"cameraPath\": \"%s\",\n",
+            options.benchmarkFrames, BENCHMARK_WARMUP_FRAMES, BENCHMARK_TIMESTEP, options.cameraPathFile ? options.cameraPathFile : "default");
+    fprintf(out, "  \"scene\": \"%s\",\n", options.sceneFile ? options.sceneFile : DEFAULT_SCENE_FILE);
+    if (options.capturePath) {
+        fprintf(out, "  \"capture\": {\"frames\": %u, \"readbackWaits\": %u, \"writerWaits\": %u},\n",
+                capture.framesCaptured, capture.readbackWaits, capture.writerWaits);
+    }
+    fprintf(out, "  \"settings\": {\"shadowQuality\": \"%s\", \"layeredShadows\": %s, \"overdraw\": \"%s\", \"deferred\": %s, \"transparency\": \"%s\", \"multiDrawIndirect\": %s},\n",
+            SHADOW_QUALITY_PRESETS[shadowQuality].name, layeredShadows ? "true" : "false", OVERDRAW_MODE_NAMES[overdrawMode],
+            deferredShading ? "true" : "false", TRANSPARENCY_MODE_NAMES[transparencyMode], useMultiDrawIndirect ? "true" : "false");
+    fprintf(out, "  \"frameTimeMs\": ");
+    frameStats.WriteJson(out);
+    fprintf(out, ",\n  \"gpuTimeMs\": ");
+    gpuStats.WriteJson(out);
+    fprintf(out, ",\n  \"passes\": {");
+    bool first = true;
+    for (const auto& pass : passTimes) {
+        fprintf(out, "%s\n    \"%s\": ", first ? "" : ",", pass.first.c_str());
+        TimingStats::From(pass.second).WriteJson(out);
+        first = false;
+    }
+    fprintf(out, "\n  }\n}\n");
+    fclose(out);
+
+    printf("Benchmark: frame avg %.2f ms, p95 %.2f ms, p99 %.2f ms; GPU avg %.2f ms (report in %s)\n",
+           frameStats.avg, frameStats.p95, frameStats.p99, gpuStats.avg, options.benchmarkOutput);
+}
+
+/**
+ * @brief Shows the latest profiled frame in the window title, plus a console breakdown while the overlay is up.
+ */
+void ClassroomSimulator::UpdateProfilerReport(double& nextTitleTime, double& nextPrintTime)
+{
+    if (!profiler.hasResults()) return;
+    double now = glfwGetTime();
+    if (now >= nextTitleTime) {
+        const ProfileFrame& frame = profiler.latest();
+        char title[256];
+        snprintf(title, sizeof(title), "%s | CPU %.2f ms | GPU %.2f ms | %u draws | %.2fM tris | %u state changes",
+                 WINDOW_TITLE, frame.cpuMs, frame.gpuMs, frame.counters.drawCalls,
+                 frame.counters.triangles / 1.0e6, frame.counters.stateChanges);
+        glfwSetWindowTitle(window, title);
+        nextTitleTime = now + PROFILER_TITLE_INTERVAL;
+    }
+    if (profilerOverlay && now >= nextPrintTime) {
+        profiler.printSummary(); // Legend for the overlay's bar colours
+        nextPrintTime = now + PROFILER_PRINT_INTERVAL;
+    }
+}
+
+void ClassroomSimulator::Cleanup() {
+    // Release Geometry & Textures (meshes only hold offsets into these)
+    for (GeometryArena& arena : arenas) arena.Dispose();
+    streamer.cleanup();
+    for (auto& entry : loadedTextures) {
+        freeDDSImage(entry.second.dds);
+        delete [] entry.second.bmp;
+    }
+    lightClusters.Dispose();
+    gbuffer.Dispose();
+    oit.Dispose();
+    capture.cleanup();
+    offscreen.Dispose();
+    if (fullScreenVao) glDeleteVertexArrays(1, &fullScreenVao);
+    if (!textureArrays.empty()) glDeleteTextures((GLsizei)textureArrays.size(), textureArrays.data());
+    if (indirectBuffer) glDeleteBuffers(1, &indirectBuffer);
 
     // Release GL Objects
     if (FramebufferName) glDeleteFramebuffers(1, &FramebufferName);
     if (depthTextureArray) glDeleteTextures(1, &depthTextureArray);
-    if (VertexArrayID) glDeleteVertexArrays(1, &VertexArrayID);
-    if (programID) glDeleteProgram(programID);
+    if (staticFramebuffer) glDeleteFramebuffers(1, &staticFramebuffer);
+    if (staticDepthTextureArray) glDeleteTextures(1, &staticDepthTextureArray);
+    for (auto& programs : forwardPrograms) {
+        for (GLuint program : programs) if (program) glDeleteProgram(program);
+    }
     if (depthProgramID) glDeleteProgram(depthProgramID);
+    if (layeredDepthProgramID) glDeleteProgram(layeredDepthProgramID);
+    for (GLuint program : gbufferPrograms) if (program) glDeleteProgram(program);
+    if (frameUniformBuffer) glDeleteBuffers(1, &frameUniformBuffer);
+    if (materialUniformBuffer) glDeleteBuffers(1, &materialUniformBuffer);
+    if (deferredLightingProgramID) glDeleteProgram(deferredLightingProgramID);
+    if (oitCompositeProgramID) glDeleteProgram(oitCompositeProgramID);
+    for (GLuint program : oitPrograms) if (program) glDeleteProgram(program);
+    profiler.cleanup();
     
     glfwTerminate();
     printf("Shutdown Complete.\n");
@@ -596,162 +2361,1180 @@ void ClassroomSimulator::Cleanup() {
 // HELPERS
 // =================================================================
 
-void ClassroomSimulator::AddObject(Mesh& mesh, glm::vec3 pos, float rotDeg, glm::vec3 rotAxis, glm::vec3 scale) 
+void ClassroomSimulator::InvalidateShadowCaster(const Mesh& mesh)
 {
-    glm::mat4 model = glm::mat4(1.0f);
-    model = glm::translate(model, pos);
-    if (rotDeg != 0.0f) model = glm::rotate(model, glm::radians(rotDeg), rotAxis);
-    if (scale != glm::vec3(1.0f)) model = glm::scale(model, scale);
-    mesh.addInstance(model);
+    // Only layers whose light frustum actually sees the caster need re-rendering
+    for (int i = 0; i < NUM_LIGHTS; i++) {
+        if (lightSlots[i] >= 0 && !shadowLayerDirty[i] && Frustum::FromMatrix(lightViewProjections[i]).IntersectsMesh(mesh)) {
+            shadowLayerDirty[i] = true;
+        }
+    }
 }
 
-Mesh ClassroomSimulator::LoadStandardMesh(const char* objPath, const char* ddsPath) {
-    Mesh mesh;
-    mesh.textureID = loadDDS(ddsPath);
-    
-    std::vector<glm::vec3> vertices;
-    std::vector<glm::vec2> uvs;
-    std::vector<glm::vec3> normals;
-    loadOBJ(objPath, vertices, uvs, normals);
+// Sets this frame's Time in every program that animates instances, and publishes CPU instance updates.
+// Runs before the shadow pass, so the cached layers, the composite and the camera all see the same pose.
+void ClassroomSimulator::UpdateAnimation()
+{
+    // Benchmarks step the clock with the camera path, so every run draws the same frames
+    double seconds = options.benchmark ? benchmark.frame * BENCHMARK_TIMESTEP : glfwGetTime() - animationStartTime;
+    float time = (float)seconds;
+    frameUniforms.Time = time;
+    glUseProgram(depthProgramID);
+    glUniform1f(depthTimeID, time);
+    glUseProgram(layeredDepthProgramID);
+    glUniform1f(layeredDepthTimeID, time);
+    profiler.countStateChange(2);
+
+    for (GeometryArena& arena : arenas) {
+        if (!arena.IsEmpty()) arena.FlushInstances();
+    }
+}
+
+int ClassroomSimulator::RoomAt(const glm::vec3& position) const
+{
+    for (size_t r = 0; r < rooms.size(); r++) {
+        if (rooms[r].Contains(position)) return (int)r;
+    }
+    return -1;
+}
 
-    std::vector<unsigned short> indices;
-    std::vector<glm::vec3> i_vertices, i_normals;
-    std::vector<glm::vec2> i_uvs;
-    indexVBO(vertices, uvs, normals, indices, i_vertices, i_uvs, i_normals);
+// Screen rectangle (NDC min x, min y, max x, max y) covered by a portal's box; false when it is all behind the eye.
+// A box around the eye, or one crossing the eye plane, covers the whole screen.
+static bool PortalRect(const ScenePortal& portal, const glm::mat4& viewProjection, const glm::vec3& eye, glm::vec4& rect)
+{
+    rect = glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f);
+    if (eye.x >= portal.boundsMin.x && eye.y >= portal.boundsMin.y && eye.z >= portal.boundsMin.z &&
+        eye.x <= portal.boundsMax.x && eye.y <= portal.boundsMax.y && eye.z <= portal.boundsMax.z) return true;
 
-    mesh.indexCount = indices.size();
-    mesh.hasNormalMap = false;
+    glm::vec2 ndcMin(FLT_MAX), ndcMax(-FLT_MAX);
+    int behind = 0;
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner((i & 1) ? portal.boundsMax.x : portal.boundsMin.x,
+                         (i & 2) ? portal.boundsMax.y : portal.boundsMin.y,
+                         (i & 4) ? portal.boundsMax.z : portal.boundsMin.z);
+        glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+        if (clip.w <= 1e-4f) { behind++; continue; }
+        glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+        ndcMin = glm::min(ndcMin, ndc);
+        ndcMax = glm::max(ndcMax, ndc);
+    }
+    if (behind == 8) return false;
+    if (behind == 0) rect = glm::vec4(ndcMin.x, ndcMin.y, ndcMax.x, ndcMax.y);
+    return true;
+}
+
+// Walks the portals from the camera's room, narrowing the screen rectangle at each one.
+// Outside every room there is nothing to start from, so every room counts as seen.
+void ClassroomSimulator::UpdateVisibleRooms(const glm::mat4& viewProjection, const glm::vec3& eye)
+{
+    int room = RoomAt(eye);
+
+    cameraRooms.assign(rooms.size(), room >= 0 ? 0 : 1);
+    if (room >= 0) MarkVisibleRooms(room, -1, glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f), 0, viewProjection, eye);
+    AssignLightSlots(eye);
+}
+
+// screenRect is what is still visible of the room (NDC); throughPortal the portal it was entered by, -1 at the start
+void ClassroomSimulator::MarkVisibleRooms(int room, int throughPortal, const glm::vec4& screenRect, int depth,
+                                          const glm::mat4& viewProjection, const glm::vec3& eye)
+{
+    cameraRooms[room] = 1;
+    if (depth == MAX_PORTAL_DEPTH) return;
+
+    for (int p : rooms[room].portals) {
+        if (p == throughPortal) continue;
+        glm::vec4 rect;
+        if (!PortalRect(portals[p], viewProjection, eye, rect)) continue;
+        rect = glm::vec4(std::max(rect.x, screenRect.x), std::max(rect.y, screenRect.y),
+                         std::min(rect.z, screenRect.z), std::min(rect.w, screenRect.w));
+        if (rect.x >= rect.z || rect.y >= rect.w) continue;  // Hidden by the portals on the way
+        int next = (int)portals[p].rooms[portals[p].rooms[0] == (unsigned int)room ? 1 : 0];
+        MarkVisibleRooms(next, p, rect, depth + 1, viewProjection, eye);
+    }
+}
+
+/**
+ * @brief Lists every light of the rooms the camera sees (shadedLights) and gives the NUM_LIGHTS slots
+ * (shadow layers) to the nearest of them; the others are shaded inside their own room only.
+ * @details A light keeps its slot, and so its cached layer, while it stays wanted. A light moving into a
+ * slot has another position than the layer was rendered from, which makes RenderShadowMaps() redraw it.
+ */
+void ClassroomSimulator::AssignLightSlots(const glm::vec3& eye)
+{
+    std::vector<std::pair<float, int>> wanted;
+    for (size_t r = 0; r < rooms.size(); r++) {
+        if (!cameraRooms[r]) continue;
+        for (int l : rooms[r].lights) {
+            glm::vec3 d = lights[l].position - eye;
+            wanted.push_back({ glm::dot(d, d), l });
+        }
+    }
+    std::stable_sort(wanted.begin(), wanted.end(), [](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+        return a.first < b.first;
+    });
+    if (wanted.size() > (size_t)MAX_SCENE_LIGHTS) wanted.resize(MAX_SCENE_LIGHTS);
+    shadedLights.clear();
+    for (const std::pair<float, int>& w : wanted) shadedLights.push_back(w.second);
+    if (wanted.size() > (size_t)NUM_LIGHTS) wanted.resize(NUM_LIGHTS);
+
+    // Free the slots of the lights no longer wanted, then fill them in order
+    std::vector<unsigned char> placed(lights.size(), 0);
+    for (int slot = 0; slot < NUM_LIGHTS; slot++) {
+        if (lightSlots[slot] < 0) continue;
+        bool keep = std::find_if(wanted.begin(), wanted.end(), [&](const std::pair<float, int>& w) { return w.second == lightSlots[slot]; }) != wanted.end();
+        if (keep) {
+            placed[lightSlots[slot]] = 1;
+        } else {
+            lightSlots[slot] = -1;
+            shadowLayerDirty[slot] = true;  // Its casters are no longer tracked
+        }
+    }
+    int slot = 0;
+    for (const std::pair<float, int>& w : wanted) {
+        if (placed[w.second]) continue;
+        while (lightSlots[slot] >= 0) slot++;
+        lightSlots[slot] = w.second;
+        classroomLightPositions_worldspace[slot] = lights[w.second].position;
+    }
+}
+
+void ClassroomSimulator::RenderShadowMaps()
+{
+    const ShadowSettings& settings = shadowSettings;
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK); 
+
+    if (settings.reverseZ) {
+        // Keep clip z in [0,1] so the float buffer's precision near 0 serves the far distances
+        glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+        glClearDepth(0.0);
+        glDepthFunc(GL_GREATER);
+    }
+
+    // Work out which layers need what, before anything is drawn
+    bool refreshStatic[NUM_LIGHTS];
+    bool recomposite[NUM_LIGHTS];
+    Frustum lightFrusta[NUM_LIGHTS];
+    for (int lightIdx = 0; lightIdx < NUM_LIGHTS; lightIdx++) {
+        refreshStatic[lightIdx] = recomposite[lightIdx] = false;
+        if (lightSlots[lightIdx] < 0) continue; // Empty slot: nothing samples the layer
+
+        // A moved light (or a new one in the slot) invalidates its own layer
+        glm::vec3 lightPos = classroomLightPositions_worldspace[lightIdx];
+        if (lightPos != shadowLightPositions[lightIdx]) {
+            shadowLightPositions[lightIdx] = lightPos;
+            shadowLayerDirty[lightIdx] = true;
+        }
+
+        refreshStatic[lightIdx] = shadowLayerDirty[lightIdx];
+        if (refreshStatic[lightIdx]) {
+            // Compute Light View/Projection
+            glm::mat4 depthView = glm::lookAt(lightPos, lightPos + glm::vec3(0, -1, 0), glm::vec3(0, 0, -1));
+            glm::mat4 depthProj = ComputeLightProjection(depthView, lights[lightSlots[lightIdx]]);
+            lightViewProjections[lightIdx] = depthProj * depthView;
+
+            // Depth Bias Matrix: clip space to [0,1] texture coordinates.
+            // z goes from [-1,1] to [0,1], except with reverse-Z where it already is [0,1].
+            float zScale = settings.reverseZ ? 1.0f : 0.5f;
+            float zOffset = settings.reverseZ ? 0.0f : 0.5f;
+            const glm::mat4 biasMatrix(0.5f, 0.0f, 0.0f, 0.0f,
+                                       0.0f, 0.5f, 0.0f, 0.0f,
+                                       0.0f, 0.0f, zScale, 0.0f,
+                                       0.5f, 0.5f, zOffset, 1.0f);
+            depthBiasMVPs[lightIdx] = biasMatrix * lightViewProjections[lightIdx];
+        }
 
-    glGenBuffers(1, &mesh.vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, i_vertices.size() * sizeof(glm::vec3), &i_vertices[0], GL_STATIC_DRAW);
+        // The composite must also be redone once after a dynamic caster leaves the frustum
+        lightFrusta[lightIdx] = Frustum::FromMatrix(lightViewProjections[lightIdx]);
+        bool dynamicVisible = false;
+        if (splitDynamicShadows) {
+            for (Mesh* mesh : opaqueMeshes) dynamicVisible |= mesh->isDynamic && lightFrusta[lightIdx].IntersectsMesh(*mesh);
+            for (Mesh* mesh : normalMapMeshes) dynamicVisible |= mesh->isDynamic && lightFrusta[lightIdx].IntersectsMesh(*mesh);
+        }
+        recomposite[lightIdx] = splitDynamicShadows && (refreshStatic[lightIdx] || dynamicVisible || shadowLayerHadDynamic[lightIdx]);
+        shadowLayerHadDynamic[lightIdx] = dynamicVisible;
+    }
+
+    if (layeredShadows) {
+        RenderShadowLayersLayered(refreshStatic, recomposite, lightFrusta);
+    } else {
+        glUseProgram(depthProgramID);
+        profiler.countStateChange();
+        for (int lightIdx = 0; lightIdx < NUM_LIGHTS; lightIdx++) {
+            if (!refreshStatic[lightIdx] && !recomposite[lightIdx]) continue; // Cached layer is still valid
+            char scopeName[32];
+            snprintf(scopeName, sizeof(scopeName), "Shadow Layer %d", lightIdx);
+            profiler.beginGpuScope(scopeName);
+            RenderShadowLayer(lightIdx, refreshStatic[lightIdx], recomposite[lightIdx], lightFrusta[lightIdx]);
+            profiler.endGpuScope();
+        }
+    }
+
+    if (settings.reverseZ) {
+        glClipControl(GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE);
+        glClearDepth(1.0);
+        glDepthFunc(GL_LESS);
+    }
+}
+
+void ClassroomSimulator::RenderShadowLayer(int lightIdx, bool refreshStatic, bool recomposite, const Frustum& lightFrustum)
+{
+    glUniformMatrix4fv(depthViewProjectionID, 1, GL_FALSE, &lightViewProjections[lightIdx][0][0]);
+    int lightResolution = shadowSettings.resolution;
+    glViewport(0, 0, lightResolution, lightResolution);
+
+    // Only casters inside this light's frustum are submitted
+    std::vector<DrawBatch>& staticBatches = splitDynamicShadows ? shadowStaticBatches : shadowCasterBatches;
+    BeginCullPass(lightFrustum, LodSelection::ForShadows(), lights[lightSlots[lightIdx]].shadowRooms);
+    if (refreshStatic) EmitVisibleCommands(staticBatches);
+    if (recomposite) EmitVisibleCommands(shadowDynamicBatches);
+    UploadCommands();
+
+    if (refreshStatic) {
+        // Target the specific layer in the cache (or directly in the sampled array)
+        GLuint targetFBO = splitDynamicShadows ? staticFramebuffer : FramebufferName;
+        GLuint targetArray = splitDynamicShadows ? staticDepthTextureArray : depthTextureArray;
+        glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, targetArray, 0, lightIdx);
+        profiler.countStateChange(2);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        // Draw Shadow Casters (dynamic ones too, unless they get their own layer)
+        DrawDepthBatches(staticBatches);
+        shadowLayerDirty[lightIdx] = false;
+    }
+
+    if (recomposite) {
+        // Composite: copy the cached static depth, then add this frame's dynamic casters
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, staticFramebuffer);
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticDepthTextureArray, 0, lightIdx);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, FramebufferName);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTextureArray, 0, lightIdx);
+        glBlitFramebuffer(0, 0, lightResolution, lightResolution, 0, 0, lightResolution, lightResolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
+        profiler.countStateChange(5);
+        DrawDepthBatches(shadowDynamicBatches);
+    }
+}
+
+void ClassroomSimulator::RenderShadowLayersLayered(const bool* refreshStatic, const bool* recomposite, const Frustum* lightFrusta)
+{
+    const ShadowSettings& settings = shadowSettings;
+    glUseProgram(layeredDepthProgramID);
+    profiler.countStateChange();
+    glViewport(0, 0, settings.resolution, settings.resolution);
+
+    std::vector<DrawBatch>& staticBatches = splitDynamicShadows ? shadowStaticBatches : shadowCasterBatches;
+    GLuint targetFBO = splitDynamicShadows ? staticFramebuffer : FramebufferName;
+    GLuint targetArray = splitDynamicShadows ? staticDepthTextureArray : depthTextureArray;
+
+    // Pass 0 refreshes the static depth of every dirty layer, pass 1 composites the dynamic casters.
+    // Layers are drawn MAX_LAYERS_PER_PASS at a time.
+    for (int pass = 0; pass < 2; pass++) {
+        const bool* selected = pass == 0 ? refreshStatic : recomposite;
+        int layers[NUM_LIGHTS];
+        glm::mat4 layerViewProjections[NUM_LIGHTS];
+        Frustum layerFrusta[NUM_LIGHTS];
+        int layerCount = 0;
+        for (int lightIdx = 0; lightIdx < NUM_LIGHTS; lightIdx++) {
+            if (!selected[lightIdx]) continue;
+            layers[layerCount] = lightIdx;
+            layerViewProjections[layerCount] = lightViewProjections[lightIdx];
+            layerFrusta[layerCount] = lightFrusta[lightIdx];
+            layerCount++;
+        }
+        if (layerCount == 0) continue;
+        profiler.beginGpuScope(pass == 0 ? "Shadow Static (Layered)" : "Shadow Dynamic (Layered)");
+
+        if (pass == 0) {
+            // Clear only the layers being refreshed, then attach the whole array for drawing
+            glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+            for (int i = 0; i < layerCount; i++) {
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, targetArray, 0, layers[i]);
+                glClear(GL_DEPTH_BUFFER_BIT);
+            }
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, targetArray, 0);
+            profiler.countStateChange(layerCount + 2);
+        } else {
+            // Copy each cached static layer, then draw the dynamic casters over all of them at once
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, staticFramebuffer);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, FramebufferName);
+            for (int i = 0; i < layerCount; i++) {
+                glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticDepthTextureArray, 0, layers[i]);
+                glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTextureArray, 0, layers[i]);
+                glBlitFramebuffer(0, 0, settings.resolution, settings.resolution, 0, 0, settings.resolution, settings.resolution,
+                                  GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            }
+            glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTextureArray, 0);
+            profiler.countStateChange(layerCount * 2 + 4);
+        }
+
+        std::vector<DrawBatch>& batches = pass == 0 ? staticBatches : shadowDynamicBatches;
+        for (int first = 0; first < layerCount; first += MAX_LAYERS_PER_PASS) {
+            int count = std::min(layerCount - first, MAX_LAYERS_PER_PASS);
+            glUniformMatrix4fv(layerViewProjectionsID, count, GL_FALSE, &layerViewProjections[first][0][0]);
+            glUniform1iv(layerIndicesID, count, &layers[first]);
+            glUniform1i(layerCountID, count);
+
+            // An instance inside any of these frusta is drawn into all of them; the clipper discards the rest
+            roomScratch.assign(rooms.size(), 0);
+            for (int i = first; i < first + count; i++) {
+                const std::vector<unsigned char>& shadowRooms = lights[lightSlots[layers[i]]].shadowRooms;
+                for (size_t r = 0; r < rooms.size(); r++) roomScratch[r] |= shadowRooms[r];
+            }
+            BeginCullPass(&layerFrusta[first], count, LodSelection::ForShadows(), roomScratch);
+            EmitVisibleCommands(batches, count);
+            UploadCommands();
+            DrawDepthBatches(batches, count);
+        }
+        profiler.endGpuScope();
+    }
+
+    for (int lightIdx = 0; lightIdx < NUM_LIGHTS; lightIdx++) {
+        if (refreshStatic[lightIdx]) shadowLayerDirty[lightIdx] = false;
+    }
+}
+
+/**
+ * @brief Distance at which a ceiling light's contribution falls below LIGHT_CUTOFF.
+ * @details Solves power * factor / (base + linear*d + quadratic*d^2) = cutoff for every model in
+ * LIGHT_ATTENUATION (the ones the lighting shaders are compiled with) and keeps the largest.
+ */
+float ClassroomSimulator::LightInfluenceRadius() const
+{
+    float radius = 0.0f;
+    for (const LightAttenuation& m : LIGHT_ATTENUATION) {
+        float c = m.base - m.power * m.factor / LIGHT_CUTOFF;
+        if (c >= 0.0f) continue; // Never reaches the cutoff
+        float d = (-m.linear + sqrtf(m.linear * m.linear - 4.0f * m.quadratic * c)) / (2.0f * m.quadratic);
+        radius = std::max(radius, d);
+    }
+    return radius;
+}
+
+void ClassroomSimulator::AssignLightClusters(const glm::mat4& view, const glm::mat4& projection, int width, int height)
+{
+    LightClusterGrid& grid = lightClusters;
+
+    // Camera near/far and frustum slopes, read back from the projection matrix
+    float nearZ = projection[3][2] / (projection[2][2] - 1.0f);
+    float farZ  = projection[3][2] / (projection[2][2] + 1.0f);
+    float tanX = 1.0f / projection[0][0];
+    float tanY = 1.0f / projection[1][1];
+    float sliceScale = CLUSTER_SLICES / logf(farZ / nearZ);
+
+    // Shaders find their cluster with: tile = fragCoord * tileScale, slice = log(depth) * x + y
+    int lightCount = (int)shadedLights.size();
+    grid.lightCount = lightCount;
+    grid.tileScale = glm::vec2((float)CLUSTER_TILES_X / width, (float)CLUSTER_TILES_Y / height);
+    grid.depthParams = glm::vec2(sliceScale, -logf(nearZ) * sliceScale);
+
+    // --- Light Table ---
+    // Every shaded light; those holding a slot carry its layer and bias matrix, the others layer -1 and their room's box
+    std::vector<int>& layers = grid.layerOfLight;
+    layers.assign(lights.size(), -1);
+    for (int slot = 0; slot < NUM_LIGHTS; slot++) {
+        if (lightSlots[slot] >= 0) layers[lightSlots[slot]] = slot;
+    }
+    grid.lightData.assign(std::max(lightCount, 1) * LIGHT_DATA_TEXELS, glm::vec4(0.0f));
+    grid.centers.resize(lightCount);
+    grid.firstSlice.resize(lightCount);
+    grid.lastSlice.resize(lightCount);
+    auto SliceOf = [&](float depth) {
+        return glm::clamp((int)floorf(logf(std::max(depth, nearZ) / nearZ) * sliceScale), 0, CLUSTER_SLICES - 1);
+    };
+    for (int i = 0; i < lightCount; i++) {
+        int light = shadedLights[i];
+        int layer = layers[light];
+        glm::vec3 center = glm::vec3(view * glm::vec4(lights[light].position, 1.0f));
+        grid.centers[i] = center;
+        glm::vec4* texels = &grid.lightData[i * LIGHT_DATA_TEXELS];
+        texels[0] = glm::vec4(center, lightInfluenceRadius);
+        texels[1] = glm::vec4((float)layer, 0.0f, 0.0f, 0.0f);
+        if (layer >= 0) {
+            for (int col = 0; col < 4; col++) texels[2 + col] = depthBiasMVPs[layer][col];
+        } else {
+            const Room& room = rooms[lights[light].room];
+            texels[2] = glm::vec4(room.boundsMin - glm::vec3(UNSHADOWED_LIGHT_MARGIN), 0.0f);
+            texels[3] = glm::vec4(room.boundsMax + glm::vec3(UNSHADOWED_LIGHT_MARGIN), 0.0f);
+        }
 
-    glGenBuffers(1, &mesh.uvBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.uvBuffer);
-    glBufferData(GL_ARRAY_BUFFER, i_uvs.size() * sizeof(glm::vec2), &i_uvs[0], GL_STATIC_DRAW);
+        // Lights entirely behind the camera or past the far plane get an empty slice range
+        float depth = -center.z;
+        grid.firstSlice[i] = SliceOf(depth - lightInfluenceRadius);
+        grid.lastSlice[i] = SliceOf(depth + lightInfluenceRadius);
+        if (depth + lightInfluenceRadius < nearZ || depth - lightInfluenceRadius > farZ) grid.lastSlice[i] = -1;
+    }
 
-    glGenBuffers(1, &mesh.normalBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.normalBuffer);
-    glBufferData(GL_ARRAY_BUFFER, i_normals.size() * sizeof(glm::vec3), &i_normals[0], GL_STATIC_DRAW);
+    // --- Cluster Lists ---
+    // Each cluster's camera-space bounding box against each light's sphere
+    grid.clusterRanges.clear();
+    grid.lightIndices.clear();
+    for (int slice = 0; slice < CLUSTER_SLICES; slice++) {
+        float sliceNear = nearZ * powf(farZ / nearZ, (float)slice / CLUSTER_SLICES);
+        float sliceFar  = nearZ * powf(farZ / nearZ, (float)(slice + 1) / CLUSTER_SLICES);
+
+        for (int ty = 0; ty < CLUSTER_TILES_Y; ty++) {
+            float y0 = (-1.0f + 2.0f * ty / CLUSTER_TILES_Y) * tanY;
+            float y1 = (-1.0f + 2.0f * (ty + 1) / CLUSTER_TILES_Y) * tanY;
+
+            for (int tx = 0; tx < CLUSTER_TILES_X; tx++) {
+                float x0 = (-1.0f + 2.0f * tx / CLUSTER_TILES_X) * tanX;
+                float x1 = (-1.0f + 2.0f * (tx + 1) / CLUSTER_TILES_X) * tanX;
+                glm::vec3 boxMin(std::min(x0 * sliceNear, x0 * sliceFar), std::min(y0 * sliceNear, y0 * sliceFar), -sliceFar);
+                glm::vec3 boxMax(std::max(x1 * sliceNear, x1 * sliceFar), std::max(y1 * sliceNear, y1 * sliceFar), -sliceNear);
+
+                GLuint first = (GLuint)grid.lightIndices.size();
+                for (int i = 0; i < lightCount; i++) {
+                    if (slice < grid.firstSlice[i] || slice > grid.lastSlice[i]) continue;
+                    glm::vec3 closest = glm::max(boxMin, glm::min(grid.centers[i], boxMax));
+                    glm::vec3 offset = closest - grid.centers[i];
+                    if (glm::dot(offset, offset) <= lightInfluenceRadius * lightInfluenceRadius) grid.lightIndices.push_back((GLushort)i);
+                }
+                grid.clusterRanges.push_back(first);
+                grid.clusterRanges.push_back((GLuint)grid.lightIndices.size() - first);
+            }
+        }
+    }
+}
 
-    glGenBuffers(1, &mesh.elementBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.elementBuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
+glm::mat4 ClassroomSimulator::ComputeLightProjection(const glm::mat4& lightView, const Light& light) const
+{
+    // Fit the depth range to the casters: nearest and farthest corner of the light's caster box along its axis.
+    // The near plane never gets closer than LIGHT_MIN_NEAR, which is what keeps the ceiling out.
+    float nearZ = FLT_MAX, farZ = 0.0f;
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner((i & 1) ? light.casterMax.x : light.casterMin.x,
+                         (i & 2) ? light.casterMax.y : light.casterMin.y,
+                         (i & 4) ? light.casterMax.z : light.casterMin.z);
+        float depth = -(lightView * glm::vec4(corner, 1.0f)).z;
+        nearZ = std::min(nearZ, depth);
+        farZ = std::max(farZ, depth);
+    }
+    nearZ = std::max(nearZ, LIGHT_MIN_NEAR);
+    farZ = std::max(farZ * 1.01f, nearZ + 1.0f);
+
+    float fov = glm::radians(LIGHT_FOV_DEGREES);
+    if (!shadowSettings.reverseZ) return glm::perspective(fov, LIGHT_ASPECT, nearZ, farZ);
+
+    // Reverse-Z for a [0,1] clip range: depth is 1 at the near plane and 0 at the far plane.
+    // (Frustum::FromMatrix still assumes [-1,1], which only makes its far plane more conservative.)
+    float f = 1.0f / tanf(fov * 0.5f);
+    glm::mat4 proj(0.0f);
+    proj[0][0] = f / LIGHT_ASPECT;
+    proj[1][1] = f;
+    proj[2][2] = nearZ / (farZ - nearZ);
+    proj[2][3] = -1.0f;
+    proj[3][2] = nearZ * farZ / (farZ - nearZ);
+    return proj;
+}
+
+// buildLods: also simplify it into a level of detail chain (for the heavy props)
+void ClassroomSimulator::LoadStandardMesh(Mesh& mesh, const char* objPath, const char* ddsPath, bool buildLods) {
+    mesh.material = AddMaterial(ddsPath);
+    mesh.hasNormalMap = false;
 
-    return mesh;
+    // Indexed + interleaved geometry, straight from the binary cache when it is up to date.
+    // Loaded by StartAssetLoads(); BakeGeometryArenas() uploads it with the rest of the scene.
+    MeshLoad load;
+    load.mesh = &mesh;
+    load.objPath = objPath;
+    load.flags = MESH_LOAD_FLAGS | (buildLods ? MESH_CACHE_BUILD_LODS : 0);
+    meshLoads.push_back(std::move(load));
 }
 
-Mesh ClassroomSimulator::LoadNormalMapMesh(const char* objPath, const char* diffPath, const char* normPath, const char* specPath) {
-    Mesh mesh;
-    mesh.textureID = loadDDS(diffPath);
-    mesh.normalTextureID = loadBMP_custom(normPath);
-    mesh.specularTextureID = loadDDS(specPath);
+void ClassroomSimulator::LoadNormalMapMesh(Mesh& mesh, const char* objPath, const char* diffPath, const char* normPath, const char* specPath) {
+    mesh.material = AddMaterial(diffPath, normPath, specPath);
     mesh.hasNormalMap = true;
 
-    std::vector<glm::vec3> vertices, normals;
-    std::vector<glm::vec2> uvs;
-    loadOBJ(objPath, vertices, uvs, normals);
+    // Tangents/Bitangents are part of the cached vertex format
+    MeshLoad load;
+    load.mesh = &mesh;
+    load.objPath = objPath;
+    load.flags = MESH_LOAD_FLAGS | MESH_CACHE_HAS_TANGENTS;
+    meshLoads.push_back(std::move(load));
+}
 
-    std::vector<glm::vec3> tangents, bitangents;
-    computeTangentBasis(vertices, uvs, normals, tangents, bitangents);
+/**
+ * @brief Hands every queued mesh and every material texture to the worker threads.
+ * @details Workers only touch their own MeshLoad / LoadedTexture, which were all created here,
+ * so neither container changes while they run.
+ */
+void ClassroomSimulator::StartAssetLoads() {
+    jobs.start();
+    printf("Asset Loading: %u worker threads\n", jobs.threadCount());
+
+    for (MeshLoad& load : meshLoads) {
+        MeshLoad* target = &load;
+        jobs.submit([this, target]() {
+            target->loaded = loadMeshCached(target->objPath.c_str(), target->flags, target->data);
+            jobs.postToMainThread([this, target]() {
+                target->done = true;
+                PackFinishedMeshLoads();
+            });
+        });
+    }
 
-    std::vector<unsigned short> indices;
-    std::vector<glm::vec3> i_vertices, i_normals, i_tangents, i_bitangents;
-    std::vector<glm::vec2> i_uvs;
+    // Each distinct path is read once, however many materials use it
+    for (const Material& m : materials) {
+        for (const std::string* path : { &m.diffusePath, &m.normalPath, &m.specularPath }) {
+            if (path->empty() || loadedTextures.count(*path)) continue;
+            LoadedTexture* target = &loadedTextures[*path];
+            std::string file = *path;
+            bool normalMap = path == &m.normalPath;
+            jobs.submit([target, file, normalMap]() {
+                if (file.size() > 4 && file.compare(file.size() - 4, 4, ".bmp") == 0) {
+                    // BMP normal maps go through their BC5 cache; the raw pixels are only a fallback
+                    if (normalMap && readNormalMapCached(file.c_str(), target->dds)) {
+                        target->loaded = true;
+                        return;
+                    }
+                    target->bmp = readBMPImage(file.c_str(), target->bmpWidth, target->bmpHeight);
+                    target->loaded = target->bmp != nullptr;
+                } else {
+                    target->loaded = readDDSImage(file.c_str(), target->dds);
+                }
+            });
+        }
+    }
+}
 
-    indexVBO_TBN(vertices, uvs, normals, tangents, bitangents, indices, 
-                 i_vertices, i_uvs, i_normals, i_tangents, i_bitangents);
+// Packs finished loads in declaration order; a load that finished early waits for the ones before it
+void ClassroomSimulator::PackFinishedMeshLoads() {
+    while (meshLoadsPacked < meshLoads.size() && meshLoads[meshLoadsPacked].done) {
+        MeshLoad& load = meshLoads[meshLoadsPacked++];
+        if (load.loaded) PackMeshData(*load.mesh, load.data);
+        load.data.blob.clear();
+        load.data.blob.shrink_to_fit();
+    }
+}
 
-    mesh.indexCount = indices.size();
+void ClassroomSimulator::FinishAssetLoads() {
+    double start = glfwGetTime();
+    jobs.waitAndRunMainThreadTasks();
+    jobs.stop();
+    meshLoads.clear();
+    printf("Asset Loading: waited %.0f ms for the workers\n", (glfwGetTime() - start) * 1000.0);
+}
 
-    glGenBuffers(1, &mesh.vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, i_vertices.size() * sizeof(glm::vec3), &i_vertices[0], GL_STATIC_DRAW);
+static int ArenaIndex(bool hasTangents, GLenum indexType) {
+    return (hasTangents ? 1 : 0) + (indexType == GL_UNSIGNED_INT ? 2 : 0);
+}
 
-    glGenBuffers(1, &mesh.uvBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.uvBuffer);
-    glBufferData(GL_ARRAY_BUFFER, i_uvs.size() * sizeof(glm::vec2), &i_uvs[0], GL_STATIC_DRAW);
+void ClassroomSimulator::PackMeshData(Mesh& mesh, const MeshData& data) {
+    const MeshCacheHeader& header = data.header();
+    GLenum indexType = header.indexSize == sizeof(unsigned int) ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+
+    GeometryArena& arena = arenas[ArenaIndex(mesh.hasNormalMap, indexType)];
+    arena.hasTangents = mesh.hasNormalMap;
+    arena.quantized = (header.flags & MESH_CACHE_QUANTIZED) != 0;
+    arena.indexType = indexType;
+    mesh.firstVertex = arena.vertexCount;
+    mesh.vertexCount = header.vertexCount;
+    mesh.firstIndex = arena.indexCount;
+    arena.Pack(data, mesh.drawRanges);
+    mesh.lods.assign(data.lods(), data.lods() + header.lodCount);
+
+    mesh.arena = &arena;
+    mesh.indexCount = header.indexCount;
+    mesh.boundsCenter = glm::vec3(header.boundsCenter[0], header.boundsCenter[1], header.boundsCenter[2]);
+    mesh.boundsRadius = header.boundsRadius;
+    mesh.boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+    mesh.boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+    if (arena.quantized) {
+        glm::vec3 offset(header.quantizeOffset[0], header.quantizeOffset[1], header.quantizeOffset[2]);
+        mesh.dequantize = glm::scale(glm::translate(glm::mat4(1.0f), offset), glm::vec3(header.quantizeScale));
+    }
+}
+
+int ClassroomSimulator::AddMaterial(const char* diffusePath, const char* normalPath, const char* specularPath) {
+    // Identical texture sets (e.g. exhaust and projector) share one material
+    for (size_t i = 0; i < materials.size(); i++) {
+        const Material& m = materials[i];
+        if (m.diffusePath == diffusePath && m.normalPath == normalPath && m.specularPath == specularPath) return (int)i;
+    }
+    if ((int)materials.size() == MAX_MATERIALS) {
+        printf("Error: More than %d materials, %s is not loaded\n", MAX_MATERIALS, diffusePath);
+        return 0;
+    }
 
-    glGenBuffers(1, &mesh.normalBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.normalBuffer);
-    glBufferData(GL_ARRAY_BUFFER, i_normals.size() * sizeof(glm::vec3), &i_normals[0], GL_STATIC_DRAW);
+    Material m;
+    m.diffusePath = diffusePath;
+    m.normalPath = normalPath;
+    m.specularPath = specularPath;
+    materials.push_back(m);
+    return (int)materials.size() - 1;
+}
 
-    glGenBuffers(1, &mesh.tangentBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.tangentBuffer);
-    glBufferData(GL_ARRAY_BUFFER, i_tangents.size() * sizeof(glm::vec3), &i_tangents[0], GL_STATIC_DRAW);
+void ClassroomSimulator::BuildMaterialTable() {
+    struct TextureLayer { GLuint array; GLint layer; };
+    std::map<std::string, TextureLayer> layers;
+
+    // --- 1. Group every distinct DDS by size, mip count and format ---
+    // Array layers must match in all three; the BMP normal map gets an array of its own.
+    std::map<std::vector<unsigned int>, std::vector<std::string>> groups;
+    // The files were read by StartAssetLoads(); the arrays are only allocated here, the streamer fills them.
+    for (const Material& m : materials) {
+        for (const std::string* path : { &m.diffusePath, &m.normalPath, &m.specularPath }) {
+            if (path->empty() || layers.count(*path)) continue;
+            const LoadedTexture& texture = loadedTextures[*path];
+            if (!texture.loaded) {
+                layers[*path] = { 0, 0 };
+                continue;
+            }
+            if (texture.bmp) {
+                GLuint array = allocateBMPArray(texture.bmpWidth, texture.bmpHeight, 1);
+                textureArrays.push_back(array);
+                layers[*path] = { array, 0 };
+                continue;
+            }
+            const DDSImage& dds = texture.dds;
+            layers[*path] = { 0, (GLint)groups[{ dds.width, dds.height, dds.mipMapCount, dds.format }].size() };
+            groups[{ dds.width, dds.height, dds.mipMapCount, dds.format }].push_back(*path);
+        }
+    }
 
-    glGenBuffers(1, &mesh.bitangentBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.bitangentBuffer);
-    glBufferData(GL_ARRAY_BUFFER, i_bitangents.size() * sizeof(glm::vec3), &i_bitangents[0], GL_STATIC_DRAW);
+    // --- 2. One GL_TEXTURE_2D_ARRAY per group ---
+    for (const auto& group : groups) {
+        GLuint array = allocateDDSArray(loadedTextures[group.second[0]].dds, (int)group.second.size());
+        if (!array) continue;
+        textureArrays.push_back(array);
+        for (const std::string& path : group.second) layers[path].array = array;
+    }
 
-    glGenBuffers(1, &mesh.elementBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.elementBuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
+    // --- 3. Resolve materials ---
+    // Every layer that exists is still empty, so the material starts as a placeholder
+    for (Material& m : materials) {
+        if (!m.diffusePath.empty())  { m.diffuseArray = layers[m.diffusePath].array;   m.diffuseLayer = layers[m.diffusePath].layer; }
+        if (!m.normalPath.empty())   { m.normalArray = layers[m.normalPath].array;     m.normalLayer = layers[m.normalPath].layer; }
+        if (!m.specularPath.empty()) { m.specularArray = layers[m.specularPath].array; m.specularLayer = layers[m.specularPath].layer; }
+        m.pendingTextures = (m.diffuseArray ? 1 : 0) + (m.normalArray ? 1 : 0) + (m.specularArray ? 1 : 0);
+    }
+    printf("Materials: %d in %d texture arrays\n", (int)materials.size(), (int)textureArrays.size());
+    UploadMaterialTable();
+}
 
-    return mesh;
+void ClassroomSimulator::UploadMaterialTable() {
+    std::vector<GLint> table;
+    for (const Material& m : materials) {
+        table.insert(table.end(), { m.diffuseLayer, m.normalLayer, m.specularLayer, m.Flags() });
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, materialUniformBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, table.size() * sizeof(GLint), table.data());
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    materialTableDirty = false;
 }
 
-void ClassroomSimulator::DrawMesh(const Mesh& mesh, const RenderUniforms& uniforms, const glm::mat4& View, const glm::mat4& Projection, float alpha) 
+/**
+ * @brief Queues every mesh's geometry and textures on the streamer, nearest to the camera first.
+ * @details Each mesh's textures go just before its geometry; a callback after the uploads makes the
+ * mesh drawable (and re-renders the shadow layers that see it) or takes a material off placeholder.
+ * The CPU copies are released by the callbacks once the streamer no longer reads them.
+ */
+void ClassroomSimulator::QueueAssetStreaming() {
+    glm::vec3 eye;
+    float horizontalAngle, verticalAngle;
+    getCameraPose(eye, horizontalAngle, verticalAngle);
+    if (options.benchmark) eye = sampleCameraPath(benchmark.path, 0.0f).position;
+
+    std::vector<Mesh*> meshes = opaqueMeshes;
+    meshes.insert(meshes.end(), normalMapMeshes.begin(), normalMapMeshes.end());
+    meshes.insert(meshes.end(), transparentMeshes.begin(), transparentMeshes.end());
+    meshes.insert(meshes.end(), unlitMeshes.begin(), unlitMeshes.end());
+
+    // Distance from the eye to a mesh's nearest instance sphere
+    auto NearestDistance = [&](const Mesh* mesh) {
+        float nearest = FLT_MAX;
+        for (GLuint i = 0; i < mesh->modelMatrices.size(); i++) {
+            const InstanceBounds& bounds = mesh->arena->bounds;
+            GLuint j = mesh->baseInstance + i;
+            float d = glm::length(glm::vec3(bounds.x[j], bounds.y[j], bounds.z[j]) - eye) - bounds.radius[j];
+            nearest = std::min(nearest, d);
+        }
+        return nearest;
+    };
+    std::vector<std::pair<float, Mesh*>> order;
+    for (Mesh* mesh : meshes) {
+        if (mesh->arena && !mesh->modelMatrices.empty()) order.push_back({ NearestDistance(mesh), mesh });
+    }
+    std::stable_sort(order.begin(), order.end(), [](const std::pair<float, Mesh*>& a, const std::pair<float, Mesh*>& b) {
+        return a.first < b.first;
+    });
+
+    const size_t queuedBefore = streamer.pendingBytes();
+    std::map<std::string, bool> texturesQueued;
+    for (const auto& entry : order) {
+        Mesh* mesh = entry.second;
+        const Material& m = materials[std::max(mesh->material, 0)];
+        struct Slot { const std::string* path; GLuint array; GLint layer; };
+        const Slot slots[] = {
+            { &m.diffusePath, m.diffuseArray, m.diffuseLayer },
+            { &m.normalPath, m.normalArray, m.normalLayer },
+            { &m.specularPath, m.specularArray, m.specularLayer } };
+        for (const Slot& slot : slots) {
+            const std::string& path = *slot.path;
+            if (!slot.array || texturesQueued[path]) continue;
+            texturesQueued[path] = true;
+
+            LoadedTexture* texture = &loadedTextures[path];
+            GLuint array = slot.array;
+            GLint layer = slot.layer;
+            if (texture->bmp) {
+                streamer.queueLayer(array, 0, layer, texture->bmpWidth, texture->bmpHeight, GL_BGR, GL_UNSIGNED_BYTE,
+                                    texture->bmp, (size_t)texture->bmpWidth * texture->bmpHeight * 3);
+            } else {
+                for (unsigned int level = 0; level < texture->dds.mipMapCount; level++) {
+                    unsigned int width, height, offset;
+                    unsigned int size = getDDSLevel(texture->dds, level, width, height, offset);
+                    streamer.queueCompressedLayer(array, level, layer, width, height, texture->dds.format, texture->dds.buffer + offset, size);
+                }
+            }
+            streamer.queueCallback([this, texture, array, path]() {
+                if (texture->bmp) {
+                    glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+                    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+                }
+                freeDDSImage(texture->dds);
+                delete [] texture->bmp;
+                *texture = LoadedTexture();
+                for (Material& user : materials) {
+                    for (const std::string* used : { &user.diffusePath, &user.normalPath, &user.specularPath }) {
+                        if (*used == path) user.pendingTextures--;
+                    }
+                }
+                materialTableDirty = true;
+            });
+        }
+
+        // Glass and the light panels cast no shadows
+        bool caster = std::find(transparentMeshes.begin(), transparentMeshes.end(), mesh) == transparentMeshes.end() &&
+                      std::find(unlitMeshes.begin(), unlitMeshes.end(), mesh) == unlitMeshes.end();
+        mesh->arena->StreamMesh(streamer, mesh->firstVertex, mesh->vertexCount, mesh->firstIndex, mesh->indexCount);
+        streamer.queueCallback([this, mesh, caster]() {
+            mesh->resident = true;
+            if (caster) InvalidateShadowCaster(*mesh);
+        });
+    }
+
+    streamer.queueCallback([this]() {
+        for (GeometryArena& arena : arenas) arena.ReleaseStaging();
+        loadedTextures.clear();
+        printf("Streaming: every mesh and texture is resident\n");
+    });
+    printf("Streaming: %.1f MB queued (%s staging ring, %d MB per frame)\n",
+           (streamer.pendingBytes() - queuedBefore) / (1024.0 * 1024.0),
+           streamer.isPersistent() ? "persistent" : "mapped", STREAMING_FRAME_BUDGET / (1024 * 1024));
+}
+
+void ClassroomSimulator::BakeGeometryArenas() {
+    std::vector<Mesh*> allMeshes = opaqueMeshes;
+    allMeshes.insert(allMeshes.end(), normalMapMeshes.begin(), normalMapMeshes.end());
+    allMeshes.insert(allMeshes.end(), transparentMeshes.begin(), transparentMeshes.end());
+    allMeshes.insert(allMeshes.end(), unlitMeshes.begin(), unlitMeshes.end());
+
+    // Each mesh's instances become a slice of its arena's instance buffer
+    for (Mesh* mesh : allMeshes) {
+        if (!mesh->arena) continue;
+        mesh->baseInstance = (GLuint)mesh->arena->instances.size();
+        std::vector<glm::mat4> matrices = mesh->InstanceMatrices();
+        mesh->arena->instances.insert(mesh->arena->instances.end(), matrices.begin(), matrices.end());
+        mesh->arena->instanceMaterials.insert(mesh->arena->instanceMaterials.end(), mesh->modelMatrices.size(), std::max(mesh->material, 0));
+        // The shaders turn the vertices before dequantizing them: move the pivots into vertex space (the scale is uniform)
+        glm::mat4 quantize = glm::inverse(mesh->dequantize);
+        for (size_t i = 0; i < mesh->modelMatrices.size(); i++) {
+            InstanceAnimation animation = i < mesh->animations.size() ? mesh->animations[i] : InstanceAnimation();
+            if (animation.angularVelocity != 0.0f) animation.pivot = glm::vec3(quantize * glm::vec4(animation.pivot, 1.0f));
+            else animation = InstanceAnimation();
+            mesh->arena->instanceAnimations.push_back(animation);
+        }
+        mesh->arena->bounds.Resize(mesh->arena->instances.size());
+        mesh->UpdateInstanceBounds();
+    }
+
+    size_t vertexBytes = 0, positionBytes = 0, indexBytes = 0;
+    for (GeometryArena& arena : arenas) {
+        if (arena.IsEmpty()) continue;
+        arena.Upload(streamer.isPersistent());
+        vertexBytes += arena.vertexData.size();
+        positionBytes += arena.positionData.size();
+        indexBytes += arena.indexData.size();
+    }
+    printf("Geometry: %.2f MB of %s vertices, %.2f MB of depth-pass positions, %.2f MB of indices\n",
+           vertexBytes / (1024.0 * 1024.0), QUANTIZE_VERTICES ? "quantized" : "float",
+           positionBytes / (1024.0 * 1024.0), indexBytes / (1024.0 * 1024.0));
+
+    // World-space box around each instance: rooms it reaches into walk its room along with theirs,
+    // and shadow casters widen the caster box of every room they reach, to fit the light depth ranges
+    auto InstanceBox = [](const Mesh* mesh, size_t k, glm::vec3& boxMin, glm::vec3& boxMax) {
+        const glm::mat4& model = mesh->modelMatrices[k];
+        boxMin = glm::vec3(FLT_MAX);
+        boxMax = glm::vec3(-FLT_MAX);
+        if (!mesh->animations.empty()) {
+            // Turning: the box around its swept sphere
+            glm::vec3 center;
+            float radius;
+            mesh->InstanceSphere(k, center, radius);
+            glm::vec3 world = glm::vec3(model * glm::vec4(center, 1.0f));
+            float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+            boxMin = world - glm::vec3(radius * scale);
+            boxMax = world + glm::vec3(radius * scale);
+            return;
+        }
+        for (int i = 0; i < 8; i++) {
+            glm::vec3 corner((i & 1) ? mesh->boundsMax.x : mesh->boundsMin.x,
+                             (i & 2) ? mesh->boundsMax.y : mesh->boundsMin.y,
+                             (i & 4) ? mesh->boundsMax.z : mesh->boundsMin.z);
+            glm::vec3 world = glm::vec3(model * glm::vec4(corner, 1.0f));
+            boxMin = glm::min(boxMin, world);
+            boxMax = glm::max(boxMax, world);
+        }
+    };
+    for (Mesh* mesh : allMeshes) {
+        bool caster = std::find(opaqueMeshes.begin(), opaqueMeshes.end(), mesh) != opaqueMeshes.end() ||
+                      std::find(normalMapMeshes.begin(), normalMapMeshes.end(), mesh) != normalMapMeshes.end();
+        for (size_t home = 0; home < rooms.size(); home++) {
+            for (GLuint k = mesh->roomStarts[home]; k < mesh->roomStarts[home + 1]; k++) {
+                glm::vec3 boxMin, boxMax;
+                InstanceBox(mesh, k, boxMin, boxMax);
+                for (size_t r = 0; r < rooms.size(); r++) {
+                    Room& room = rooms[r];
+                    if (r != home && (boxMax.x < room.boundsMin.x || boxMax.y < room.boundsMin.y || boxMax.z < room.boundsMin.z ||
+                                      boxMin.x > room.boundsMax.x || boxMin.y > room.boundsMax.y || boxMin.z > room.boundsMax.z)) continue;
+                    if (r != home && std::find(room.overlapping.begin(), room.overlapping.end(), (int)home) == room.overlapping.end()) {
+                        room.overlapping.push_back((int)home);
+                    }
+                    if (caster) {
+                        room.casterMin = glm::min(room.casterMin, boxMin);
+                        room.casterMax = glm::max(room.casterMax, boxMax);
+                    }
+                }
+            }
+        }
+    }
+
+    // A light's shadow pass walks its own room and the rooms behind that room's portals
+    for (Light& light : lights) {
+        light.shadowRooms.assign(rooms.size(), 0);
+        light.shadowRooms[light.room] = 1;
+        for (int p : rooms[light.room].portals) {
+            light.shadowRooms[portals[p].rooms[0]] = 1;
+            light.shadowRooms[portals[p].rooms[1]] = 1;
+        }
+        light.casterMin = glm::vec3(FLT_MAX);
+        light.casterMax = glm::vec3(-FLT_MAX);
+        for (size_t r = 0; r < rooms.size(); r++) {
+            if (!light.shadowRooms[r]) continue;
+            light.casterMin = glm::min(light.casterMin, rooms[r].casterMin);
+            light.casterMax = glm::max(light.casterMax, rooms[r].casterMax);
+        }
+        if (light.casterMin.x > light.casterMax.x) light.casterMin = light.casterMax = light.position; // Nothing to shadow
+    }
+
+    glGenBuffers(1, &indirectBuffer);
+    BuildDrawBatches();
+}
+
+void ClassroomSimulator::BuildDrawBatches() {
+    // Shadow casters need no material, so each list is one batch per arena
+    shadowCasterBatches.clear();
+    shadowStaticBatches.clear();
+    shadowDynamicBatches.clear();
+    AppendShadowBatches(shadowCasterBatches, -1);
+    AppendShadowBatches(shadowStaticBatches, 0);
+    AppendShadowBatches(shadowDynamicBatches, 1);
+
+    opaqueBatches.clear();
+    normalMapBatches.clear();
+    transparentBatches.clear();
+    unlitBatches.clear();
+    AppendMaterialBatches(opaqueBatches, opaqueMeshes);
+    AppendMaterialBatches(normalMapBatches, normalMapMeshes);
+    AppendMaterialBatches(transparentBatches, transparentMeshes);
+    AppendMaterialBatches(unlitBatches, unlitMeshes);
+}
+
+// dynamicFilter: -1 = every caster, 0 = static casters only, 1 = dynamic casters only
+void ClassroomSimulator::AppendShadowBatches(std::vector<DrawBatch>& batches, int dynamicFilter) {
+    std::vector<Mesh*> casters = opaqueMeshes;
+    casters.insert(casters.end(), normalMapMeshes.begin(), normalMapMeshes.end());
+
+    for (const GeometryArena& arena : arenas) {
+        DrawBatch batch = { &arena, 0, 0, 0 };
+        for (Mesh* mesh : casters) {
+            if (mesh->arena != &arena || mesh->modelMatrices.empty()) continue;
+            if (dynamicFilter >= 0 && mesh->isDynamic != (dynamicFilter == 1)) continue;
+            batch.meshes.push_back(mesh);
+        }
+        if (!batch.meshes.empty()) batches.push_back(batch);
+    }
+}
+
+// Sorts the meshes so the ones sharing an arena and texture arrays end up in one batch
+void ClassroomSimulator::AppendMaterialBatches(std::vector<DrawBatch>& batches, const std::vector<Mesh*>& meshes) {
+    auto BatchOf = [this](const Mesh* mesh) {
+        const Material& m = materials[std::max(mesh->material, 0)];
+        return DrawBatch{ mesh->arena, m.diffuseArray, m.normalArray, m.specularArray };
+    };
+    auto SameBatch = [](const DrawBatch& a, const DrawBatch& b) {
+        return a.arena == b.arena && a.diffuseArray == b.diffuseArray && a.normalArray == b.normalArray && a.specularArray == b.specularArray;
+    };
+
+    std::vector<Mesh*> sorted;
+    for (Mesh* mesh : meshes) if (mesh->arena && !mesh->modelMatrices.empty()) sorted.push_back(mesh);
+    std::stable_sort(sorted.begin(), sorted.end(), [&](const Mesh* a, const Mesh* b) {
+        DrawBatch ba = BatchOf(a), bb = BatchOf(b);
+        if (ba.arena != bb.arena) return ba.arena < bb.arena;
+        if (ba.diffuseArray != bb.diffuseArray) return ba.diffuseArray < bb.diffuseArray;
+        if (ba.normalArray != bb.normalArray) return ba.normalArray < bb.normalArray;
+        return ba.specularArray < bb.specularArray;
+    });
+
+    size_t first = batches.size();
+    for (Mesh* mesh : sorted) {
+        DrawBatch key = BatchOf(mesh);
+        if (batches.size() == first || !SameBatch(batches.back(), key)) batches.push_back(key);
+        batches.back().meshes.push_back(mesh);
+    }
+}
+
+// Starts a pass (the camera, or one light's layer): tests every instance of the rooms in roomMask once,
+// and of the rooms reaching into them. Instances of the other rooms stay invisible untested.
+// lod picks the level each visible instance is drawn with.
+void ClassroomSimulator::BeginCullPass(const Frustum& frustum, const LodSelection& lod, const std::vector<unsigned char>& roomMask) {
+    BeginCullPass(&frustum, 1, lod, roomMask);
+}
+
+// Layered passes keep an instance if any of the frusta sees it
+void ClassroomSimulator::BeginCullPass(const Frustum* frusta, int frustumCount, const LodSelection& lod, const std::vector<unsigned char>& roomMask) {
+    drawCommands.clear();
+    cullLod = lod;
+    cullRooms = roomMask;
+    for (size_t r = 0; r < rooms.size(); r++) {
+        if (!roomMask[r]) continue;
+        for (int other : rooms[r].overlapping) cullRooms[other] = 1;
+    }
+    for (int i = 0; i < NUM_ARENAS; i++) {
+        if (!arenas[i].IsEmpty()) arenaVisibility[i].assign(arenas[i].bounds.Size(), 0);
+    }
+
+    for (const Mesh& mesh : sceneMeshes) {
+        if (!mesh.arena || mesh.modelMatrices.empty()) continue;
+        const InstanceBounds& bounds = mesh.arena->bounds;
+        unsigned char* visible = arenaVisibility[mesh.arena - arenas].data();
+        for (size_t r = 0; r < rooms.size(); r++) {
+            size_t first = mesh.baseInstance + mesh.roomStarts[r];
+            size_t count = mesh.roomStarts[r + 1] - mesh.roomStarts[r];
+            if (!cullRooms[r] || count == 0) continue;
+            frusta[0].CullSpheres(bounds, first, count, visible + first);
+            for (int f = 1; f < frustumCount; f++) {
+                cullScratch.resize(count);
+                frusta[f].CullSpheres(bounds, first, count, cullScratch.data());
+                for (size_t j = 0; j < count; j++) visible[first + j] |= cullScratch[j];
+            }
+        }
+    }
+}
+
+// Writes the batches' commands for the current pass: one per draw range and run of visible instances
+// at the same level of detail. Visible instances are usually contiguous (instances are added in grid order),
+// and neighbours are at similar distances, so runs stay few.
+// layerCount > 1 repeats every instance once per layer (see SetInstanceDivisor).
+// singleInstances gives every visible instance its own command, so they can be sorted.
+void ClassroomSimulator::EmitVisibleCommands(std::vector<DrawBatch>& batches, GLuint layerCount, bool singleInstances) {
+    for (DrawBatch& batch : batches) {
+        const std::vector<unsigned char>& visible = arenaVisibility[batch.arena - arenas];
+        const InstanceBounds& bounds = batch.arena->bounds;
+        batch.firstCommand = (GLuint)drawCommands.size();
+
+        for (const Mesh* mesh : batch.meshes) {
+            if (!mesh->resident) continue;
+            // Only the rooms the pass walked were tested
+            for (size_t room = 0; room < cullRooms.size(); room++) {
+                if (!cullRooms[room]) continue;
+                GLuint end = mesh->roomStarts[room + 1];
+                for (GLuint i = mesh->roomStarts[room]; i < end; ) {
+                    if (!visible[mesh->baseInstance + i]) { i++; continue; }
+                    GLuint runStart = i;
+                    GLuint maxRun = singleInstances ? 1 : end;
+                    GLuint level = cullLod.Select(*mesh, bounds, mesh->baseInstance + i++);
+                    while (i < end && i - runStart < maxRun && visible[mesh->baseInstance + i] &&
+                           cullLod.Select(*mesh, bounds, mesh->baseInstance + i) == level) i++;
+
+                    const MeshLod& lod = mesh->lods[level];
+                    for (GLuint r = lod.firstRange; r < lod.firstRange + lod.rangeCount; r++) {
+                        const MeshDrawRange& range = mesh->drawRanges[r];
+                        drawCommands.push_back({ range.indexCount, (i - runStart) * layerCount, range.firstIndex, (GLint)range.baseVertex, mesh->baseInstance + runStart });
+                    }
+                }
+            }
+        }
+        batch.commandCount = (GLsizei)(drawCommands.size() - batch.firstCommand);
+    }
+}
+
+// Orders each batch's single-instance commands by squared eye distance to the instance's sphere centre,
+// then the batches by their nearest command. Batches keep their state, so this is per bucket only.
+void ClassroomSimulator::SortFrontToBack(std::vector<DrawBatch>& batches, const glm::vec3& eye) {
+    for (DrawBatch& batch : batches) {
+        const InstanceBounds& bounds = batch.arena->bounds;
+        auto DistanceOf = [&](const DrawCommand& cmd) {
+            glm::vec3 d = glm::vec3(bounds.x[cmd.baseInstance], bounds.y[cmd.baseInstance], bounds.z[cmd.baseInstance]) - eye;
+            return glm::dot(d, d);
+        };
+
+        DrawCommand* first = drawCommands.data() + batch.firstCommand;
+        std::sort(first, first + batch.commandCount, [&](const DrawCommand& a, const DrawCommand& b) {
+            return DistanceOf(a) < DistanceOf(b);
+        });
+        batch.nearestDistance = batch.commandCount ? DistanceOf(*first) : FLT_MAX;
+    }
+    std::stable_sort(batches.begin(), batches.end(), [](const DrawBatch& a, const DrawBatch& b) {
+        return a.nearestDistance < b.nearestDistance;
+    });
+}
+
+// Stable LSD radix sort of values by their keys, 8 bits per pass. A pass whose digit is the same for
+// every key is skipped. Both pairs of arrays are swapped back and forth, so nothing is reallocated once
+// the scratch arrays have reached the largest size sorted.
+static void RadixSortByKey(std::vector<unsigned int>& keys, std::vector<GLuint>& values,
+                           std::vector<unsigned int>& keysScratch, std::vector<GLuint>& valuesScratch)
 {
-    // Bind Material Textures
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, mesh.textureID);
-    glUniform1i(uniforms.TextureID, 0);
-
-    if (mesh.hasNormalMap) {
-        glUniform1i(uniforms.bUseNormalMapID, 1);
-        glUniform1i(uniforms.bUseSpecularMapID, 1);
-        
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, mesh.normalTextureID);
-        glUniform1i(uniforms.NormalSamplerID, 2);
-        
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, mesh.specularTextureID);
-        glUniform1i(uniforms.SpecularSamplerID, 3);
-    } else {
-        glUniform1i(uniforms.bUseNormalMapID, 0);
-        glUniform1i(uniforms.bUseSpecularMapID, 0);
+    size_t count = keys.size();
+    keysScratch.resize(count);
+    valuesScratch.resize(count);
+    for (int shift = 0; shift < 32; shift += 8) {
+        size_t offsets[256] = {};
+        for (size_t i = 0; i < count; i++) offsets[(keys[i] >> shift) & 0xFF]++;
+        if (offsets[(keys[0] >> shift) & 0xFF] == count) continue;
+        size_t sum = 0;
+        for (size_t& offset : offsets) {
+            size_t digitCount = offset;
+            offset = sum;
+            sum += digitCount;
+        }
+        for (size_t i = 0; i < count; i++) {
+            size_t slot = offsets[(keys[i] >> shift) & 0xFF]++;
+            keysScratch[slot] = keys[i];
+            valuesScratch[slot] = values[i];
+        }
+        keys.swap(keysScratch);
+        values.swap(valuesScratch);
     }
+}
 
-    // Bind Geometry Attributes
-    glEnableVertexAttribArray(0); glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBuffer); glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-    glEnableVertexAttribArray(1); glBindBuffer(GL_ARRAY_BUFFER, mesh.uvBuffer);     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
-    glEnableVertexAttribArray(2); glBindBuffer(GL_ARRAY_BUFFER, mesh.normalBuffer); glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+// Orders each batch's single-instance commands back to front by the view-space depth of their instance's
+// sphere centre. Depths become unsigned keys in the same order (sign bit flipped, negatives inverted) and
+// an index array is radix sorted by them; being stable, a multi-range instance's commands stay together.
+// Batches keep their state, so this is per batch only.
+void ClassroomSimulator::SortBackToFront(std::vector<DrawBatch>& batches, const glm::mat4& view) {
+    // View-space z of a point; the farthest is the most negative, so it sorts first
+    glm::vec4 depthRow(view[0][2], view[1][2], view[2][2], view[3][2]);
+    for (DrawBatch& batch : batches) {
+        if (batch.commandCount < 2) continue;
+        const InstanceBounds& bounds = batch.arena->bounds;
+        DrawCommand* first = drawCommands.data() + batch.firstCommand;
+        size_t count = (size_t)batch.commandCount;
+
+        sortKeys.resize(count);
+        sortOrder.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            GLuint instance = first[i].baseInstance;
+            float z = depthRow.x * bounds.x[instance] + depthRow.y * bounds.y[instance] + depthRow.z * bounds.z[instance] + depthRow.w;
+            unsigned int bits;
+            memcpy(&bits, &z, sizeof(bits));
+            sortKeys[i] = (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+            sortOrder[i] = (GLuint)i;
+        }
+        RadixSortByKey(sortKeys, sortOrder, sortKeysScratch, sortOrderScratch);
 
-    if (mesh.hasNormalMap) {
-        glEnableVertexAttribArray(3); glBindBuffer(GL_ARRAY_BUFFER, mesh.tangentBuffer);   glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-        glEnableVertexAttribArray(4); glBindBuffer(GL_ARRAY_BUFFER, mesh.bitangentBuffer); glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-    } else {
-        glDisableVertexAttribArray(3);
-        glDisableVertexAttribArray(4);
+        sortedCommands.resize(count);
+        for (size_t i = 0; i < count; i++) sortedCommands[i] = first[sortOrder[i]];
+        std::copy(sortedCommands.begin(), sortedCommands.end(), first);
     }
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.elementBuffer);
-    glUniform1f(uniforms.AlphaID, alpha);
+// The buffer is respecified (orphaned) each pass, so earlier passes' draws are left untouched
+void ClassroomSimulator::UploadCommands() {
+    if (!useMultiDrawIndirect) return; // The fallback reads drawCommands on the CPU
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, drawCommands.size() * sizeof(DrawCommand), drawCommands.data(), GL_STREAM_DRAW);
+}
+
+void ClassroomSimulator::SubmitCommands(const GeometryArena& arena, GLuint vertexArray, GLuint firstCommand, GLsizei commandCount, GLuint instanceDivisor)
+{
+    if (commandCount == 0) return; // Everything culled
+    glBindVertexArray(vertexArray);
+    profiler.countStateChange();
+
+    if (useMultiDrawIndirect) {
+        // The whole run in one call; the GPU reads the commands straight from indirectBuffer
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, arena.indexType, (void*)(firstCommand * sizeof(DrawCommand)), commandCount, sizeof(DrawCommand));
+        if (profiler.enabled) {
+            unsigned long long triangles = 0;
+            for (GLsizei i = 0; i < commandCount; i++) {
+                const DrawCommand& cmd = drawCommands[firstCommand + i];
+                triangles += (unsigned long long)(cmd.count / 3) * cmd.instanceCount;
+            }
+            profiler.countDraw(1, commandCount, triangles);
+        }
+        return;
+    }
 
-    // Instanced Draw Loop
-    for (const auto& modelMatrix : mesh.modelMatrices) {
-        glm::mat4 MVP = Projection * View * modelMatrix;
-        glUniformMatrix4fv(uniforms.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        glUniformMatrix4fv(uniforms.ModelMatrixID, 1, GL_FALSE, &modelMatrix[0][0]);
-        glDrawElements(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_SHORT, nullptr);
+    // GL 3.3: no base instance, so the instance attributes are re-pointed at each mesh's slice instead
+    GLsizei indexSize = arena.IndexSize();
+    GLuint currentBaseInstance = ~0u;
+    for (GLsizei i = 0; i < commandCount; i++) {
+        const DrawCommand& cmd = drawCommands[firstCommand + i];
+        if (cmd.baseInstance != currentBaseInstance) {
+            arena.AttachInstanceAttributes(cmd.baseInstance, instanceDivisor);
+            currentBaseInstance = cmd.baseInstance;
+            profiler.countStateChange();
+        }
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, cmd.count, arena.indexType,
+                                          (void*)((size_t)cmd.firstIndex * indexSize),
+                                          cmd.instanceCount, cmd.baseVertex);
+        profiler.countDraw(1, 1, (unsigned long long)(cmd.count / 3) * cmd.instanceCount);
     }
+}
+
+void ClassroomSimulator::DrawBatches(const std::vector<DrawBatch>& batches) 
+{
+    // Only rebind an array when the next batch actually uses a different one
+    GLuint bound[3] = { 0, 0, 0 };
+    for (const DrawBatch& batch : batches) {
+        if (batch.commandCount == 0) continue;
+        const GLuint arrays[3] = { batch.diffuseArray, batch.normalArray, batch.specularArray };
+        const GLenum units[3] = { GL_TEXTURE0, GL_TEXTURE2, GL_TEXTURE3 };
+        for (int i = 0; i < 3; i++) {
+            if (arrays[i] && arrays[i] != bound[i]) {
+                glActiveTexture(units[i]);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[i]);
+                bound[i] = arrays[i];
+                profiler.countStateChange();
+            }
+        }
 
-    glDisableVertexAttribArray(0); glDisableVertexAttribArray(1); glDisableVertexAttribArray(2);
+        // Materials and model matrices are fetched per instance in the shader
+        SubmitCommands(*batch.arena, batch.arena->vao, batch.firstCommand, batch.commandCount);
+    }
 }
 
-void ClassroomSimulator::DrawMeshShadow(const Mesh& mesh, GLuint depthMatrixID, const glm::mat4& dProj, const glm::mat4& dView) 
+void ClassroomSimulator::DrawDepthBatches(const std::vector<DrawBatch>& batches, GLuint layerCount) 
 {
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBuffer);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.elementBuffer);
+    for (const DrawBatch& batch : batches) {
+        if (layerCount == 1) {
+            SubmitCommands(*batch.arena, batch.arena->depthVao, batch.firstCommand, batch.commandCount);
+            continue;
+        }
+        if (batch.commandCount == 0) continue;
 
-    for (const auto& modelMatrix : mesh.modelMatrices) {
-        glm::mat4 depthMVP = dProj * dView * modelMatrix;
-        glUniformMatrix4fv(depthMatrixID, 1, GL_FALSE, &depthMVP[0][0]);
-        glDrawElements(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_SHORT, nullptr);
+        // Layered: each instance's attributes stay put for layerCount instances, then go back to normal
+        glBindVertexArray(batch.arena->depthVao);
+        batch.arena->SetInstanceDivisor(layerCount);
+        SubmitCommands(*batch.arena, batch.arena->depthVao, batch.firstCommand, batch.commandCount, layerCount);
+        batch.arena->SetInstanceDivisor(1);
     }
-    glDisableVertexAttribArray(0);
 }